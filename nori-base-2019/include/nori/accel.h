@@ -20,9 +20,60 @@
 #define __NORI_BVH_H
 
 #include <nori/mesh.h>
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#  include <malloc.h>
+#endif
+
+#define NORI_PACKET_SIZE 8 /* Number of rays traced together by Accel::rayIntersectPacket() */
+#if !defined(NORI_TRIANGLE_GROUP_SIZE)
+#  define NORI_TRIANGLE_GROUP_SIZE 4 /* Number of triangles tested together in BVH leaves (4 or 8) */
+#endif
+#define NORI_PAGE_SIZE 4096 /* Memory page size assumed by the layout of the wide BVH nodes */
 
 NORI_NAMESPACE_BEGIN
 
+struct PacketRays;
+
+/**
+ * \brief STL allocator that places arrays at the start of a memory page
+ *
+ * Used for the wide BVH nodes, so that the page-sized treelets created by
+ * Accel::reorder() coincide with actual pages.
+ */
+template <typename T> struct PageAlignedAllocator {
+    typedef T value_type;
+
+    PageAlignedAllocator() { }
+    template <typename U> PageAlignedAllocator(const PageAlignedAllocator<U> &) { }
+
+    T *allocate(size_t count) {
+        void *ptr = nullptr;
+#if defined(_WIN32)
+        ptr = _aligned_malloc(count * sizeof(T), NORI_PAGE_SIZE);
+#else
+        if (posix_memalign(&ptr, NORI_PAGE_SIZE, count * sizeof(T)) != 0)
+            ptr = nullptr;
+#endif
+        if (!ptr)
+            throw std::bad_alloc();
+        return static_cast<T *>(ptr);
+    }
+
+    void deallocate(T *ptr, size_t) {
+#if defined(_WIN32)
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    template <typename U> bool operator==(const PageAlignedAllocator<U> &) const { return true; }
+    template <typename U> bool operator!=(const PageAlignedAllocator<U> &) const { return false; }
+};
+
 /**
  * \brief Bounding Volume Hierarchy for fast ray intersection queries
  *
@@ -38,13 +89,144 @@ NORI_NAMESPACE_BEGIN
  * "Fast and Parallel Construction of SAH-based Bounding Volume Hierarchies"
  * by Ingo Wald (Proc. IEEE/EG Symposium on Interactive Ray Tracing, 2007)
  *
+ * After construction, the binary tree can optionally be collapsed into a
+ * 4- or 8-wide BVH, which stores the bounding boxes of all children of a
+ * node in SoA form so that they can be tested using a single SSE/AVX
+ * slab test. The layout is chosen using the <tt>accel</tt> property of
+ * the scene (one of <tt>bvh2</tt>, <tt>bvh4</tt>, or <tt>bvh8</tt>).
+ *
  * \author Wenzel Jakob
  */
 class Accel {
     friend class BVHBuildTask;
+    friend class SBVHBuilder;
+    friend class LBVHBuilder;
 public:
-    /// Create a new and empty BVH
-    Accel() { m_meshOffset.push_back(0u); }
+    /// Node layouts that can be used for ray traversal
+    enum ELayout {
+        /// Binary BVH, one bounding box test per visited node
+        EBinary = 2,
+        /// Collapsed 4-wide BVH, child boxes are tested using SSE
+        EWide4 = 4,
+        /// Collapsed 8-wide BVH, child boxes are tested using AVX
+        EWide8 = 8
+    };
+
+    /// Algorithms that can be used to construct the binary BVH
+    enum EBuilder {
+        /// Parallel binned SAH build with object splits
+        EObjectSplit = 0,
+        /// Serial SAH build that also considers spatial splits (SBVH)
+        ESpatialSplit,
+        /// Fast parallel build based on sorted Morton codes (LBVH)
+        ELinear
+    };
+
+    /// Ray queries distinguished by the traversal statistics
+    enum ERayType {
+        /// Closest-hit queries of camera rays, see \ref countPrimaryRays()
+        EPrimary = 0,
+        /// Other closest-hit queries (secondary rays)
+        EClosestHit,
+        /// Any-hit queries (shadow rays)
+        EShadow,
+        ERayTypeCount
+    };
+
+    /// Traversal counters of one type of ray query
+    struct TraversalCounters {
+        uint64_t rays = 0;       ///< Number of traced rays
+        uint64_t nodes = 0;      ///< Number of visited nodes (inner nodes and leaves)
+        uint64_t boxes = 0;      ///< Number of ray-box tests
+        uint64_t triangles = 0;  ///< Number of ray-triangle tests
+        uint64_t hits = 0;       ///< Number of rays that found an intersection
+
+        TraversalCounters &operator+=(const TraversalCounters &c) {
+            rays += c.rays; nodes += c.nodes; boxes += c.boxes;
+            triangles += c.triangles; hits += c.hits;
+            return *this;
+        }
+    };
+
+    /// Tunable parameters of the BVH construction
+    struct BuildParameters {
+        int binCount;              ///< Number of bins used by the parallel SAH build
+        uint32_t serialThreshold;  ///< Switch to a serial SAH build below this many triangles
+        uint32_t grainSize;        ///< Number of triangles per parallel work item
+        float traversalCost;       ///< Heuristic cost value for traversal operations
+        float intersectionCost;    ///< Heuristic cost value for intersection operations
+        uint32_t lbvhLeafSize;     ///< LBVH only, create a leaf when this many triangles are left
+
+        BuildParameters()
+            : binCount(16), serialThreshold(32), grainSize(1000), traversalCost(1.0f),
+              intersectionCost(1.0f), lbvhLeafSize(4) { }
+
+        /// Return a human-readable summary
+        std::string toString() const;
+    };
+
+    /// Traversal counters of all types of ray queries
+    struct TraversalStatistics {
+        TraversalCounters counters[ERayTypeCount];
+
+        TraversalStatistics &operator+=(const TraversalStatistics &s) {
+            for (int i=0; i<ERayTypeCount; ++i)
+                counters[i] += s.counters[i];
+            return *this;
+        }
+
+        /// Return a human-readable summary (averages per ray)
+        std::string toString() const;
+    };
+
+    /**
+     * \brief Create a new and empty BVH
+     *
+     * The following (optional) properties are recognized:
+     * <tt>accel</tt>: node layout used for traversal (<tt>bvh2</tt>,
+     * <tt>bvh4</tt> or <tt>bvh8</tt>). The binary tree is released once it
+     * has been collapsed into a wide one. Default: <tt>bvh4</tt>
+     * <tt>accelBuilder</tt>: construction algorithm (<tt>sah</tt>,
+     * <tt>sbvh</tt> or <tt>lbvh</tt>). Default: <tt>sah</tt>
+     * <tt>spatialSplitAlpha</tt>: SBVH only, spatial splits are tried when the
+     * children of the best object split overlap by more than this fraction
+     * of the scene's surface area. Default: <tt>1e-5</tt>
+     * <tt>lbvhRefine</tt>: LBVH only, build the top levels of the tree over
+     * clusters of nearby triangles using the SAH. Default: <tt>true</tt>
+     * <tt>accelCache</tt>: directory in which built BVHs are cached. The
+     * cache files are keyed by a hash of the mesh geometry and the build
+     * parameters, so later runs over the same meshes skip construction.
+     * Default: empty (caching disabled)
+     * <tt>accelQuantize</tt>: <tt>bvh4</tt>/<tt>bvh8</tt> only, store the
+     * child boxes of the wide nodes as 8-bit offsets relative to the parent,
+     * which shrinks the nodes to roughly half their size.
+     * Default: <tt>false</tt>
+     * <tt>accelReorder</tt>: <tt>bvh4</tt>/<tt>bvh8</tt> only, store the wide
+     * nodes in treelets that each fill one memory page and are laid out
+     * breadth-first, so that the top levels of the tree are contiguous and
+     * the nodes visited by a ray touch fewer memory pages.
+     * Default: <tt>true</tt>
+     * <tt>accelStatistics</tt>: count the nodes, boxes and triangles tested
+     * by every ray (see \ref getStatistics()) and log the properties of the
+     * tree after it has been built. Default: <tt>false</tt>
+     * <tt>refitThreshold</tt>: \ref refit() rebuilds the BVH from scratch
+     * once its SAH cost exceeds that of the last full build by this
+     * factor. Default: <tt>1.5</tt>
+     * <tt>removeThreshold</tt>: \ref removeMesh() rebuilds the triangle BVH
+     * once more than this fraction of its triangles has been removed.
+     * Default: <tt>0.25</tt>
+     * <tt>accelBinCount</tt>, <tt>accelSerialThreshold</tt>,
+     * <tt>accelGrainSize</tt>, <tt>accelTraversalCost</tt>,
+     * <tt>accelIntersectionCost</tt>, <tt>lbvhLeafSize</tt>: build
+     * parameters, see \ref BuildParameters. The ratio of the two costs
+     * controls how small the leaves of the SAH builders get.
+     * <tt>accelAutoTune</tt>: build the BVH with several settings, time a
+     * fixed workload of random rays, and keep the fastest. The chosen
+     * settings are kept in the <tt>accelCache</tt> and in memory (see
+     * \ref setMemoryCache()), so later runs over the same meshes skip the
+     * tuning. Default: <tt>false</tt>
+     */
+    Accel(const PropertyList &propList = PropertyList());
 
     /// Release all resources
     virtual ~Accel() { clear(); };
@@ -55,13 +237,52 @@ public:
     /**
      * \brief Register a triangle mesh for inclusion in the BVH.
      *
-     * This function can only be used before \ref build() is called
+     * The triangles of regular meshes are merged into a single BVH. An
+     * \ref Instance is instead placed into a top-level BVH that refers to
+     * a separate bottom-level BVH per shared mesh, so that adding further
+     * copies of a mesh doesn't increase the build cost or memory usage.
+     *
+     * When called after \ref build(), a regular mesh isn't merged into the
+     * triangle BVH. It gets a bottom-level BVH of its own instead, which is
+     * placed into the top-level BVH like an instance with an identity
+     * transformation. The cost is thus that of building a BVH over the new
+     * mesh and rebuilding the (small) top-level BVH. Such BVHs are neither
+     * auto-tuned nor cached, even if <tt>accelAutoTune</tt> or
+     * <tt>accelCache</tt> are set.
      */
     void addMesh(Mesh *mesh);
 
+    /**
+     * \brief Remove a mesh or instance that was registered using \ref addMesh()
+     *
+     * Instances and meshes added after \ref build() are simply dropped
+     * from the top-level BVH. The triangles of meshes that were merged
+     * into the triangle BVH are disabled in place instead, which costs
+     * time proportional to their number but doesn't shrink the boxes of
+     * the nodes containing them. To bound the traversal work wasted on
+     * these nodes, the triangle BVH is rebuilt without them once more than
+     * <tt>removeThreshold</tt> of its triangles have been removed.
+     *
+     * The BVH owns its meshes, so the mesh is deleted (the merged ones
+     * only when the triangle BVH is rebuilt) and must not be used afterwards.
+     */
+    void removeMesh(Mesh *mesh);
+
     /// Build the BVH
     void build();
 
+    /**
+     * \brief Update the BVH after the registered meshes or instances moved
+     *
+     * The bounding boxes of all nodes are recomputed bottom-up while the
+     * topology of the tree is kept, which is much cheaper than \ref build().
+     * The number of triangles of every mesh must not have changed. Since the quality of
+     * the tree degrades when the geometry moves far, it is rebuilt instead
+     * once its SAH cost grows past <tt>refitThreshold</tt> times the cost
+     * of the last full build.
+     */
+    void refit();
+
     /**
      * \brief Intersect a ray against all triangle meshes registered
      * with the BVH
@@ -80,9 +301,72 @@ public:
     bool rayIntersect(const Ray3f &ray, Intersection &its, 
         bool shadowRay = false) const;
 
-    /// Return the total number of meshes registered with the BVH
+    /**
+     * \brief Check whether a ray segment is occluded
+     *
+     * This is an any-hit query, which only considers the interval
+     * [<tt>ray.mint</tt>, <tt>ray.maxt</tt>] and stops as soon as
+     * any intersection is found.
+     *
+     * \return \c true If an intersection was found
+     */
+    bool occluded(const Ray3f &ray) const {
+        Intersection its; /* Unused */
+        return rayIntersect(ray, its, true);
+    }
+
+    /**
+     * \brief Intersect a packet of up to \ref NORI_PACKET_SIZE rays against
+     * all triangle meshes registered with the BVH
+     *
+     * The rays are traced through the BVH together: a node is visited
+     * once for all active rays overlapping its bounding box, and children
+     * are visited in front-to-back order with respect to the first active
+     * ray. This is considerably faster than tracing the rays one by one
+     * when they are coherent, e.g. for camera rays through neighboring
+     * pixels. All node layouts are supported; BVHs over instances trace
+     * the rays of a packet one at a time.
+     *
+     * \param rays
+     *    Array of \ref NORI_PACKET_SIZE rays
+     *
+     * \param its
+     *    Array of \ref NORI_PACKET_SIZE intersection records. Records of
+     *    active rays that find an intersection are filled in; all other
+     *    entries are left untouched.
+     *
+     * \param mask
+     *    Bit mask of the active rays; bit \c i refers to <tt>rays[i]</tt>
+     *
+     * \return A bit mask of the rays that found an intersection
+     */
+    uint32_t rayIntersectPacket(const Ray3f *rays, Intersection *its,
+        uint32_t mask) const;
+
+    /**
+     * \brief Fill in the intersection record of a ray with a known triangle
+     *
+     * This is used when the visible triangle was found without tracing
+     * the ray, e.g. by the \ref Rasterizer. The record is the same as the
+     * one that \ref rayIntersect() would return.
+     *
+     * \param mesh
+     *    Mesh (or \ref Instance) containing the triangle
+     * \param f
+     *    Index of the triangle within the mesh
+     * \param bary
+     *    Barycentric coordinates of the intersection with respect to
+     *    the second and third vertex of the triangle
+     */
+    void fillIntersection(const Ray3f &ray, const Mesh *mesh, uint32_t f,
+        const Point2f &bary, Intersection &its) const;
+
+    /// Return the total number of (non-instanced) meshes registered with the BVH
     uint32_t getMeshCount() const { return (uint32_t) m_meshes.size(); }
 
+    /// Return the total number of mesh instances registered with the BVH
+    uint32_t getInstanceCount() const { return (uint32_t) m_instances.size(); }
+
     /// Return the total number of internally represented triangles 
     uint32_t getTriangleCount() const { return m_meshOffset.back(); }
 
@@ -97,6 +381,73 @@ public:
         return m_bbox;
     }
 
+    /// Return the node layout used for traversal
+    ELayout getLayout() const { return m_layout; }
+
+    /// Return the parameters used to construct the BVH (chosen by auto-tuning, if enabled)
+    const BuildParameters &getBuildParameters() const { return m_params; }
+
+    /// Does this BVH record traversal statistics?
+    bool collectsStatistics() const { return m_statistics; }
+
+    /**
+     * \brief Return the traversal statistics of all BVHs that were created
+     * with <tt>accelStatistics</tt> enabled
+     *
+     * The counters are kept separately for every thread and are merged
+     * by this function, so it should be called once rendering is done.
+     */
+    static TraversalStatistics getStatistics();
+
+    /// Reset the traversal statistics returned by \ref getStatistics()
+    static void resetStatistics();
+
+    /**
+     * \brief Redirect the traversal statistics of the calling thread
+     *
+     * While set, every ray query issued by this thread is counted in
+     * \c stats (and not in \ref getStatistics()), regardless of the
+     * <tt>accelStatistics</tt> property. This makes it possible to measure
+     * the cost of individual rays, e.g. to render a heat map.
+     *
+     * \param stats
+     *    Counters to be used, or \c nullptr to restore the default
+     *
+     * \return The previously used counters
+     */
+    static TraversalStatistics *setThreadStatistics(TraversalStatistics *stats);
+
+    /**
+     * \brief Count the next closest-hit queries of the calling thread as
+     * primary rays
+     *
+     * The render loop calls this before tracing camera rays, so that the
+     * traversal statistics keep them apart from secondary rays. A packet
+     * uses up one query per active ray.
+     *
+     * \param count
+     *    Number of queries, or \c 0 to count all further queries as
+     *    secondary rays again
+     */
+    static void countPrimaryRays(uint32_t count);
+
+    /**
+     * \brief Keep the BVHs of the accels that are created from now on in
+     * memory, so that later scenes over the same meshes reuse them
+     *
+     * The BVHs are keyed like the files of the <tt>accelCache</tt>, i.e.
+     * by a hash of the mesh geometry and the build parameters. This is
+     * used when rendering several scenes in one process.
+     *
+     * \param capacity
+     *    Number of bytes the kept BVHs may take up. The least recently
+     *    used ones are released when a new BVH exceeds this bound.
+     */
+    static void setMemoryCache(bool enabled, size_t capacity = NORI_DEFAULT_CACHE_CAPACITY);
+
+    /// Release the BVHs kept in memory by \ref setMemoryCache()
+    static void clearMemoryCache();
+
 protected:
     /**
      * \brief Compute the mesh and triangle indices corresponding to 
@@ -120,8 +471,11 @@ protected:
         return m_meshes[meshIdx]->getCentroid(index);
     }
 
-    /// Compute internal tree statistics
-    std::pair<float, uint32_t> statistics(uint32_t index = 0) const;
+    /// Compute internal tree statistics (SAH cost and number of nodes)
+    std::pair<float, uint32_t> statistics() const;
+
+    /// Recursive helper function used by \ref statistics() for the binary tree
+    std::pair<float, uint32_t> statistics(uint32_t node_idx) const;
 
     /* BVH node in 32 bytes */
     struct BVHNode {
@@ -162,12 +516,274 @@ protected:
             return leaf.start + leaf.size;
         }
     };
+
+    /**
+     * \brief Collapsed N-wide BVH node
+     *
+     * The bounding boxes of all children are stored in SoA form
+     * (min x/y/z followed by max x/y/z). Unused child slots have an
+     * empty bounding box and are never reported as being hit.
+     */
+    template <int N> struct BVHWideNode {
+        enum { Width = N };
+        typedef float Bounds[6][N];
+
+        Bounds bounds;       ///< Child bounding boxes
+        uint32_t child[N];   ///< Inner: index of the child node, leaf: first index into m_indices
+        uint32_t count[N];   ///< Leaf: number of triangles, zero for inner children
+
+        bool isLeaf(int i) const { return count[i] != 0; }
+
+        /// Return the child bounding boxes (\c storage is unused)
+        const Bounds &getBounds(Bounds &) const { return bounds; }
+    };
+
+    /**
+     * \brief Collapsed N-wide BVH node with quantized child boxes
+     *
+     * The child boxes are stored on a grid of 255 cells per axis spanning
+     * the bounds of the node. They are rounded outwards, so the decoded
+     * boxes are conservative and traversal remains exact; the slightly
+     * larger boxes only cause a few additional node visits.
+     */
+    template <int N> struct BVHQuantizedNode {
+        enum { Width = N };
+        typedef float Bounds[6][N];
+
+        float origin[3];       ///< Minimum corner of the node's bounding box
+        float scale[3];        ///< Size of a grid cell along each axis
+        uint8_t bounds[6][N];  ///< Child bounding boxes in grid cells
+        uint32_t child[N];     ///< Inner: index of the child node, leaf: first index into m_indices
+        uint32_t count[N];     ///< Leaf: number of triangles, zero for inner children
+
+        bool isLeaf(int i) const { return count[i] != 0; }
+
+        /// Decode the child bounding boxes into \c storage
+        const Bounds &getBounds(Bounds &storage) const {
+            for (int k=0; k<6; ++k)
+                for (int i=0; i<N; ++i)
+                    storage[k][i] = origin[k % 3] + (float) bounds[k][i] * scale[k % 3];
+            return storage;
+        }
+    };
+
+    /// Array of collapsed wide nodes, see \ref reorder()
+    template <typename Node> using NodeArray = std::vector<Node, PageAlignedAllocator<Node>>;
+
+    /**
+     * \brief Group of triangles stored in BVH leaf order
+     *
+     * Lane \c j of group \c i describes the triangle referenced by
+     * <tt>m_indices[i * NORI_TRIANGLE_GROUP_SIZE + j]</tt>. The vertices
+     * are stored in SoA form, so that a leaf can be intersected a whole
+     * group at a time using SSE/AVX, without looking up the mesh or
+     * gathering vertex positions.
+     */
+    struct BVHTriangleGroup {
+        enum { Width = NORI_TRIANGLE_GROUP_SIZE };
+
+        float p[3][3][Width];   ///< Vertex positions, indexed by [vertex][axis][lane]
+        uint32_t mesh[Width];   ///< Index of the mesh containing the triangle
+        uint32_t index[Width];  ///< Index of the triangle within its mesh
+    };
+
+    /**
+     * \brief Instance record stored in the leaf order of the top-level BVH
+     *
+     * Rays are transformed into the object space of the instance without
+     * renormalizing the direction, so that distances along the ray remain
+     * valid in both spaces.
+     */
+    struct BVHInstance {
+        Instance *instance;         ///< Instance (provides the BSDF and transformation), \c nullptr for meshes added after build()
+        const Accel *accel;         ///< Bottom-level BVH over the shared mesh
+        Eigen::Matrix3f toLocal;    ///< Linear part of the world-to-object transformation
+        Vector3f toLocalOffset;     ///< Translation of the world-to-object transformation
+    };
+
+    /// Return the world-space bounding box of an instance record
+    const BoundingBox3f &getBoundingBox(const BVHInstance &record) const;
+
+    /// Build the bottom-level BVHs and the top-level BVH over all instances
+    void buildInstances();
+
+    /// Recursive helper function used by \ref buildInstances()
+    uint32_t buildInstances(uint32_t start, uint32_t end);
+
+    /// Update the instance transformations and rebuild the top-level BVH
+    void updateInstances();
+
+    /// Recompute \ref m_bbox from the meshes and instances that are still registered
+    void updateBoundingBox();
+
+    /// Delete the removed meshes and rebuild the triangle BVH over the remaining ones
+    void compact();
+
+    /// Build the triangle BVH (or load it from the cache)
+    void buildHierarchy();
+
+    /// Try several build parameters and build the BVH using the fastest ones
+    void autoTune();
+
+    /// Time the ray workload used by \ref autoTune(), returns milliseconds per pass
+    double benchmark(const std::vector<Ray3f> &rays) const;
+
+    /// Collapse (and quantize) the binary BVH according to the node layout
+    void buildWide();
+
+    /// Recursive helper function used by \ref refit(), returns the new bounding box of the node
+    BoundingBox3f refit(uint32_t node_idx, int depth);
+
+    /// Recursive helper function used by \ref refit() for collapsed wide trees (plain or quantized)
+    template <typename Node> BoundingBox3f refit(NodeArray<Node> &nodes,
+        uint32_t node_idx, int depth);
+
+    /// Return the counters that the current thread should update (\c nullptr if disabled)
+    TraversalCounters *getCounters(ERayType type) const;
+
+    /// Traverse the top-level BVH, returns the instance containing the closest triangle in \c instance
+    bool traverseInstances(Ray3f &ray, Intersection &its, bool shadowRay,
+        uint32_t &f, const BVHInstance *&instance, TraversalCounters *counters) const;
+
+    /// Traverse the triangle BVH using the configured node layout
+    bool traverse(Ray3f &ray, Intersection &its, bool shadowRay, uint32_t &f,
+        TraversalCounters *counters) const;
+
+    /**
+     * \brief Move every leaf of the binary BVH to a multiple of
+     * \c NORI_TRIANGLE_GROUP_SIZE in \ref m_indices
+     *
+     * This ensures that no triangle group is shared by two leaves. The gaps
+     * are filled with padding entries, which remain degenerate triangles.
+     */
+    void alignLeaves();
+
+    /// Fill \ref m_triangles based on the final order of \ref m_indices
+    void buildTriangles();
+
+    /// Collapse the binary BVH into an N-wide one (plain or quantized)
+    template <typename Node> void collapse(NodeArray<Node> &nodes) const;
+
+    /// Recursive helper function used by \ref collapse()
+    template <typename Node> uint32_t collapse(NodeArray<Node> &nodes, uint32_t node_idx) const;
+
+    /// Find the (up to N) binary nodes that become the children of a wide node, returns their number
+    template <int N> int gather(uint32_t node_idx, uint32_t (&children)[N]) const;
+
+    /// Return the number of wide nodes that \ref collapse() creates for a binary subtree
+    template <int N> uint32_t countWide(uint32_t node_idx) const;
+
+    /**
+     * \brief Reorder collapsed wide nodes into a cache-friendly layout
+     *
+     * The tree is cut into treelets that each fill one page of the
+     * (page-aligned) node array, which are stored in breadth-first order.
+     * Within a treelet, the nodes are stored breadth-first as well, which
+     * places the children of a node next to each other. Where a node would
+     * straddle a page boundary, an unused padding node is inserted instead.
+     * The root remains the first node.
+     */
+    template <typename Node> static void reorder(NodeArray<Node> &nodes);
+
+    /// Store a collapsed wide node in the given node format
+    template <int N> static void encode(const BVHWideNode<N> &node, BVHWideNode<N> &result) { result = node; }
+
+    /// Store a collapsed wide node in quantized form
+    template <int N> static void encode(const BVHWideNode<N> &node, BVHQuantizedNode<N> &qnode);
+
+    /// Recursive helper function used by \ref statistics() for collapsed wide trees
+    template <typename Node> std::pair<float, uint32_t> statistics(
+        const NodeArray<Node> &nodes, uint32_t node_idx) const;
+
+    /// Traverse the binary BVH, returns the index of the closest triangle in \c f
+    bool traverseBinary(Ray3f &ray, Intersection &its, bool shadowRay, uint32_t &f,
+        TraversalCounters *counters) const;
+
+    /// Traverse a collapsed wide BVH (plain or quantized), returns the index of the closest triangle in \c f
+    template <typename Node> bool traverseWide(const NodeArray<Node> &nodes,
+        Ray3f &ray, Intersection &its, bool shadowRay, uint32_t &f,
+        TraversalCounters *counters) const;
+
+    /// Traverse the binary BVH with a packet of rays, returns a bit mask of the rays that found an intersection
+    uint32_t traversePacketBinary(Ray3f *rays, Intersection *its, uint32_t *f,
+        PacketRays &packet, uint32_t mask, TraversalCounters *counters) const;
+
+    /// Traverse a collapsed wide BVH (plain or quantized) with a packet of rays
+    template <typename Node> uint32_t traversePacketWide(const NodeArray<Node> &nodes,
+        Ray3f *rays, Intersection *its, uint32_t *f, PacketRays &packet, uint32_t mask,
+        TraversalCounters *counters) const;
+
+    /// Intersect a ray against the triangles referenced by <tt>m_indices[start..end-1]</tt>
+    bool intersectLeaf(uint32_t start, uint32_t end, Ray3f &ray,
+        Intersection &its, bool shadowRay, uint32_t &f, TraversalCounters *counters) const;
+
+    /// Fill in the detailed intersection record for triangle \c f
+    void fillIntersection(Intersection &its, uint32_t f) const;
+
+    /// Transform an intersection record from the object space of an instance to world space
+    void fillIntersection(Intersection &its, const BVHInstance &instance) const;
+
+    /// Hash of the mesh geometry, shared by \ref getCacheKey() and \ref getTuningKey()
+    uint64_t getMeshKey() const;
+
+    /// Hash of the mesh geometry and build parameters identifying a cached BVH
+    uint64_t getCacheKey() const;
+
+    /// Hash of the mesh geometry and configured settings identifying the result of \ref autoTune()
+    uint64_t getTuningKey() const;
+
+    /// Look up the parameters that \ref autoTune() has chosen earlier, returns \c false if there are none
+    bool loadTuning(uint64_t key, BuildParameters &params) const;
+
+    /// Keep the parameters chosen by \ref autoTune() in the caches
+    void saveTuning(uint64_t key, const BuildParameters &params) const;
+
+    /// Load the BVH from a cache file, returns \c false if it is missing or stale
+    bool loadCache(const std::string &filename, uint64_t key);
+
+    /// Write the BVH to a cache file
+    void saveCache(const std::string &filename, uint64_t key) const;
+
+    /// Load the BVH from cached data in the format of the cache files, returns \c false if it is stale
+    bool readCache(const char *data, size_t size, uint64_t key);
+
+    /// Write the BVH in the format of the cache files
+    void writeCache(std::ostream &os, uint64_t key) const;
 private:
-    std::vector<Mesh *> m_meshes;       ///< List of meshes registered with the BVH
-    std::vector<uint32_t> m_meshOffset; ///< Index of the first triangle for each shape
-    std::vector<BVHNode> m_nodes;       ///< BVH nodes
-    std::vector<uint32_t> m_indices;    ///< Index references by BVH nodes
-    BoundingBox3f m_bbox;               ///< Bounding box of the entire BVH
+    std::vector<Mesh *> m_meshes;         ///< List of meshes registered with the BVH
+    std::vector<uint32_t> m_meshOffset;   ///< Index of the first triangle for each shape
+    std::vector<BVHNode> m_nodes;         ///< BVH nodes (only kept for the binary layout)
+    NodeArray<BVHWideNode<4>> m_nodes4; ///< Collapsed 4-wide BVH nodes (if enabled)
+    NodeArray<BVHWideNode<8>> m_nodes8; ///< Collapsed 8-wide BVH nodes (if enabled)
+    NodeArray<BVHQuantizedNode<4>> m_qnodes4; ///< Quantized 4-wide BVH nodes (if enabled)
+    NodeArray<BVHQuantizedNode<8>> m_qnodes8; ///< Quantized 8-wide BVH nodes (if enabled)
+    std::vector<uint32_t> m_indices;      ///< Index references by BVH nodes
+    std::vector<BVHTriangleGroup> m_triangles; ///< Triangle data in the order of m_indices
+    std::vector<BVHInstance> m_instances; ///< Mesh instances in the order of m_instanceNodes
+    std::vector<BVHNode> m_instanceNodes; ///< Top-level BVH nodes over the instances
+    std::vector<Accel *> m_prototypes;    ///< Bottom-level BVHs of the instanced meshes
+    std::vector<Accel *> m_objects;       ///< Bottom-level BVHs of the meshes added after build()
+    std::vector<uint8_t> m_removed;       ///< Per mesh: were its triangles removed from the triangle BVH?
+    uint32_t m_removedCount;              ///< Number of removed triangles that are still in the triangle BVH
+    std::vector<uint32_t> m_refOffset;    ///< Per triangle: first entry in m_refPositions (built on demand)
+    std::vector<uint32_t> m_refPositions; ///< Positions in m_indices, grouped by triangle
+    PropertyList m_propList;              ///< Configuration, used for the bottom-level BVHs
+    BoundingBox3f m_bbox;                 ///< Bounding box of the entire BVH
+    ELayout m_layout;                     ///< Node layout used for traversal
+    EBuilder m_builder;                   ///< Construction algorithm
+    float m_spatialSplitAlpha;            ///< Overlap threshold for spatial splits
+    BuildParameters m_params;             ///< Construction parameters
+    bool m_autoTune;                      ///< Choose the construction parameters by benchmarking?
+    bool m_lbvhRefine;                    ///< Build the top of the LBVH using the SAH?
+    bool m_quantize;                      ///< Store quantized wide nodes?
+    bool m_reorder;                       ///< Reorder the wide nodes into treelets?
+    bool m_statistics;                    ///< Record traversal statistics?
+    float m_refitThreshold;               ///< Relative SAH cost increase triggering a rebuild in refit()
+    float m_buildCost;                    ///< SAH cost after the last full build
+    float m_removeThreshold;              ///< Fraction of removed triangles triggering a rebuild in removeMesh()
+    bool m_built;                         ///< Has build() been called?
+    std::string m_cacheDir;               ///< Directory of the BVH cache (disabled if empty)
+    bool m_memoryCache;                   ///< Share the BVH with later accels, see setMemoryCache()
 };
 
 NORI_NAMESPACE_END
@@ -24,7 +24,7 @@
 
 #include <nori/color.h>
 #include <nori/vector.h>
-#include <tbb/mutex.h>
+#include <mutex>
 
 #define NORI_BLOCK_SIZE 32 /* Block size used for parallelization */
 
@@ -116,7 +116,7 @@ protected:
     float *m_weightsX = nullptr;
     float *m_weightsY = nullptr;
     float m_lookupFactor = 0;
-    mutable tbb::mutex m_mutex;
+    mutable std::mutex m_mutex;
 };
 
 /**
@@ -160,7 +160,7 @@ protected:
     int m_blocksLeft;
     int m_stepsLeft;
     int m_direction;
-    tbb::mutex m_mutex;
+    std::mutex m_mutex;
 };
 
 NORI_NAMESPACE_END
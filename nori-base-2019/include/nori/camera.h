@@ -57,6 +57,34 @@ public:
         const Point2f &samplePosition,
         const Point2f &apertureSample) const = 0;
 
+    /**
+     * \brief Return the projection used by the \ref Rasterizer
+     *
+     * Only cameras whose rays all start at a single center of projection
+     * can be rasterized. For those, this function provides the matrix that
+     * maps homogeneous world-space points to <tt>(x*w, y*w, z, w)</tt>,
+     * where <tt>(x, y)</tt> is the position on the film in fractional pixel
+     * coordinates and \c w is the depth along the viewing direction.
+     * Rays only cover depths between \c nearClip and \c farClip.
+     *
+     * \return \c false if the camera can't be rasterized
+     */
+    virtual bool getRasterTransform(Eigen::Matrix4f &worldToRaster,
+            float &nearClip, float &farClip) const {
+        return false;
+    }
+
+    /**
+     * \brief Return the number of views rendered by this camera
+     *
+     * A camera rig renders several views (e.g. from positions around an
+     * object), each of which is a camera of its own, see \ref getView().
+     */
+    virtual uint32_t getViewCount() const { return 1; }
+
+    /// Return one of the views rendered by this camera
+    virtual const Camera *getView(uint32_t index) const { return this; }
+
     /// Return the size of the output image in pixels
     const Vector2i &getOutputSize() const { return m_outputSize; }
 
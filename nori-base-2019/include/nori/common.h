@@ -59,6 +59,9 @@
 #define SQRT_TWO     1.41421356237309504880f
 #define INV_SQRT_TWO 0.70710678118654752440f
 
+/* Bytes kept by the OBJ and BVH memory caches, see setOBJCache() */
+#define NORI_DEFAULT_CACHE_CAPACITY (size_t(1) << 30)
+
 /* Forward declarations */
 namespace filesystem {
     class path;
@@ -122,7 +125,9 @@ class Bitmap;
 class BlockGenerator;
 class Camera;
 class ImageBlock;
+class Instance;
 class Integrator;
+struct Intersection;
 class KDTree;
 class Emitter;
 struct EmitterQueryRecord;
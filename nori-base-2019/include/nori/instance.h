@@ -0,0 +1,75 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+#include <nori/transform.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Transformed copy of a shared triangle mesh
+ *
+ * Scenes that place the same object several times (e.g. with different
+ * rotations, scales and translations) can reference its OBJ file from
+ * several \c instance meshes. The geometry is loaded only once and kept
+ * in object space. \ref Accel builds one BVH per shared mesh and a
+ * top-level BVH over the instances, which transforms rays into object
+ * space on entry.
+ *
+ * The following properties are recognized:
+ * <tt>filename</tt>: OBJ file containing the shared mesh
+ * <tt>toWorld</tt>: object-to-world transformation of this copy
+ *
+ * Every instance can have its own BSDF. Instances cannot be emitters.
+ */
+class Instance : public Mesh {
+public:
+    Instance(const PropertyList &propList);
+
+    /// Register a child object (only BSDFs are supported)
+    virtual void addChild(NoriObject *child);
+
+    /// Return the shared mesh in object space
+    const Mesh *getPrototype() const { return m_prototype.get(); }
+
+    /// Return the object-to-world transformation of this instance
+    const Transform &getTransform() const { return m_toWorld; }
+
+    /**
+     * \brief Apply a further transformation to this instance
+     *
+     * Only the transformation of the instance changes, the shared mesh
+     * is left untouched.
+     */
+    virtual void transform(const Transform &trafo);
+
+    /// Recompute the world-space bounding box (e.g. after the shared mesh was edited)
+    void updateBoundingBox();
+
+    /// Return a human-readable summary of this instance
+    std::string toString() const;
+
+protected:
+    std::shared_ptr<Mesh> m_prototype;   ///< Shared mesh in object space
+    Transform m_toWorld;                 ///< Object-to-world transformation
+};
+
+NORI_NAMESPACE_END
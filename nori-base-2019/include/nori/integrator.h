@@ -18,7 +18,7 @@
 
 #pragma once
 
-#include <nori/object.h>
+#include <nori/mesh.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -42,7 +42,9 @@ public:
 		EWhitted,
 		ELightDepthArea,
 		EWhittedNoShadows,
-		EDepthMapArea
+		EDepthMapArea,
+		EHeatmap,
+		ENormals
 	};
     /// Release all memory
     virtual ~Integrator() { }
@@ -64,6 +66,102 @@ public:
      */
     virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const = 0;
 
+    /**
+     * \brief Sample the incident radiance along a camera ray whose first
+     * intersection has already been found, e.g. using packet tracing or
+     * the \ref Rasterizer
+     *
+     * This is only called when \ref supportsPrimaryHits() returns \c true.
+     * The default implementation ignores the intersection record and
+     * calls \ref Li().
+     *
+     * \param its
+     *    Intersection record of the ray. <tt>its.mesh</tt> is \c nullptr
+     *    when the ray did not intersect the scene.
+     */
+    virtual Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+                          const Intersection &its) const {
+        return Li(scene, sampler, ray);
+    }
+
+    /// Can this integrator shade camera rays using a precomputed first intersection?
+    virtual bool supportsPrimaryHits() const { return false; }
+
+    /**
+     * \brief Sample the incident radiance along a batch of camera rays
+     *
+     * This is only called when \ref supportsRayStreams() returns \c true.
+     * Integrators implementing it advance all samples of the batch one
+     * bounce at a time and trace the rays of each bounce together using a
+     * \ref RayStream, which sorts them for coherence. The default
+     * implementation calls \ref Li() for every ray.
+     *
+     * \param rays
+     *    Array of \c count camera rays
+     * \param result
+     *    Array of \c count radiance estimates, which will be filled
+     */
+    virtual void LiStream(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+                          Color3f *result, uint32_t count) const {
+        for (uint32_t i = 0; i < count; ++i)
+            result[i] = Li(scene, sampler, rays[i]);
+    }
+
+    /// Can this integrator trace batches of samples using \ref LiStream()?
+    virtual bool supportsRayStreams() const { return false; }
+
+    /**
+     * \brief Return the number of images that are rendered at once
+     *
+     * Integrators with several outputs (e.g. one image per light position)
+     * compute all of them from the same camera samples, see
+     * \ref shadeOutputs().
+     */
+    virtual uint32_t getOutputCount() const { return 1; }
+
+    /// Return the suffix that is appended to the file name of an output, e.g. "_simple"
+    virtual std::string getOutputSuffix(uint32_t index) const {
+        return getTypeSuffix(getIntegratorType());
+    }
+
+    /**
+     * \brief Shade a batch of camera samples for all outputs
+     *
+     * The first intersections of the camera rays are found only once and
+     * stored in a G-buffer (rays, intersection records and the weights
+     * of the pixel samples), from which every output is then computed.
+     * This is only used when \ref getOutputCount() is larger than one and
+     * requires \ref supportsPrimaryHits(). The default implementation
+     * calls \ref shade() for the first output.
+     *
+     * \param rays
+     *    Array of \c count camera rays
+     * \param its
+     *    Array of \c count intersection records of the rays
+     * \param result
+     *    Array of <tt>getOutputCount() * count</tt> values, which will be
+     *    filled. The value of sample \c i in output \c k is stored at
+     *    <tt>result[k * count + i]</tt>
+     */
+    virtual void shadeOutputs(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+                              const Intersection *its, Color3f *result, uint32_t count) const {
+        for (uint32_t i = 0; i < count; ++i)
+            result[i] = shade(scene, sampler, rays[i], its[i]);
+    }
+
+    /// Return the file name suffix of the images rendered by an integrator type
+    static std::string getTypeSuffix(EIntegratorType type) {
+        switch (type) {
+            case ESimple: return "_simple";
+            case EDepthMap: return "_depthMap";
+            case ELightDepth: return "_lightDepth";
+            case ENoShadows: return "_noShadows";
+            case EHeatmap: return "_heatmap";
+            case ENormals: return "_normals";
+            default: return "";
+        }
+    }
+
     /**
      * \brief Return the type of object (i.e. Mesh/BSDF/etc.) 
      * provided by this instance
@@ -0,0 +1,120 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/common.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Thread-safe cache with a bound on the memory used by its entries
+ *
+ * When an insertion exceeds the capacity, the least recently used entries
+ * are released. Entries are handed out as shared pointers, so an evicted
+ * entry stays valid for as long as it is in use elsewhere.
+ */
+template <typename Key, typename Value> class LRUCache {
+public:
+    typedef std::shared_ptr<const Value> Pointer;
+
+    /// Create an empty cache that holds up to \c capacity bytes
+    LRUCache(size_t capacity) : m_capacity(capacity), m_size(0) { }
+
+    /// Change the capacity (in bytes), evicting entries if necessary
+    void setCapacity(size_t capacity) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_capacity = capacity;
+        evict();
+    }
+
+    /// Return the entry with the given key (or \c nullptr) and mark it as recently used
+    Pointer find(const Key &key) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it == m_index.end())
+            return nullptr;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return it->second->value;
+    }
+
+    /**
+     * \brief Insert or replace an entry that takes up \c size bytes
+     *
+     * Entries larger than the capacity aren't stored.
+     */
+    void insert(const Key &key, const Pointer &value, size_t size) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it != m_index.end()) {
+            m_size -= it->second->size;
+            m_entries.erase(it->second);
+            m_index.erase(it);
+        }
+        if (size > m_capacity)
+            return;
+
+        m_entries.push_front(Entry { key, value, size });
+        m_index[key] = m_entries.begin();
+        m_size += size;
+        evict();
+    }
+
+    /// Release all entries
+    void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_index.clear();
+        m_size = 0;
+    }
+
+    /// Return the number of bytes taken up by the entries
+    size_t getSize() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_size;
+    }
+
+private:
+    struct Entry {
+        Key key;
+        Pointer value;
+        size_t size;
+    };
+
+    /// Release the least recently used entries until the capacity is met
+    void evict() {
+        while (m_size > m_capacity && !m_entries.empty()) {
+            const Entry &entry = m_entries.back();
+            m_size -= entry.size;
+            m_index.erase(entry.key);
+            m_entries.pop_back();
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::list<Entry> m_entries;  ///< Entries, most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator> m_index;
+    size_t m_capacity;           ///< Maximum total size in bytes
+    size_t m_size;               ///< Current total size in bytes
+};
+
+NORI_NAMESPACE_END
@@ -22,6 +22,7 @@
 #include <nori/frame.h>
 #include <nori/bbox.h>
 #include <nori/dpdf.h>
+#include <nori/transform.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -144,6 +145,18 @@ public:
     /// Return a pointer to the triangle vertex index list
     const MatrixXu &getIndices() const { return m_F; }
 
+    /**
+     * \brief Replace the vertex positions, keeping the triangles
+     *
+     * The number of vertices must not change. The bounding box and the
+     * area sampling distribution are updated accordingly; a BVH containing
+     * the mesh can be updated afterwards using \ref Accel::refit().
+     */
+    void setVertexPositions(const MatrixXf &V);
+
+    /// Transform the vertex positions and normals, see \ref setVertexPositions()
+    virtual void transform(const Transform &trafo);
+
     /// Is this mesh an area emitter?
     bool isEmitter() const { return m_emitter != nullptr; }
 
@@ -192,4 +205,22 @@ protected:
 	DiscretePDF m_dPdf;
 };
 
+/**
+ * \brief Keep the geometry of the OBJ files that are loaded from now on in
+ * memory, so that later scenes referencing the same file (with the same
+ * transformation) copy it instead of parsing the file again
+ *
+ * Files are recognized by their name, size and modification time, so a
+ * file that changes between scenes is loaded again. This is used when
+ * rendering several scenes in one process.
+ *
+ * \param capacity
+ *    Number of bytes the kept geometry may take up. The least recently
+ *    used files are released when a new file exceeds this bound.
+ */
+extern void setOBJCache(bool enabled, size_t capacity = NORI_DEFAULT_CACHE_CAPACITY);
+
+/// Release the geometry kept in memory by \ref setOBJCache()
+extern void clearOBJCache();
+
 NORI_NAMESPACE_END
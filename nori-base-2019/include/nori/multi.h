@@ -0,0 +1,73 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/integrator.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Renders the images of several integrators in one pass
+ *
+ * The first hit of every camera sample is found once and then shaded by
+ * all integrators (see \ref Integrator::shadeOutputs()). The outputs of
+ * the integrators follow each other, each image is saved with the suffix
+ * of its integrator. Subclasses create the integrators themselves instead
+ * of nesting them in the XML file, e.g. the sweep integrator.
+ */
+class MultiIntegrator : public Integrator {
+public:
+    MultiIntegrator(const PropertyList &props);
+
+    /// Release the integrators
+    virtual ~MultiIntegrator();
+
+    /// Register a nested integrator
+    virtual void addChild(NoriObject *obj);
+
+    /// Check that every output is saved under its own name
+    virtual void activate();
+
+    virtual void preprocess(const Scene *scene);
+
+    /// Only used when there is a single output
+    virtual Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const;
+
+    virtual Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray,
+        const Intersection &its) const;
+
+    virtual void shadeOutputs(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+        const Intersection *its, Color3f *result, uint32_t count) const;
+
+    virtual uint32_t getOutputCount() const;
+
+    virtual std::string getOutputSuffix(uint32_t index) const;
+
+    /// Integrators that need more than the first hit (e.g. whitted) trace their own rays from shade()
+    virtual bool supportsPrimaryHits() const { return true; }
+
+    virtual EIntegratorType getIntegratorType() const;
+
+    virtual std::string toString() const;
+
+protected:
+    std::vector<Integrator *> integrators; ///< The integrators, in the order of their outputs
+};
+
+NORI_NAMESPACE_END
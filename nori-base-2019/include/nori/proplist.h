@@ -103,6 +103,15 @@ public:
 
     /// Get a transform property, and use a default value if it does not exist
     Transform getTransform(const std::string &name, const Transform &defaultValue) const;
+    /// Check whether a property exists
+    bool has(const std::string &name) const;
+
+    /// Return the XML tag of the type of a property (e.g. "point"), and throw an exception if it does not exist
+    std::string getType(const std::string &name) const;
+
+    /// Remove a property (e.g. before replacing its value), returns \c false if it did not exist
+    bool remove(const std::string &name);
+
 private:
     /* Custom variant data type (stores one of boolean/integer/float/...) */
     struct Property {
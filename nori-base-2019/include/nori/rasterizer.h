@@ -0,0 +1,130 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Tile-based software rasterizer that finds the first
+ * intersection of camera rays
+ *
+ * Integrators that only need the first hit of every camera sample (see
+ * \ref Integrator::supportsPrimaryHits()) don't need a BVH for it: all
+ * camera rays leave from the same point, so the surface visible along
+ * a ray can be found using a z-buffer instead.
+ *
+ * When the rasterizer is created, the triangles of all meshes are
+ * projected onto the film once and sorted into bins of
+ * \ref NORI_BLOCK_SIZE x \ref NORI_BLOCK_SIZE pixels, which match the
+ * image blocks rendered by the worker threads. A batch of samples is then
+ * resolved by testing the triangles of its bins against the samples of
+ * the pixels they overlap and keeping the closest one.
+ *
+ * Coverage and depth are computed using homogeneous 2D edge functions
+ * ("Triangle Scan Conversion using 2D Homogeneous Coordinates" by Olano
+ * and Greer), which handle triangles extending behind the camera without
+ * clipping them. The visible triangle is finally turned into the same
+ * \ref Intersection record that \ref Scene::rayIntersect() returns.
+ */
+class Rasterizer {
+public:
+    /// Project and bin the triangles of all meshes of the scene as seen by its camera
+    Rasterizer(const Scene *scene);
+
+    /// Project and bin the triangles of all meshes of the scene as seen by one of its views
+    Rasterizer(const Scene *scene, const Camera *camera);
+
+    /**
+     * \brief Project and bin the triangles of all meshes of the scene
+     * using an arbitrary projection, e.g. to render a shadow map
+     *
+     * \param worldToRaster
+     *    Projection in the form described in \ref Camera::getRasterTransform()
+     * \param size
+     *    Size of the image in pixels
+     * \param nearClip
+     *    Minimum depth of visible surfaces
+     * \param farClip
+     *    Maximum depth of visible surfaces (may be infinite)
+     */
+    Rasterizer(const Scene *scene, const Eigen::Matrix4f &worldToRaster,
+        const Vector2i &size, float nearClip, float farClip);
+
+    /**
+     * \brief Find the first intersection of a batch of camera rays
+     *
+     * \param samples
+     *    Film positions of the samples (in fractional pixel coordinates),
+     *    as passed to \ref Camera::sampleRay()
+     * \param rays
+     *    Camera rays of the samples
+     * \param its
+     *    Intersection records, which will be filled. <tt>its[i].mesh</tt>
+     *    is \c nullptr when sample \c i did not hit anything.
+     * \param count
+     *    Number of samples. The batch should cover a small region of the
+     *    film, such as an image block.
+     */
+    void rayIntersect(const Point2f *samples, const Ray3f *rays,
+        Intersection *its, uint32_t count) const;
+
+    /**
+     * \brief Render a depth map with one sample at the center of every pixel
+     *
+     * \param depth
+     *    Array of <tt>size.x() * size.y()</tt> entries in row-major order,
+     *    which receives the depth of the closest surface (or infinity)
+     */
+    void renderDepth(float *depth) const;
+
+    /// Return the number of triangles that were binned
+    uint32_t getTriangleCount() const { return (uint32_t) m_triangles.size(); }
+
+protected:
+    /// Triangle set up for rasterization
+    struct RasterTriangle {
+        float edge[3][3];      ///< Edge functions divided by the determinant, evaluated at (x - origin, 1)
+        float origin[2];       ///< Center of the covered pixels, improves the precision of the edge functions
+        int bounds[4];         ///< Covered pixels (min x, min y, max x, max y), inclusive
+        const Mesh *mesh;      ///< Mesh containing the triangle
+        uint32_t index;        ///< Index of the triangle within its mesh
+    };
+
+    /// Project, set up and bin the triangles of all meshes
+    void build(const Eigen::Matrix4f &worldToRaster);
+
+    /// Set up a triangle given its vertices in homogeneous raster space, returns \c false if it is not visible
+    bool setup(const Vector3f *p, RasterTriangle &tri) const;
+
+    /// Find the inverse depth and index of the closest triangle of every sample (\c -1 if none)
+    void resolve(const Point2f *samples, uint32_t count, float *invDepth, uint32_t *closest) const;
+
+private:
+    const Scene *m_scene;
+    float m_nearClip, m_farClip;                ///< Depth range covered by the camera rays
+    Vector2i m_size;                            ///< Size of the film in pixels
+    Vector2i m_binCount;                        ///< Number of bins along each axis
+    std::vector<RasterTriangle> m_triangles;    ///< All visible triangles
+    std::vector<uint32_t> m_binOffset;          ///< Per bin: first entry in m_binTriangles
+    std::vector<uint32_t> m_binTriangles;       ///< Triangle indices, grouped by bin
+};
+
+NORI_NAMESPACE_END
@@ -0,0 +1,88 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/mesh.h>
+
+#define NORI_STREAM_SIZE 4096 /* Number of camera samples that are rendered as one stream */
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Batch of ray queries that are traced in a coherent order
+ *
+ * Secondary rays (e.g. BSDF samples or shadow rays) of neighboring
+ * samples point in all directions, so tracing them one by one in the order
+ * in which they are generated thrashes the caches. A stream collects the
+ * rays of many samples first, sorts them by the octant of their direction
+ * and the cell of the scene containing their origin, and then traces them
+ * in that order. Consecutive closest-hit rays are traced as packets.
+ *
+ * Usage: queue the rays using \ref addRay() and \ref addShadowRay(),
+ * call \ref trace(), and look up the results using the returned indices.
+ */
+class RayStream {
+public:
+    /// Create an empty stream for queries against the given scene
+    RayStream(const Scene *scene);
+
+    /// Queue a closest-hit query, returns its index
+    uint32_t addRay(const Ray3f &ray);
+
+    /// Queue an any-hit query, returns its index
+    uint32_t addShadowRay(const Ray3f &ray);
+
+    /**
+     * \brief Queue an occlusion query between two points, returns its index
+     *
+     * Like \ref Scene::occluded(), the segment ends slightly before \c q.
+     */
+    uint32_t addShadowRay(const Point3f &p, const Point3f &q);
+
+    /// Trace all queued rays
+    void trace();
+
+    /// Did the query with the given index find an intersection?
+    bool hit(uint32_t index) const { return m_hit[index] != 0; }
+
+    /// Return the intersection record of a closest-hit query (only valid if \ref hit())
+    const Intersection &getIntersection(uint32_t index) const { return m_its[index]; }
+
+    /// Return the number of queued rays
+    uint32_t size() const { return (uint32_t) m_rays.size(); }
+
+    /// Remove all queued rays, keeping the allocated memory
+    void clear();
+
+protected:
+    /// Sort key: shadow flag, direction octant, Morton code of the origin cell
+    uint32_t getSortKey(const Ray3f &ray, bool shadowRay) const;
+
+private:
+    const Scene *m_scene;
+    BoundingBox3f m_bbox;             ///< Bounds of the scene, used to find the origin cells
+    std::vector<Ray3f> m_rays;        ///< Queued rays
+    std::vector<uint8_t> m_shadow;    ///< Is the query an any-hit query?
+    std::vector<uint8_t> m_hit;       ///< Results of the queries
+    std::vector<Intersection> m_its;  ///< Intersection records of the closest-hit queries
+    std::vector<uint64_t> m_order;    ///< Sort key (upper 32 bits) and index of every ray
+    std::vector<uint64_t> m_temp;     ///< Temporary storage of the radix sort
+};
+
+NORI_NAMESPACE_END
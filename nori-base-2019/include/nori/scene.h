@@ -40,14 +40,25 @@ public:
     /// Return a pointer to the scene's kd-tree
     const Accel *getAccel() const { return m_accel; }
 
+    /// Return a pointer to the scene's kd-tree (e.g. to refit it after editing meshes)
+    Accel *getAccel() { return m_accel; }
+
     /// Return a pointer to the scene's integrator
     const Integrator *getIntegrator() const { return m_integrator; }
 
     /// Return a pointer to the scene's integrator
     Integrator *getIntegrator() { return m_integrator; }
 
-    /// Return a pointer to the scene's camera
-    const Camera *getCamera() const { return m_camera; }
+    /// Return a pointer to the scene's camera (the first view if there are several)
+    const Camera *getCamera() const { return m_views.empty() ? nullptr : m_views[0]; }
+
+    /**
+     * \brief Return all views of the scene
+     *
+     * These are the cameras in the order in which they were specified, a
+     * camera rig contributes one entry per view (see \ref Camera::getView()).
+     */
+    const std::vector<const Camera *> &getCameras() const { return m_views; }
 
     /// Return a pointer to the scene's sample generator (const version)
     const Sampler *getSampler() const { return m_sampler; }
@@ -58,6 +69,18 @@ public:
     /// Return a reference to an array containing all meshes
     const std::vector<Mesh *> &getMeshes() const { return m_meshes; }
 
+    /**
+     * \brief Add an (activated) mesh to a scene that has already been
+     * activated, e.g. to render several variants of a scene
+     *
+     * Only the new mesh is processed, see \ref Accel::addMesh(). Integrators
+     * that cache the emitters must be preprocessed again afterwards.
+     */
+    void addMesh(Mesh *mesh);
+
+    /// Remove a mesh from the scene and delete it, see \ref Accel::removeMesh()
+    void removeMesh(Mesh *mesh);
+
     /**
      * \brief Intersect a ray against all triangles stored in the scene
      * and return detailed intersection information
@@ -92,8 +115,53 @@ public:
      * \return \c true if an intersection was found
      */
     bool rayIntersect(const Ray3f &ray) const {
-        Intersection its; /* Unused */
-        return m_accel->rayIntersect(ray, its, true);
+        return m_accel->occluded(ray);
+    }
+
+    /**
+     * \brief Intersect a packet of up to \ref NORI_PACKET_SIZE coherent rays
+     * against all triangles stored in the scene
+     *
+     * \param rays
+     *    Array of \ref NORI_PACKET_SIZE rays
+     *
+     * \param its
+     *    Array of \ref NORI_PACKET_SIZE intersection records, which will be
+     *    filled by the intersection query for all rays that hit something
+     *
+     * \param mask
+     *    Bit mask of the active rays
+     *
+     * \return A bit mask of the rays that found an intersection
+     */
+    uint32_t rayIntersectPacket(const Ray3f *rays, Intersection *its, uint32_t mask) const {
+        return m_accel->rayIntersectPacket(rays, its, mask);
+    }
+
+    /// Should camera rays be traced in packets when the integrator supports it?
+    bool usePacketTracing() const { return m_packetTracing; }
+
+    /// Should samples be rendered as sorted ray streams when the integrator supports it? (off by default)
+    bool useRayStreams() const { return m_rayStreams; }
+
+    /// Should the first hits of camera rays be found using the \ref Rasterizer when the integrator supports it?
+    bool useRasterization() const { return m_rasterize; }
+
+    /**
+     * \brief Check whether the segment between two points is occluded
+     *
+     * This is an any-hit query: traversal stops at the first intersection
+     * that is found. The segment ends slightly before \c q, so that the
+     * surface on which \c q lies (e.g. a light source) is not reported.
+     *
+     * \return \c true if some triangle blocks the segment from \c p to \c q
+     */
+    bool occluded(const Point3f &p, const Point3f &q) const {
+        Vector3f d = q - p;
+        float dist = d.norm();
+        if (dist == 0)
+            return false;
+        return m_accel->occluded(Ray3f(p, d / dist, Epsilon, dist * (1 - Epsilon)));
     }
 
     /// \brief Return an axis-aligned box that bounds the scene
@@ -124,8 +192,12 @@ private:
     std::vector<Mesh *> m_meshes;
     Integrator *m_integrator = nullptr;
     Sampler *m_sampler = nullptr;
-    Camera *m_camera = nullptr;
+    std::vector<Camera *> m_cameras;
+    std::vector<const Camera *> m_views;
     Accel *m_accel = nullptr;
+    bool m_packetTracing = true;
+    bool m_rayStreams = false;
+    bool m_rasterize = false;
 	std::vector<Mesh *> m_emitters;
 };
 
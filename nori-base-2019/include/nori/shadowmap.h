@@ -0,0 +1,66 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <nori/vector.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Omnidirectional (cube) shadow map of a point light
+ *
+ * The depth of the closest surface as seen from the light is rendered
+ * once into the six faces of a cube around it using the \ref Rasterizer.
+ * Afterwards, the visibility of a point from the light is a lookup into
+ * this map instead of a shadow ray.
+ *
+ * Lookups use percentage-closer filtering: the depth of the point is
+ * compared against the four nearest texels, and the results are blended
+ * bilinearly, which smooths the jagged edges of the shadows. A relative
+ * depth bias avoids self-shadowing due to the limited resolution.
+ */
+class ShadowMap {
+public:
+    /**
+     * \brief Render the shadow map of a point light
+     *
+     * \param position
+     *    Position of the light
+     * \param resolution
+     *    Width and height of each face in texels
+     * \param bias
+     *    Points count as lit when they are at most this fraction of
+     *    their distance behind the closest surface
+     */
+    ShadowMap(const Scene *scene, const Point3f &position, int resolution, float bias);
+
+    /// Return the fraction of the light that is visible from the point \c p
+    float visibility(const Point3f &p) const;
+
+    /// Return a human-readable summary
+    std::string toString() const;
+
+private:
+    Point3f m_position;          ///< Position of the light
+    int m_resolution;            ///< Size of the faces in texels
+    float m_bias;                ///< Relative depth bias
+    std::vector<float> m_depth;  ///< Depth along the axis of each face, six faces in a row
+};
+
+NORI_NAMESPACE_END
@@ -17,10 +17,35 @@
 */
 
 #include <nori/accel.h>
+#include <nori/instance.h>
+#include <nori/lrucache.h>
 #include <nori/timer.h>
 #include <tbb/tbb.h>
 #include <Eigen/Geometry>
+#include <pcg32.h>
 #include <atomic>
+#include <bitset>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#  define NORI_BVH_SSE 1
+#  include <immintrin.h>
+#endif
+
+#if defined(__AVX__)
+#  define NORI_BVH_AVX 1
+#endif
 
 /*
  * =======================================================================
@@ -33,46 +58,142 @@
 
 NORI_NAMESPACE_BEGIN
 
-/* Bin data structure for counting triangles and computing their bounding box */
+/// Return the number of triangle groups needed to store the given number of triangles
+inline uint32_t getGroupCount(size_t triangles) {
+    return (uint32_t) ((triangles + NORI_TRIANGLE_GROUP_SIZE - 1) / NORI_TRIANGLE_GROUP_SIZE);
+}
+
+/**
+ * \brief Return the number of triangle slots taken up by a leaf
+ *
+ * Leaves start at a group boundary (see Accel::alignLeaves()), and testing
+ * a partially filled group costs as much as testing a full one. The
+ * builders use this count for the SAH, which favors full groups.
+ */
+inline uint32_t getPaddedCount(uint32_t triangles) {
+    return getGroupCount(triangles) * NORI_TRIANGLE_GROUP_SIZE;
+}
+
+/* Entry of Accel::m_indices that pads a leaf to a whole number of groups */
+static const uint32_t PADDING_INDEX = 0xFFFFFFFFu;
+
+/* Bin data structure for counting triangles and computing their bounding box.
+   Only the first 'accelBinCount' entries are used */
 struct Bins {
-    static const int BIN_COUNT = 16;
-    Bins() { memset(counts, 0, sizeof(uint32_t) * BIN_COUNT); }
-    uint32_t counts[BIN_COUNT];
-    BoundingBox3f bbox[BIN_COUNT];
+    static const int MAX_BIN_COUNT = 64;
+    Bins() { memset(counts, 0, sizeof(uint32_t) * MAX_BIN_COUNT); }
+    uint32_t counts[MAX_BIN_COUNT];
+    BoundingBox3f bbox[MAX_BIN_COUNT];
 };
 
 /**
  * \brief Build task for parallel BVH construction
  *
- * This class uses the task scheduling system of Intel' Thread Building Blocks
- * to parallelize the divide and conquer BVH build at all levels.
+ * This class uses Intel's Thread Building Blocks to parallelize the divide
+ * and conquer BVH build at all levels: the triangles of a node are binned
+ * and partitioned in parallel, and the two subtrees are then built
+ * concurrently using \c tbb::parallel_invoke.
  *
  * The used methodology is roughly that described in
  * "Fast and Parallel Construction of SAH-based Bounding Volume Hierarchies"
  * by Ingo Wald (Proc. IEEE/EG Symposium on Interactive Ray Tracing, 2007)
  */
-class BVHBuildTask : public tbb::task {
-private:
-    Accel &bvh;
-    uint32_t node_idx;
-    uint32_t *start, *end, *temp;
-
+class BVHBuildTask {
 public:
-    /// Build-related parameters
-    enum {
-        /// Switch to a serial build when less than 32 triangles are left
-        SERIAL_THRESHOLD = 32,
+    /**
+     * \brief Node storage used during construction
+     *
+     * Unlike \ref Accel::m_nodes, the list can grow while other threads
+     * hold references to its entries. Nodes are only allocated when they
+     * are needed, in chunks of \c CHUNK_SIZE nodes, so the build doesn't
+     * have to reserve room for the worst case of 2N-1 nodes. The two
+     * children of an inner node are allocated next to each other, and
+     * <tt>inner.rightChild</tt> refers to the first of them until
+     * \ref linearize() rearranges the nodes.
+     */
+    class NodeList {
+    public:
+        enum {
+            /// Number of nodes per chunk (512 KiB)
+            CHUNK_BITS = 14,
+            CHUNK_SIZE = 1 << CHUNK_BITS
+        };
+
+        /// Create an empty list that can hold up to \c maxSize nodes
+        NodeList(uint32_t maxSize)
+            : m_chunkCount((maxSize >> CHUNK_BITS) + 1),
+              m_chunks(new std::atomic<Accel::BVHNode *>[m_chunkCount]), m_size(0) {
+            for (uint32_t i = 0; i < m_chunkCount; ++i)
+                m_chunks[i] = nullptr;
+        }
+
+        ~NodeList() {
+            for (uint32_t i = 0; i < m_chunkCount; ++i)
+                delete[] m_chunks[i].load();
+        }
+
+        /// Append \c count copies of \c node, returns the index of the first one
+        uint32_t grow(uint32_t count, const Accel::BVHNode &node) {
+            uint32_t first = m_size.fetch_add(count);
+            if ((uint64_t) first + count > (uint64_t) m_chunkCount << CHUNK_BITS)
+                throw NoriException("BVHBuildTask: exceeded the maximum number of nodes!");
+            for (uint32_t i = first; i < first + count; ++i)
+                getChunk(i >> CHUNK_BITS)[i & (CHUNK_SIZE - 1)] = node;
+            return first;
+        }
+
+        Accel::BVHNode &operator[](uint32_t i) {
+            return m_chunks[i >> CHUNK_BITS].load(std::memory_order_acquire)[i & (CHUNK_SIZE - 1)];
+        }
+
+        const Accel::BVHNode &operator[](uint32_t i) const {
+            return m_chunks[i >> CHUNK_BITS].load(std::memory_order_acquire)[i & (CHUNK_SIZE - 1)];
+        }
 
-        /// Process triangles in batches of 1K for the purpose of parallelization
-        GRAIN_SIZE = 1000,
+        uint32_t size() const { return m_size; }
+
+        /**
+         * \brief Move all nodes to the end of \c nodes, which must have
+         * enough capacity
+         *
+         * Every chunk is released as soon as it has been copied, so the
+         * nodes are never stored twice.
+         */
+        void moveTo(std::vector<Accel::BVHNode> &nodes) {
+            for (uint32_t i = 0; i < m_chunkCount; ++i) {
+                Accel::BVHNode *chunk = m_chunks[i].exchange(nullptr);
+                uint32_t first = i << CHUNK_BITS;
+                if (first < m_size)
+                    nodes.insert(nodes.end(), chunk, chunk + std::min((uint32_t) CHUNK_SIZE, m_size - first));
+                delete[] chunk;
+            }
+            m_size = 0;
+        }
 
-        /// Heuristic cost value for traversal operations
-        TRAVERSAL_COST = 1,
+    private:
+        /// Return the given chunk, allocating it if necessary
+        Accel::BVHNode *getChunk(uint32_t i) {
+            Accel::BVHNode *chunk = m_chunks[i].load(std::memory_order_acquire);
+            if (chunk)
+                return chunk;
+            Accel::BVHNode *fresh = new Accel::BVHNode[CHUNK_SIZE];
+            if (m_chunks[i].compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+                return fresh;
+            delete[] fresh; /* Another thread was faster */
+            return chunk;
+        }
 
-        /// Heuristic cost value for intersection operations
-        INTERSECTION_COST = 1
+        uint32_t m_chunkCount;
+        std::unique_ptr<std::atomic<Accel::BVHNode *>[]> m_chunks;
+        std::atomic<uint32_t> m_size;
     };
 
+private:
+    Accel &bvh;
+    NodeList &nodes;
+    uint32_t node_idx;
+    uint32_t *start, *end, *temp;
+
 public:
     /**
      * Create a new build task
@@ -80,6 +201,9 @@ public:
      * \param bvh
      *    Reference to the underlying BVH
      *
+     * \param nodes
+     *    Node storage of the build, see \ref NodeList
+     *
      * \param node_idx
      *    Index of the BVH node that should be built
      *
@@ -94,27 +218,90 @@ public:
      *    construction purposes. The usable length is <tt>end-start</tt>
      *    unsigned integers.
      */
-    BVHBuildTask(Accel &bvh, uint32_t node_idx, uint32_t *start, uint32_t *end, uint32_t *temp)
-        : bvh(bvh), node_idx(node_idx), start(start), end(end), temp(temp) { }
+    BVHBuildTask(Accel &bvh, NodeList &nodes, uint32_t node_idx, uint32_t *start, uint32_t *end, uint32_t *temp)
+        : bvh(bvh), nodes(nodes), node_idx(node_idx), start(start), end(end), temp(temp) { }
+
+    /// Allocate a node with the given bounding box, returns its index
+    static uint32_t allocate(NodeList &nodes, const BoundingBox3f &bbox = BoundingBox3f()) {
+        Accel::BVHNode node;
+        node.data = 0;
+        node.bbox = bbox;
+        return nodes.grow(1, node);
+    }
+
+    /// Allocate the two children of an inner node next to each other, returns the first index
+    static uint32_t allocateChildren(NodeList &nodes) {
+        Accel::BVHNode node;
+        node.data = 0;
+        return nodes.grow(2, node);
+    }
+
+    /**
+     * \brief Move the nodes into <tt>bvh.m_nodes</tt> in depth-first order
+     *
+     * This establishes the layout expected by traversal: the left child
+     * of an inner node directly follows its parent. The nodes are moved
+     * over in allocation order and then permuted in place, so that the
+     * peak memory usage is that of one copy of the tree plus an index
+     * per node.
+     */
+    static void linearize(Accel &bvh, NodeList &nodes) {
+        uint32_t size = nodes.size();
+
+        /* Find the depth-first position of every node */
+        std::vector<uint32_t> position(size), stack(1, 0u);
+        uint32_t next = 0;
+        while (!stack.empty()) {
+            uint32_t node_idx = stack.back();
+            stack.pop_back();
+            position[node_idx] = next++;
+            const Accel::BVHNode &node = nodes[node_idx];
+            if (node.isInner()) {
+                stack.push_back(node.inner.rightChild + 1);
+                stack.push_back(node.inner.rightChild);
+            }
+        }
+
+        std::vector<Accel::BVHNode> &result = bvh.m_nodes;
+        std::vector<Accel::BVHNode>().swap(result);
+        result.reserve(size);
+        nodes.moveTo(result);
+
+        for (Accel::BVHNode &node : result) {
+            if (node.isInner())
+                node.inner.rightChild = position[node.inner.rightChild + 1];
+        }
 
-    task *execute() {
+        /* Apply the permutation by following its cycles */
+        for (uint32_t i = 0; i < size; ++i) {
+            while (position[i] != i) {
+                uint32_t j = position[i];
+                std::swap(result[i], result[j]);
+                std::swap(position[i], position[j]);
+            }
+        }
+    }
+
+    void execute() {
+        const Accel::BuildParameters &params = bvh.m_params;
+        const int binCount = params.binCount;
         uint32_t size = (uint32_t) (end-start);
-        Accel::BVHNode &node = bvh.m_nodes[node_idx];
+        Accel::BVHNode &node = nodes[node_idx];
 
-        /* Switch to a serial build when less than SERIAL_THRESHOLD triangles are left */
-        if (size < SERIAL_THRESHOLD) {
-            execute_serially(bvh, node_idx, start, end, temp);
-            return nullptr;
+        /* Switch to a serial build when only a few triangles are left */
+        if (size < params.serialThreshold) {
+            execute_serially(bvh, nodes, node_idx, start, end, temp);
+            return;
         }
 
         /* Always split along the largest axis */
         int axis = node.bbox.getLargestAxis();
         float min = node.bbox.min[axis], max = node.bbox.max[axis],
-              inv_bin_size = Bins::BIN_COUNT / (max-min);
+              inv_bin_size = binCount / (max-min);
 
         /* Accumulate all triangles into bins */
         Bins bins = tbb::parallel_reduce(
-            tbb::blocked_range<uint32_t>(0u, size, GRAIN_SIZE),
+            tbb::blocked_range<uint32_t>(0u, size, params.grainSize),
             Bins(),
             /* MAP: Bin a number of triangles and return the resulting 'Bins' data structure */
             [&](const tbb::blocked_range<uint32_t> &range, Bins result) {
@@ -124,7 +311,7 @@ public:
 
                     int index = std::min(std::max(
                         (int) ((centroid - min) * inv_bin_size), 0),
-                        (Bins::BIN_COUNT - 1));
+                        (binCount - 1));
 
                     result.counts[index]++;
                     result.bbox[index].expandBy(bvh.getBoundingBox(f));
@@ -132,9 +319,9 @@ public:
                 return result;
             },
             /* REDUCE: Combine two 'Bins' data structures */
-            [](const Bins &b1, const Bins &b2) {
+            [binCount](const Bins &b1, const Bins &b2) {
                 Bins result;
-                for (int i=0; i < Bins::BIN_COUNT; ++i) {
+                for (int i=0; i < binCount; ++i) {
                     result.counts[i] = b1.counts[i] + b2.counts[i];
                     result.bbox[i] = BoundingBox3f::merge(b1.bbox[i], b2.bbox[i]);
                 }
@@ -143,23 +330,23 @@ public:
         );
 
         /* Choose the best split plane based on the binned data */
-        BoundingBox3f bbox_left[Bins::BIN_COUNT];
+        BoundingBox3f bbox_left[Bins::MAX_BIN_COUNT];
         bbox_left[0] = bins.bbox[0];
-        for (int i=1; i<Bins::BIN_COUNT; ++i) {
+        for (int i=1; i<binCount; ++i) {
             bins.counts[i] += bins.counts[i-1];
             bbox_left[i] = BoundingBox3f::merge(bbox_left[i-1], bins.bbox[i]);
         }
 
-        BoundingBox3f bbox_right = bins.bbox[Bins::BIN_COUNT-1], best_bbox_right;
+        BoundingBox3f bbox_right = bins.bbox[binCount-1], best_bbox_right;
         int64_t best_index = -1;
-        float best_cost = (float) INTERSECTION_COST * size;
-        float tri_factor = (float) INTERSECTION_COST / node.bbox.getSurfaceArea();
+        float best_cost = params.intersectionCost * getPaddedCount(size);
+        float tri_factor = params.intersectionCost / node.bbox.getSurfaceArea();
 
-        for (int i=Bins::BIN_COUNT - 2; i >= 0; --i) {
+        for (int i=binCount - 2; i >= 0; --i) {
             uint32_t prims_left = bins.counts[i], prims_right = (uint32_t) (end - start) - bins.counts[i];
-            float sah_cost = 2.0f * TRAVERSAL_COST +
-                tri_factor * (prims_left * bbox_left[i].getSurfaceArea() +
-                              prims_right * bbox_right.getSurfaceArea());
+            float sah_cost = 2.0f * params.traversalCost +
+                tri_factor * (getPaddedCount(prims_left) * bbox_left[i].getSurfaceArea() +
+                              getPaddedCount(prims_right) * bbox_right.getSurfaceArea());
             if (sah_cost < best_cost) {
                 best_cost = sah_cost;
                 best_index = i;
@@ -171,17 +358,17 @@ public:
         if (best_index == -1) {
             /* Could not find a good split plane -- retry with
                more careful serial code just to be sure.. */
-            execute_serially(bvh, node_idx, start, end, temp);
-            return nullptr;
+            execute_serially(bvh, nodes, node_idx, start, end, temp);
+            return;
         }
 
         uint32_t left_count = bins.counts[best_index];
-        int node_idx_left = node_idx+1;
-        int node_idx_right = node_idx+2*left_count;
+        uint32_t node_idx_left = allocateChildren(nodes);
+        uint32_t node_idx_right = node_idx_left + 1;
 
-        bvh.m_nodes[node_idx_left ].bbox = bbox_left[best_index];
-        bvh.m_nodes[node_idx_right].bbox = best_bbox_right;
-        node.inner.rightChild = node_idx_right;
+        nodes[node_idx_left ].bbox = bbox_left[best_index];
+        nodes[node_idx_right].bbox = best_bbox_right;
+        node.inner.rightChild = node_idx_left;
         node.inner.axis = axis;
         node.inner.flag = 0;
 
@@ -189,7 +376,7 @@ public:
                               offset_right(bins.counts[best_index]);
 
         tbb::parallel_for(
-            tbb::blocked_range<uint32_t>(0u, size, GRAIN_SIZE),
+            tbb::blocked_range<uint32_t>(0u, size, params.grainSize),
             [&](const tbb::blocked_range<uint32_t> &range) {
                 uint32_t count_left = 0, count_right = 0;
                 for (uint32_t i = range.begin(); i != range.end(); ++i) {
@@ -214,29 +401,26 @@ public:
         memcpy(start, temp, size * sizeof(uint32_t));
         assert(offset_left == left_count && offset_right == size);
 
-        /* Create an empty parent task */
-        tbb::task& c = *new (allocate_continuation()) tbb::empty_task;
-        c.set_ref_count(2);
-
-        /* Post right subtree to scheduler */
-        BVHBuildTask &b = *new (c.allocate_child())
-            BVHBuildTask(bvh, node_idx_right, start + left_count,
-                         end, temp + left_count);
-        spawn(b);
-
-        /* Directly start working on left subtree */
-        recycle_as_child_of(c);
-        node_idx = node_idx_left;
-        end = start + left_count;
-
-        return this;
+        /* Build both subtrees concurrently. The two halves of the index
+           and temporary arrays are disjoint, hence no locking is needed */
+        tbb::parallel_invoke(
+            [&] {
+                BVHBuildTask(bvh, nodes, node_idx_left, start,
+                             start + left_count, temp).execute();
+            },
+            [&] {
+                BVHBuildTask(bvh, nodes, node_idx_right, start + left_count,
+                             end, temp + left_count).execute();
+            }
+        );
     }
 
     /// Single-threaded build function
-    static void execute_serially(Accel &bvh, uint32_t node_idx, uint32_t *start, uint32_t *end, uint32_t *temp) {
-        Accel::BVHNode &node = bvh.m_nodes[node_idx];
+    static void execute_serially(Accel &bvh, NodeList &nodes, uint32_t node_idx, uint32_t *start, uint32_t *end, uint32_t *temp) {
+        const Accel::BuildParameters &params = bvh.m_params;
+        Accel::BVHNode &node = nodes[node_idx];
         uint32_t size = (uint32_t) (end - start);
-        float best_cost = (float) INTERSECTION_COST * size;
+        float best_cost = params.intersectionCost * getPaddedCount(size);
         int64_t best_index = -1, best_axis = -1;
         float *left_areas = (float *) temp;
 
@@ -259,17 +443,17 @@ public:
             bbox.reset();
 
             /* Choose the best split plane */
-            float tri_factor = INTERSECTION_COST / node.bbox.getSurfaceArea();
+            float tri_factor = params.intersectionCost / node.bbox.getSurfaceArea();
             for (uint32_t i = size-1; i>=1; --i) {
                 uint32_t f = *(start + i);
                 bbox.expandBy(bvh.getBoundingBox(f));
 
                 float left_area = left_areas[i-1];
                 float right_area = bbox.getSurfaceArea();
-                uint32_t prims_left = i;
-                uint32_t prims_right = size-i;
+                uint32_t prims_left = getPaddedCount(i);
+                uint32_t prims_right = getPaddedCount(size-i);
 
-                float sah_cost = 2.0f * TRAVERSAL_COST +
+                float sah_cost = 2.0f * params.traversalCost +
                     tri_factor * (prims_left * left_area +
                                   prims_right * right_area);
 
@@ -294,213 +478,3010 @@ public:
         });
 
         uint32_t left_count = (uint32_t) best_index;
-        uint32_t node_idx_left = node_idx + 1;
-        uint32_t node_idx_right = node_idx + 2 * left_count;
-        node.inner.rightChild = node_idx_right;
+        uint32_t node_idx_left = allocateChildren(nodes);
+        uint32_t node_idx_right = node_idx_left + 1;
+        node.inner.rightChild = node_idx_left;
         node.inner.axis = best_axis;
         node.inner.flag = 0;
 
-        execute_serially(bvh, node_idx_left, start, start + left_count, temp);
-        execute_serially(bvh, node_idx_right, start+left_count, end, temp + left_count);
+        execute_serially(bvh, nodes, node_idx_left, start, start + left_count, temp);
+        execute_serially(bvh, nodes, node_idx_right, start+left_count, end, temp + left_count);
     }
-};
 
-void Accel::addMesh(Mesh *mesh) {
-    m_meshes.push_back(mesh);
-    m_meshOffset.push_back(m_meshOffset.back() + mesh->getTriangleCount());
-    m_bbox.expandBy(mesh->getBoundingBox());
-}
+};
 
-void Accel::clear() {
-    for (auto mesh : m_meshes)
-        delete mesh;
-    m_meshes.clear();
-    m_meshOffset.clear();
-    m_meshOffset.push_back(0u);
-    m_nodes.clear();
-    m_indices.clear();
-    m_bbox.reset();
-    m_nodes.shrink_to_fit();
-    m_meshes.shrink_to_fit();
-    m_meshOffset.shrink_to_fit();
-    m_indices.shrink_to_fit();
-}
+/**
+ * \brief Builder for a BVH with spatial splits (SBVH)
+ *
+ * Object splits partition the triangles of a node, which leads to heavily
+ * overlapping children when triangles are large or long and thin compared
+ * to the node (e.g. the walls and the light of a Cornell box). A spatial
+ * split instead cuts the node with an axis-aligned plane and references
+ * straddling triangles from both children, with their bounding boxes
+ * clipped against the plane. The builder chooses whichever of the two
+ * split types has the lower SAH cost.
+ *
+ * Spatial splits are only attempted when the best object split has
+ * children that overlap by more than \c alpha times the surface area of
+ * the whole scene, which keeps the number of duplicated references small.
+ *
+ * The methodology is that described in "Spatial Splits in Bounding Volume
+ * Hierarchies" by Martin Stich, Heiko Friedrich and Andreas Dietrich
+ * (Proc. High Performance Graphics, 2009). The build is serial; the nodes
+ * are emitted in depth-first order and don't need to be compactified.
+ */
+class SBVHBuilder {
+public:
+    /// Build-related parameters
+    enum {
+        /// Number of bins used to search for spatial splits along each axis
+        SPATIAL_BIN_COUNT = 32,
 
-void Accel::build() {
-    uint32_t size  = getTriangleCount();
-    if (size == 0)
-        return;
-    //cout << "Constructing a SAH BVH (" << m_meshes.size()
-    //    << (m_meshes.size() == 1 ? " mesh, " : " meshes, ")
-    //    << size << " triangles) .. ";
-    //cout.flush();
-    Timer timer;
+        /// Don't create deeper trees than this (traversal uses fixed-size stacks)
+        MAX_DEPTH = 48
+    };
 
-    /* Conservative estimate for the total number of nodes */
-    m_nodes.resize(2*size);
-    memset(m_nodes.data(), 0, sizeof(BVHNode) * m_nodes.size());
-    m_nodes[0].bbox = m_bbox;
-    m_indices.resize(size);
+    /// Triangle reference with a (potentially clipped) bounding box
+    struct Reference {
+        uint32_t f;
+        BoundingBox3f bbox;
+    };
 
-    if (sizeof(BVHNode) != 32)
-        throw NoriException("BVH Node is not packed! Investigate compiler settings.");
+    SBVHBuilder(Accel &bvh, float alpha) : bvh(bvh) {
+        minOverlap = alpha * bvh.m_bbox.getSurfaceArea();
+    }
 
-    for (uint32_t i = 0; i < size; ++i)
-        m_indices[i] = i;
+    /// Build the BVH into <tt>bvh.m_nodes</tt> and <tt>bvh.m_indices</tt>
+    void build() {
+        uint32_t size = bvh.getTriangleCount();
+        std::vector<Reference> refs(size);
+        tbb::parallel_for(
+            tbb::blocked_range<uint32_t>(0u, size, bvh.m_params.grainSize),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                for (uint32_t i = range.begin(); i != range.end(); ++i)
+                    refs[i] = Reference { i, bvh.getBoundingBox(i) };
+            }
+        );
 
-    uint32_t *indices = m_indices.data(), *temp = new uint32_t[size];
-    BVHBuildTask& task = *new(tbb::task::allocate_root())
-        BVHBuildTask(*this, 0u, indices, indices + size , temp);
-    tbb::task::spawn_root_and_wait(task);
-    delete[] temp;
-    std::pair<float, uint32_t> stats = statistics();
+        bvh.m_nodes.clear();
+        bvh.m_indices.clear();
+        bvh.m_indices.reserve(size + size / 4);
+        buildNode(refs, bvh.m_bbox, 0);
+        bvh.m_nodes.shrink_to_fit();
+        bvh.m_indices.shrink_to_fit();
+    }
 
-    /* The node array was allocated conservatively and now contains
-       many unused entries -- do a compactification pass. */
-    std::vector<BVHNode> compactified(stats.second);
-    std::vector<uint32_t> skipped_accum(m_nodes.size());
+private:
+    /// Description of the best split plane found for a node
+    struct Split {
+        float cost = std::numeric_limits<float>::infinity();
+        int axis = -1;
+        bool spatial = false;
+        uint32_t index = 0;   ///< Object split: number of references on the left
+        float pos = 0;        ///< Spatial split: position of the split plane
+        BoundingBox3f left, right;
+    };
 
-    for (int64_t i = stats.second-1, j = m_nodes.size(), skipped = 0; i >= 0; --i) {
-        while (m_nodes[--j].isUnused())
-            skipped++;
-        BVHNode &new_node = compactified[i];
-        new_node = m_nodes[j];
-        skipped_accum[j] = (uint32_t) skipped;
+    /// Recursively build the subtree for the given references, returns the node index
+    uint32_t buildNode(std::vector<Reference> &refs, const BoundingBox3f &bbox, int depth) {
+        uint32_t node_idx = (uint32_t) bvh.m_nodes.size();
+        uint32_t size = (uint32_t) refs.size();
+        bvh.m_nodes.emplace_back();
+        bvh.m_nodes[node_idx].data = 0;
+        bvh.m_nodes[node_idx].bbox = bbox;
+
+        Split split;
+        if (size > 1 && depth < MAX_DEPTH) {
+            findObjectSplit(refs, bbox, split);
+
+            BoundingBox3f overlap = split.left;
+            overlap.clip(split.right);
+            if (overlap.isValid() && overlap.getSurfaceArea() > minOverlap)
+                findSpatialSplit(refs, bbox, split);
+        }
 
-        if (new_node.isInner()) {
-            new_node.inner.rightChild = (uint32_t)
-                (i + new_node.inner.rightChild - j -
-                (skipped - skipped_accum[new_node.inner.rightChild]));
+        if (split.axis == -1 || split.cost >= bvh.m_params.intersectionCost * getPaddedCount(size)) {
+            /* Splitting does not reduce the cost, make a leaf */
+            Accel::BVHNode &node = bvh.m_nodes[node_idx];
+            node.leaf.flag = 1;
+            node.leaf.start = (uint32_t) bvh.m_indices.size();
+            node.leaf.size = size;
+            for (const Reference &ref : refs)
+                bvh.m_indices.push_back(ref.f);
+            return node_idx;
         }
+
+        std::vector<Reference> left, right;
+        if (split.spatial)
+            partitionSpatial(refs, split, left, right);
+        else
+            partitionObject(refs, split, left, right);
+        std::vector<Reference>().swap(refs);
+
+        /* The binned estimates are conservative, recompute the child boxes */
+        BoundingBox3f right_bbox = getBoundingBox(right);
+        buildNode(left, getBoundingBox(left), depth + 1);
+        std::vector<Reference>().swap(left);
+        uint32_t right_idx = buildNode(right, right_bbox, depth + 1);
+
+        Accel::BVHNode &node = bvh.m_nodes[node_idx];
+        node.inner.flag = 0;
+        node.inner.axis = split.axis;
+        node.inner.rightChild = right_idx;
+        return node_idx;
     }
-    /*cout << "done (took " << timer.elapsedString() << " and "
-        << memString(sizeof(BVHNode) * m_nodes.size() + sizeof(uint32_t)*m_indices.size())
-        << ", SAH cost = " << stats.first
-        << ")." << endl;*/
 
-    m_nodes = std::move(compactified);
-}
+    /// Sweep over the sorted reference centroids along every axis
+    void findObjectSplit(std::vector<Reference> &refs, const BoundingBox3f &bbox, Split &split) const {
+        uint32_t size = (uint32_t) refs.size();
+        float tri_factor = bvh.m_params.intersectionCost / bbox.getSurfaceArea();
+        std::vector<BoundingBox3f> left_bboxes(size);
 
-std::pair<float, uint32_t> Accel::statistics(uint32_t node_idx) const {
-    const BVHNode &node = m_nodes[node_idx];
-    if (node.isLeaf()) {
-        return std::make_pair((float) BVHBuildTask::INTERSECTION_COST * node.leaf.size, 1u);
-    } else {
-        std::pair<float, uint32_t> stats_left = statistics(node_idx + 1u);
-        std::pair<float, uint32_t> stats_right = statistics(node.inner.rightChild);
-        float saLeft = m_nodes[node_idx + 1u].bbox.getSurfaceArea();
-        float saRight = m_nodes[node.inner.rightChild].bbox.getSurfaceArea();
-        float saCur = node.bbox.getSurfaceArea();
-        float sahCost =
-            2 * BVHBuildTask::TRAVERSAL_COST +
-            (saLeft * stats_left.first + saRight * stats_right.first) / saCur;
-        return std::make_pair(
-            sahCost,
-            stats_left.second + stats_right.second + 1u
-        );
+        for (int axis=0; axis<3; ++axis) {
+            sortReferences(refs, axis);
+
+            BoundingBox3f box;
+            for (uint32_t i = 0; i<size; ++i) {
+                box.expandBy(refs[i].bbox);
+                left_bboxes[i] = box;
+            }
+
+            box.reset();
+            for (uint32_t i = size-1; i>=1; --i) {
+                box.expandBy(refs[i].bbox);
+                float sah_cost = 2.0f * bvh.m_params.traversalCost +
+                    tri_factor * (getPaddedCount(i) * left_bboxes[i-1].getSurfaceArea() +
+                                  getPaddedCount(size - i) * box.getSurfaceArea());
+                if (sah_cost < split.cost) {
+                    split.cost = sah_cost;
+                    split.axis = axis;
+                    split.index = i;
+                    split.left = left_bboxes[i-1];
+                    split.right = box;
+                }
+            }
+        }
     }
-}
 
-bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) const {
-    uint32_t node_idx = 0, stack_idx = 0, stack[64];
+    /// Bin the clipped references along every axis and look for a cheaper spatial split
+    void findSpatialSplit(const std::vector<Reference> &refs, const BoundingBox3f &bbox, Split &split) const {
+        float tri_factor = bvh.m_params.intersectionCost / bbox.getSurfaceArea();
 
-    its.t = std::numeric_limits<float>::infinity();
+        for (int axis=0; axis<3; ++axis) {
+            float min = bbox.min[axis], extent = bbox.max[axis] - min;
+            if (extent <= 0)
+                continue;
+            float bin_size = extent / SPATIAL_BIN_COUNT;
+
+            BoundingBox3f bins[SPATIAL_BIN_COUNT];
+            uint32_t enter[SPATIAL_BIN_COUNT] = { 0 }, exit[SPATIAL_BIN_COUNT] = { 0 };
+
+            /* Chop each reference into the bins that it overlaps */
+            for (const Reference &ref : refs) {
+                int first = binIndex(ref.bbox.min[axis], min, bin_size),
+                    last  = binIndex(ref.bbox.max[axis], min, bin_size);
+                Reference cur = ref, left, right;
+                for (int i = first; i < last; ++i) {
+                    splitReference(cur, axis, min + (i + 1) * bin_size, left, right);
+                    bins[i].expandBy(left.bbox);
+                    cur = right;
+                }
+                bins[last].expandBy(cur.bbox);
+                enter[first]++;
+                exit[last]++;
+            }
 
-    /* Use an adaptive ray epsilon */
-    Ray3f ray(_ray);
-    if (ray.mint == Epsilon)
-        ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+            /* Sweep from the right to accumulate the right child boxes */
+            BoundingBox3f right_bboxes[SPATIAL_BIN_COUNT];
+            uint32_t right_counts[SPATIAL_BIN_COUNT];
+            BoundingBox3f box;
+            uint32_t count = 0;
+            for (int i = SPATIAL_BIN_COUNT-1; i > 0; --i) {
+                box.expandBy(bins[i]);
+                count += exit[i];
+                right_bboxes[i] = box;
+                right_counts[i] = count;
+            }
 
-    if (m_nodes.empty() || ray.maxt < ray.mint)
-        return false;
+            box.reset();
+            count = 0;
+            for (int i = 0; i < SPATIAL_BIN_COUNT-1; ++i) {
+                box.expandBy(bins[i]);
+                count += enter[i];
+                if (count == 0 || right_counts[i+1] == 0)
+                    continue;
+                float sah_cost = 2.0f * bvh.m_params.traversalCost +
+                    tri_factor * (getPaddedCount(count) * box.getSurfaceArea() +
+                                  getPaddedCount(right_counts[i+1]) * right_bboxes[i+1].getSurfaceArea());
+                if (sah_cost < split.cost) {
+                    split.cost = sah_cost;
+                    split.axis = axis;
+                    split.spatial = true;
+                    split.pos = min + (i + 1) * bin_size;
+                    split.left = box;
+                    split.right = right_bboxes[i+1];
+                }
+            }
+        }
+    }
 
-    bool foundIntersection = false;
-    uint32_t f = 0;
+    /// Distribute the references according to an object split
+    void partitionObject(std::vector<Reference> &refs, const Split &split,
+            std::vector<Reference> &left, std::vector<Reference> &right) const {
+        sortReferences(refs, split.axis);
+        left.assign(refs.begin(), refs.begin() + split.index);
+        right.assign(refs.begin() + split.index, refs.end());
+    }
 
-    while (true) {
-        const BVHNode &node = m_nodes[node_idx];
+    /// Distribute the references according to a spatial split, straddling ones go to both sides
+    void partitionSpatial(const std::vector<Reference> &refs, const Split &split,
+            std::vector<Reference> &left, std::vector<Reference> &right) const {
+        int axis = split.axis;
+        for (const Reference &ref : refs) {
+            if (ref.bbox.max[axis] <= split.pos) {
+                left.push_back(ref);
+            } else if (ref.bbox.min[axis] >= split.pos) {
+                right.push_back(ref);
+            } else {
+                Reference l, r;
+                splitReference(ref, axis, split.pos, l, r);
+                if (l.bbox.isValid())
+                    left.push_back(l);
+                if (r.bbox.isValid())
+                    right.push_back(r);
+            }
+        }
 
-        if (!node.bbox.rayIntersect(ray)) {
-            if (stack_idx == 0)
-                break;
-            node_idx = stack[--stack_idx];
-            continue;
+        /* Clipping is done in floating point -- never end up with an empty side */
+        if (left.empty() || right.empty()) {
+            std::vector<Reference> all(refs);
+            Split object;
+            object.axis = axis;
+            object.index = (uint32_t) all.size() / 2;
+            left.clear(); right.clear();
+            partitionObject(all, object, left, right);
         }
+    }
 
-        if (node.isInner()) {
-            stack[stack_idx++] = node.inner.rightChild;
-            node_idx++;
-            assert(stack_idx<64);
-        } else {
-            for (uint32_t i = node.start(), end = node.end(); i < end; ++i) {
-                uint32_t idx = m_indices[i];
-                const Mesh *mesh = m_meshes[findMesh(idx)];
-
-                float u, v, t;
-                if (mesh->rayIntersect(idx, ray, u, v, t)) {
-                    if (shadowRay)
-                        return true;
-                    foundIntersection = true;
-                    ray.maxt = its.t = t;
-                    its.uv = Point2f(u, v);
-                    its.mesh = mesh;
-                    f = idx;
-                }
+    /// Split a reference with the plane <tt>x[axis] = pos</tt>
+    void splitReference(const Reference &ref, int axis, float pos,
+            Reference &left, Reference &right) const {
+        uint32_t idx = ref.f;
+        uint32_t meshIdx = bvh.findMesh(idx);
+        const MatrixXf &V = bvh.m_meshes[meshIdx]->getVertexPositions();
+        const MatrixXu &F = bvh.m_meshes[meshIdx]->getIndices();
+
+        left.f = right.f = ref.f;
+        left.bbox.reset();
+        right.bbox.reset();
+
+        /* Walk along the triangle edges and collect the vertices and
+           plane crossings on either side */
+        for (int i=0; i<3; ++i) {
+            Point3f v0 = V.col(F(i, idx)), v1 = V.col(F((i+1) % 3, idx));
+            float a = v0[axis], b = v1[axis];
+            if (a <= pos)
+                left.bbox.expandBy(v0);
+            if (a >= pos)
+                right.bbox.expandBy(v0);
+            if ((a < pos && pos < b) || (b < pos && pos < a)) {
+                float t = clamp((pos - a) / (b - a), 0.0f, 1.0f);
+                Point3f p = v0 + (v1 - v0) * t;
+                left.bbox.expandBy(p);
+                right.bbox.expandBy(p);
             }
-            if (stack_idx == 0)
-                break;
-            node_idx = stack[--stack_idx];
-            continue;
         }
+
+        left.bbox.max[axis] = pos;
+        right.bbox.min[axis] = pos;
+        left.bbox.clip(ref.bbox);
+        right.bbox.clip(ref.bbox);
     }
 
-    if (foundIntersection) {
-        /* Find the barycentric coordinates */
-        Vector3f bary;
-        bary << 1-its.uv.sum(), its.uv;
-
-        /* References to all relevant mesh buffers */
-        const Mesh *mesh   = its.mesh;
-        const MatrixXf &V  = mesh->getVertexPositions();
-        const MatrixXf &N  = mesh->getVertexNormals();
-        const MatrixXf &UV = mesh->getVertexTexCoords();
-        const MatrixXu &F  = mesh->getIndices();
-
-        /* Vertex indices of the triangle */
-        uint32_t idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
-
-        Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
-
-        /* Compute the intersection positon accurately
-           using barycentric coordinates */
-        its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
-
-        /* Compute proper texture coordinates if provided by the mesh */
-        if (UV.size() > 0)
-            its.uv = bary.x() * UV.col(idx0),
-                bary.y() * UV.col(idx1),
-                bary.z() * UV.col(idx2);
-
-        /* Compute the geometry frame */
-        its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
-
-        if (N.size() > 0) {
-            /* Compute the shading frame. Note that for simplicity,
-               the current implementation doesn't attempt to provide
-               tangents that are continuous across the surface. That
-               means that this code will need to be modified to be able
-               use anisotropic BRDFs, which need tangent continuity */
-
-            its.shFrame = Frame(
-                (bary.x() * N.col(idx0) +
-                 bary.y() * N.col(idx1) +
-                 bary.z() * N.col(idx2)).normalized());
-        } else {
-            its.shFrame = its.geoFrame;
+    static BoundingBox3f getBoundingBox(const std::vector<Reference> &refs) {
+        BoundingBox3f bbox;
+        for (const Reference &ref : refs)
+            bbox.expandBy(ref.bbox);
+        return bbox;
+    }
+
+    static int binIndex(float x, float min, float bin_size) {
+        return std::min(std::max((int) ((x - min) / bin_size), 0), SPATIAL_BIN_COUNT - 1);
+    }
+
+    static void sortReferences(std::vector<Reference> &refs, int axis) {
+        std::sort(refs.begin(), refs.end(), [axis](const Reference &r1, const Reference &r2) {
+            float c1 = r1.bbox.min[axis] + r1.bbox.max[axis],
+                  c2 = r2.bbox.min[axis] + r2.bbox.max[axis];
+            return c1 < c2 || (c1 == c2 && r1.f < r2.f);
+        });
+    }
+
+private:
+    Accel &bvh;
+    float minOverlap;
+};
+
+/**
+ * \brief Linear BVH builder based on Morton codes (LBVH)
+ *
+ * The triangle centroids are quantized to a 3D grid and sorted along the
+ * Z-order curve using a parallel radix sort. The hierarchy is then emitted
+ * by recursively splitting each range of triangles where the highest
+ * differing bit of their Morton codes changes. This is much faster than a
+ * SAH build at the price of tree quality.
+ *
+ * When <tt>refineTop</tt> is set, the triangles are grouped into clusters
+ * that share the first \c CLUSTER_BITS bits of their Morton codes, and the
+ * top levels of the tree are built over these clusters using the SAH
+ * (following "HLBVH: Hierarchical LBVH Construction for Real-Time Ray
+ * Tracing of Dynamic Geometry" by Jacopo Pantaleoni and David Luebke,
+ * Proc. High Performance Graphics, 2010). This recovers most of the
+ * quality lost near the root, where it matters most.
+ *
+ * The nodes are laid out like those of \ref BVHBuildTask and need to be
+ * compactified afterwards.
+ */
+class LBVHBuilder {
+public:
+    /// Build-related parameters
+    enum {
+        /// Number of bits used to quantize the centroids along each axis
+        MORTON_BITS = 10,
+
+        /// Length of the Morton code prefix shared by the triangles of a cluster
+        CLUSTER_BITS = 12,
+
+        /// Switch to a serial hierarchy emission when less than 1K triangles are left
+        SERIAL_THRESHOLD = 1024
+    };
+
+    LBVHBuilder(Accel &bvh, BVHBuildTask::NodeList &nodes, bool refineTop)
+        : bvh(bvh), nodes(nodes), refineTop(refineTop) { }
+
+    /// Build the BVH below the root of \c nodes and fill <tt>bvh.m_indices</tt>
+    void build() {
+        uint32_t size = bvh.getTriangleCount();
+
+        /* Look up the bounding boxes only once, and compute the centroid bounds */
+        bboxes.resize(size);
+        BoundingBox3f centroidBounds = tbb::parallel_reduce(
+            tbb::blocked_range<uint32_t>(0u, size, bvh.m_params.grainSize),
+            BoundingBox3f(),
+            [&](const tbb::blocked_range<uint32_t> &range, BoundingBox3f result) {
+                for (uint32_t i = range.begin(); i != range.end(); ++i) {
+                    bboxes[i] = bvh.getBoundingBox(i);
+                    result.expandBy(bboxes[i].getCenter());
+                }
+                return result;
+            },
+            [](const BoundingBox3f &b1, const BoundingBox3f &b2) {
+                return BoundingBox3f::merge(b1, b2);
+            }
+        );
+
+        /* Compute the Morton codes */
+        std::vector<MortonPrimitive> prims(size), temp(size);
+        Vector3f scale;
+        for (int axis=0; axis<3; ++axis) {
+            float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+            scale[axis] = extent > 0 ? (1 << MORTON_BITS) / extent : 0.0f;
+        }
+        tbb::parallel_for(
+            tbb::blocked_range<uint32_t>(0u, size, bvh.m_params.grainSize),
+            [&](const tbb::blocked_range<uint32_t> &range) {
+                for (uint32_t i = range.begin(); i != range.end(); ++i) {
+                    Vector3f p = (bboxes[i].getCenter() - centroidBounds.min).cwiseProduct(scale);
+                    uint32_t x = std::min((uint32_t) p.x(), (1u << MORTON_BITS) - 1),
+                             y = std::min((uint32_t) p.y(), (1u << MORTON_BITS) - 1),
+                             z = std::min((uint32_t) p.z(), (1u << MORTON_BITS) - 1);
+                    prims[i].code = (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+                    prims[i].index = i;
+                }
+            }
+        );
+
+        radixSort(prims, temp, bvh.m_params.grainSize);
+
+        bvh.m_indices.resize(size);
+        codes.resize(size);
+
+        if (!refineTop) {
+            for (uint32_t i = 0; i < size; ++i) {
+                bvh.m_indices[i] = prims[i].index;
+                codes[i] = prims[i].code;
+            }
+            emit(0, 0, size);
+            return;
+        }
+
+        /* Split the sorted triangles into clusters with a common Morton code prefix */
+        const int shift = 3 * MORTON_BITS - CLUSTER_BITS;
+        std::vector<Cluster> clusters;
+        for (uint32_t i = 0; i < size; ++i) {
+            if (i == 0 || (prims[i].code >> shift) != (prims[i-1].code >> shift))
+                clusters.push_back(Cluster { i, i, BoundingBox3f() });
+            clusters.back().end = i + 1;
         }
+
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0u, clusters.size()),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    Cluster &cluster = clusters[i];
+                    for (uint32_t j = cluster.start; j < cluster.end; ++j)
+                        cluster.bbox.expandBy(bboxes[prims[j].index]);
+                }
+            }
+        );
+
+        /* Build the top levels over the clusters using the SAH. This
+           decides where the triangles of each cluster end up */
+        std::vector<ClusterTask> tasks;
+        buildTop(0, clusters.data(), clusters.data() + clusters.size(), 0, tasks);
+
+        /* Emit the hierarchies within the clusters */
+        tbb::parallel_for(
+            tbb::blocked_range<size_t>(0u, tasks.size()),
+            [&](const tbb::blocked_range<size_t> &range) {
+                for (size_t i = range.begin(); i != range.end(); ++i) {
+                    const ClusterTask &task = tasks[i];
+                    uint32_t count = task.cluster.end - task.cluster.start;
+                    for (uint32_t j = 0; j < count; ++j) {
+                        const MortonPrimitive &prim = prims[task.cluster.start + j];
+                        bvh.m_indices[task.offset + j] = prim.index;
+                        codes[task.offset + j] = prim.code;
+                    }
+                    emit(task.node_idx, task.offset, task.offset + count);
+                }
+            }
+        );
     }
 
-    return foundIntersection;
+private:
+    struct MortonPrimitive {
+        uint32_t code;
+        uint32_t index;
+    };
+
+    /// Triangles <tt>[start, end)</tt> of the Morton-sorted list sharing a code prefix
+    struct Cluster {
+        uint32_t start, end;
+        BoundingBox3f bbox;
+    };
+
+    /// Cluster placed at a leaf of the top levels, still to be emitted
+    struct ClusterTask {
+        Cluster cluster;
+        uint32_t node_idx;
+        uint32_t offset;   ///< Position of the cluster's triangles in bvh.m_indices
+    };
+
+    /// Insert two zero bits after each of the 10 low bits of \c x
+    static uint32_t expandBits(uint32_t x) {
+        x = (x | (x << 16)) & 0x030000FF;
+        x = (x | (x <<  8)) & 0x0300F00F;
+        x = (x | (x <<  4)) & 0x030C30C3;
+        x = (x | (x <<  2)) & 0x09249249;
+        return x;
+    }
+
+    /// Index of the highest set bit
+    static int highestBit(uint32_t value) {
+        int bit = 0;
+        while (value >>= 1)
+            ++bit;
+        return bit;
+    }
+
+    /**
+     * \brief Parallel LSD radix sort by Morton code
+     *
+     * Every pass histograms blocks of the input in parallel and then
+     * scatters them in parallel. The offsets are ordered by digit and
+     * then by block, which keeps each pass stable.
+     */
+    static void radixSort(std::vector<MortonPrimitive> &prims, std::vector<MortonPrimitive> &temp,
+            uint32_t grainSize) {
+        const int DIGIT_BITS = 8, BUCKETS = 1 << DIGIT_BITS;
+        const uint32_t size = (uint32_t) prims.size();
+        const uint32_t blockCount = std::max(1u, std::min(64u, size / grainSize));
+        const uint32_t blockSize = (size + blockCount - 1) / blockCount;
+        std::vector<uint32_t> offsets(blockCount * BUCKETS);
+
+        for (int shift = 0; shift < 3 * MORTON_BITS; shift += DIGIT_BITS) {
+            std::fill(offsets.begin(), offsets.end(), 0u);
+
+            tbb::parallel_for(
+                tbb::blocked_range<uint32_t>(0u, blockCount, 1),
+                [&](const tbb::blocked_range<uint32_t> &range) {
+                    for (uint32_t b = range.begin(); b != range.end(); ++b) {
+                        uint32_t *histogram = &offsets[b * BUCKETS];
+                        for (uint32_t i = b * blockSize; i < std::min(size, (b + 1) * blockSize); ++i)
+                            histogram[(prims[i].code >> shift) & (BUCKETS - 1)]++;
+                    }
+                }
+            );
+
+            uint32_t sum = 0;
+            for (int digit = 0; digit < BUCKETS; ++digit) {
+                for (uint32_t b = 0; b < blockCount; ++b) {
+                    uint32_t count = offsets[b * BUCKETS + digit];
+                    offsets[b * BUCKETS + digit] = sum;
+                    sum += count;
+                }
+            }
+
+            tbb::parallel_for(
+                tbb::blocked_range<uint32_t>(0u, blockCount, 1),
+                [&](const tbb::blocked_range<uint32_t> &range) {
+                    for (uint32_t b = range.begin(); b != range.end(); ++b) {
+                        uint32_t *offset = &offsets[b * BUCKETS];
+                        for (uint32_t i = b * blockSize; i < std::min(size, (b + 1) * blockSize); ++i)
+                            temp[offset[(prims[i].code >> shift) & (BUCKETS - 1)]++] = prims[i];
+                    }
+                }
+            );
+
+            prims.swap(temp);
+        }
+    }
+
+    /// SAH build of the top levels over the clusters <tt>[begin, end)</tt>
+    void buildTop(uint32_t node_idx, Cluster *begin, Cluster *end, uint32_t offset,
+            std::vector<ClusterTask> &tasks) {
+        uint32_t count = (uint32_t) (end - begin);
+        if (count == 1) {
+            tasks.push_back(ClusterTask { *begin, node_idx, offset });
+            return;
+        }
+
+        auto centroidLess = [](int axis) {
+            return [axis](const Cluster &c1, const Cluster &c2) {
+                return c1.bbox.getCenter()[axis] < c2.bbox.getCenter()[axis];
+            };
+        };
+
+        /* Sweep over the clusters sorted along every axis */
+        std::vector<float> left_areas(count);
+        std::vector<uint32_t> left_prims(count);
+        float best_cost = std::numeric_limits<float>::infinity();
+        uint32_t best_index = count / 2;
+        int best_axis = 0;
+        BoundingBox3f bbox;
+
+        for (int axis=0; axis<3; ++axis) {
+            std::sort(begin, end, centroidLess(axis));
+
+            BoundingBox3f box;
+            uint32_t prims = 0;
+            for (uint32_t i = 0; i < count; ++i) {
+                box.expandBy(begin[i].bbox);
+                prims += begin[i].end - begin[i].start;
+                left_areas[i] = box.getSurfaceArea();
+                left_prims[i] = prims;
+            }
+            bbox = box;
+
+            box.reset();
+            for (uint32_t i = count - 1; i >= 1; --i) {
+                box.expandBy(begin[i].bbox);
+                float cost = left_prims[i-1] * left_areas[i-1] +
+                    (prims - left_prims[i-1]) * box.getSurfaceArea();
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_index = i;
+                    best_axis = axis;
+                }
+            }
+        }
+
+        std::sort(begin, end, centroidLess(best_axis));
+        uint32_t left_count = 0;
+        for (uint32_t i = 0; i < best_index; ++i)
+            left_count += begin[i].end - begin[i].start;
+
+        uint32_t node_idx_left = BVHBuildTask::allocateChildren(nodes);
+        Accel::BVHNode &node = nodes[node_idx];
+        node.bbox = bbox;
+        node.inner.flag = 0;
+        node.inner.axis = best_axis;
+        node.inner.rightChild = node_idx_left;
+
+        buildTop(node_idx_left, begin, begin + best_index, offset, tasks);
+        buildTop(node_idx_left + 1, begin + best_index, end, offset + left_count, tasks);
+    }
+
+    /// Emit the hierarchy over <tt>bvh.m_indices[start..end-1]</tt>, returns its bounding box
+    BoundingBox3f emit(uint32_t node_idx, uint32_t start, uint32_t end) {
+        uint32_t size = end - start;
+        Accel::BVHNode &node = nodes[node_idx];
+
+        if (size <= bvh.m_params.lbvhLeafSize) {
+            BoundingBox3f bbox;
+            for (uint32_t i = start; i < end; ++i)
+                bbox.expandBy(bboxes[bvh.m_indices[i]]);
+            node.bbox = bbox;
+            node.leaf.flag = 1;
+            node.leaf.start = start;
+            node.leaf.size = size;
+            return bbox;
+        }
+
+        /* Split where the highest differing bit of the Morton codes flips */
+        uint32_t first = codes[start], last = codes[end - 1], split;
+        int axis = -1;
+        if (first == last) {
+            split = start + size / 2;
+        } else {
+            int bit = highestBit(first ^ last);
+            uint32_t mask = 1u << bit;
+            split = (uint32_t) (std::partition_point(codes.begin() + start, codes.begin() + end,
+                [mask](uint32_t code) { return (code & mask) == 0; }) - codes.begin());
+            axis = 2 - bit % 3;
+        }
+
+        uint32_t node_idx_left = BVHBuildTask::allocateChildren(nodes);
+        uint32_t node_idx_right = node_idx_left + 1;
+        BoundingBox3f bbox_left, bbox_right;
+
+        if (size >= SERIAL_THRESHOLD) {
+            tbb::parallel_invoke(
+                [&] { bbox_left = emit(node_idx_left, start, split); },
+                [&] { bbox_right = emit(node_idx_right, split, end); }
+            );
+        } else {
+            bbox_left = emit(node_idx_left, start, split);
+            bbox_right = emit(node_idx_right, split, end);
+        }
+
+        node.bbox = BoundingBox3f::merge(bbox_left, bbox_right);
+        node.inner.flag = 0;
+        node.inner.axis = axis >= 0 ? axis : node.bbox.getLargestAxis();
+        node.inner.rightChild = node_idx_left;
+        return node.bbox;
+    }
+
+private:
+    Accel &bvh;
+    BVHBuildTask::NodeList &nodes;
+    bool refineTop;
+    std::vector<BoundingBox3f> bboxes;  ///< Bounding box of every triangle
+    std::vector<uint32_t> codes;        ///< Morton codes in the order of bvh.m_indices
+};
+
+/* Ray data shared by all child box tests during wide BVH traversal */
+struct WideRay {
+    float o[3];    ///< Ray origin
+    float rcp[3];  ///< Reciprocal direction (clamped to finite values to avoid 0*inf=NaN)
+    int near[3];   ///< Index of the near bound (within BVHWideNode::bounds) for each axis
+    int far[3];    ///< Index of the far bound (within BVHWideNode::bounds) for each axis
+
+    WideRay(const Ray3f &ray) {
+        for (int i=0; i<3; ++i) {
+            o[i] = ray.o[i];
+            rcp[i] = 1.0f / ray.d[i];
+            if (!std::isfinite(rcp[i]))
+                rcp[i] = std::copysign(std::numeric_limits<float>::max(), ray.d[i]);
+            near[i] = rcp[i] < 0 ? i + 3 : i;
+            far[i]  = rcp[i] < 0 ? i : i + 3;
+        }
+    }
+};
+
+/**
+ * \brief Intersect a ray against the N child bounding boxes of a wide BVH node
+ *
+ * \return A bit mask of the children whose boxes overlap the interval
+ *    [mint, maxt] along the ray. The entry distance of each child
+ *    is written to \c tNear.
+ */
+template <int N> inline int intersectBoxes(const float (&bounds)[6][N], const WideRay &r,
+        float mint, float maxt, float *tNear) {
+    int mask = 0;
+    for (int i=0; i<N; ++i) {
+        float t0 = mint, t1 = maxt;
+        for (int axis=0; axis<3; ++axis) {
+            t0 = std::max(t0, (bounds[r.near[axis]][i] - r.o[axis]) * r.rcp[axis]);
+            t1 = std::min(t1, (bounds[r.far[axis]][i] - r.o[axis]) * r.rcp[axis]);
+        }
+        tNear[i] = t0;
+        if (t0 <= t1)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(NORI_BVH_SSE)
+/// Test all four child boxes at once using SSE
+template <> inline int intersectBoxes<4>(const float (&bounds)[6][4], const WideRay &r,
+        float mint, float maxt, float *tNear) {
+    __m128 t0 = _mm_set1_ps(mint), t1 = _mm_set1_ps(maxt);
+    for (int axis=0; axis<3; ++axis) {
+        __m128 o = _mm_set1_ps(r.o[axis]), rcp = _mm_set1_ps(r.rcp[axis]);
+        t0 = _mm_max_ps(t0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds[r.near[axis]]), o), rcp));
+        t1 = _mm_min_ps(t1, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bounds[r.far[axis]]), o), rcp));
+    }
+    _mm_storeu_ps(tNear, t0);
+    return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+#endif
+
+#if defined(NORI_BVH_AVX)
+/// Test all eight child boxes at once using AVX
+template <> inline int intersectBoxes<8>(const float (&bounds)[6][8], const WideRay &r,
+        float mint, float maxt, float *tNear) {
+    __m256 t0 = _mm256_set1_ps(mint), t1 = _mm256_set1_ps(maxt);
+    for (int axis=0; axis<3; ++axis) {
+        __m256 o = _mm256_set1_ps(r.o[axis]), rcp = _mm256_set1_ps(r.rcp[axis]);
+        t0 = _mm256_max_ps(t0, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.near[axis]]), o), rcp));
+        t1 = _mm256_min_ps(t1, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(bounds[r.far[axis]]), o), rcp));
+    }
+    _mm256_storeu_ps(tNear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif
+
+/* Structure-of-arrays copy of a ray packet used for the box tests */
+struct PacketRays {
+    float o[3][NORI_PACKET_SIZE];
+    float rcp[3][NORI_PACKET_SIZE];
+    float mint[NORI_PACKET_SIZE];
+    float maxt[NORI_PACKET_SIZE];
+};
+
+static_assert(NORI_PACKET_SIZE % 4 == 0 && NORI_PACKET_SIZE <= 32,
+              "The packet size must be a multiple of 4 and fit into a bit mask");
+
+/// Return the number of rays in a bit mask
+inline uint32_t bitCount(uint32_t mask) {
+    return (uint32_t) std::bitset<32>(mask).count();
+}
+
+/// Return a bit mask of the rays in \c mask that overlap the given bounding box
+inline uint32_t intersectBoxPacket(const BoundingBox3f &bbox, const PacketRays &p, uint32_t mask) {
+    uint32_t result = 0;
+#if defined(NORI_BVH_SSE)
+    for (int i=0; i<NORI_PACKET_SIZE; i += 4) {
+        __m128 t0 = _mm_loadu_ps(p.mint + i), t1 = _mm_loadu_ps(p.maxt + i);
+        for (int axis=0; axis<3; ++axis) {
+            __m128 o = _mm_loadu_ps(p.o[axis] + i), rcp = _mm_loadu_ps(p.rcp[axis] + i);
+            __m128 ta = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bbox.min[axis]), o), rcp);
+            __m128 tb = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bbox.max[axis]), o), rcp);
+            t0 = _mm_max_ps(t0, _mm_min_ps(ta, tb));
+            t1 = _mm_min_ps(t1, _mm_max_ps(ta, tb));
+        }
+        result |= (uint32_t) _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << i;
+    }
+#else
+    for (int i=0; i<NORI_PACKET_SIZE; ++i) {
+        float t0 = p.mint[i], t1 = p.maxt[i];
+        for (int axis=0; axis<3; ++axis) {
+            float ta = (bbox.min[axis] - p.o[axis][i]) * p.rcp[axis][i];
+            float tb = (bbox.max[axis] - p.o[axis][i]) * p.rcp[axis][i];
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+        }
+        if (t0 <= t1)
+            result |= 1u << i;
+    }
+#endif
+    return result & mask;
+}
+
+/**
+ * \brief Ray data used by the watertight ray-triangle test
+ *
+ * The test follows "Watertight Ray/Triangle Intersection" by Woop et al.
+ * (JCGT 2013): the vertices are translated to the ray origin and sheared
+ * so that the ray points along the +z axis, after which the edge functions
+ * are evaluated in 2D. Two triangles sharing an edge evaluate that edge
+ * from the same transformed vertices and obtain exactly opposite values,
+ * so a ray can never slip through the gap between them.
+ *
+ * Unlike in the paper, the hit distance is computed from the plane of the
+ * triangle: the edge functions of long, thin triangles far away from the
+ * ray origin suffer from cancellation, which is fine for the inside test
+ * but leads to noticeably wrong distances.
+ */
+struct WatertightRay {
+    int kx, ky, kz;  ///< Axis permutation that makes 'kz' the dominant direction
+    float o[3];      ///< Ray origin
+    float d[3];      ///< Ray direction
+    float sx, sy;    ///< Shear constants that map the direction onto the z axis
+
+    WatertightRay(const Ray3f &ray) {
+        Vector3f absD = ray.d.cwiseAbs();
+        kz = absD.x() > absD.y() ? (absD.x() > absD.z() ? 0 : 2) : (absD.y() > absD.z() ? 1 : 2);
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        /* Preserve the winding of the triangles */
+        if (ray.d[kz] < 0)
+            std::swap(kx, ky);
+
+        for (int i=0; i<3; ++i) {
+            o[i] = ray.o[i];
+            d[i] = ray.d[i];
+        }
+        sx = ray.d[kx] / ray.d[kz];
+        sy = ray.d[ky] / ray.d[kz];
+    }
+};
+
+/**
+ * \brief Intersect a ray against a group of N triangles
+ *
+ * \return A bit mask of the triangles that are hit within [mint, maxt].
+ *    The distances and barycentric coordinates of the second and third
+ *    vertex are written to \c t, \c u and \c v.
+ */
+template <int N> inline int intersectTriangles(const float (&p)[3][3][N], const WatertightRay &r,
+        float mint, float maxt, float *t, float *u, float *v) {
+    int mask = 0;
+    for (int i=0; i<N; ++i) {
+        /* Vertices relative to the ray origin, sheared into ray space */
+        float x[3], y[3], z[3];
+        for (int k=0; k<3; ++k) {
+            z[k] = p[k][r.kz][i] - r.o[r.kz];
+            x[k] = (p[k][r.kx][i] - r.o[r.kx]) - r.sx * z[k];
+            y[k] = (p[k][r.ky][i] - r.o[r.ky]) - r.sy * z[k];
+        }
+
+        /* Scaled barycentric coordinates (edge functions) */
+        float e0 = x[2] * y[1] - y[2] * x[1];
+        float e1 = x[0] * y[2] - y[0] * x[2];
+        float e2 = x[1] * y[0] - y[1] * x[0];
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+            continue;
+
+        float det = e0 + e1 + e2;
+        if (det == 0)
+            continue;
+
+        /* Distance to the plane of the triangle */
+        float edge1[3], edge2[3], rel[3];
+        for (int axis=0; axis<3; ++axis) {
+            edge1[axis] = p[1][axis][i] - p[0][axis][i];
+            edge2[axis] = p[2][axis][i] - p[0][axis][i];
+            rel[axis] = p[0][axis][i] - r.o[axis];
+        }
+        float n[3] = {
+            edge1[1] * edge2[2] - edge1[2] * edge2[1],
+            edge1[2] * edge2[0] - edge1[0] * edge2[2],
+            edge1[0] * edge2[1] - edge1[1] * edge2[0]
+        };
+        float den = n[0] * r.d[0] + n[1] * r.d[1] + n[2] * r.d[2];
+        if (den == 0)
+            continue;
+
+        float rcpDet = 1.0f / det;
+        t[i] = (n[0] * rel[0] + n[1] * rel[1] + n[2] * rel[2]) / den;
+        u[i] = e1 * rcpDet;
+        v[i] = e2 * rcpDet;
+        if (t[i] >= mint && t[i] <= maxt)
+            mask |= 1 << i;
+    }
+    return mask;
+}
+
+#if defined(NORI_BVH_SSE)
+/// Test four triangles at once using SSE
+template <> inline int intersectTriangles<4>(const float (&p)[3][3][4], const WatertightRay &r,
+        float mint, float maxt, float *t, float *u, float *v) {
+    const __m128 zero = _mm_setzero_ps();
+    __m128 ox = _mm_set1_ps(r.o[r.kx]), oy = _mm_set1_ps(r.o[r.ky]), oz = _mm_set1_ps(r.o[r.kz]);
+    __m128 sx = _mm_set1_ps(r.sx), sy = _mm_set1_ps(r.sy);
+    __m128 x[3], y[3], z[3];
+    for (int k=0; k<3; ++k) {
+        z[k] = _mm_sub_ps(_mm_loadu_ps(p[k][r.kz]), oz);
+        x[k] = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(p[k][r.kx]), ox), _mm_mul_ps(sx, z[k]));
+        y[k] = _mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(p[k][r.ky]), oy), _mm_mul_ps(sy, z[k]));
+    }
+
+    __m128 e0 = _mm_sub_ps(_mm_mul_ps(x[2], y[1]), _mm_mul_ps(y[2], x[1]));
+    __m128 e1 = _mm_sub_ps(_mm_mul_ps(x[0], y[2]), _mm_mul_ps(y[0], x[2]));
+    __m128 e2 = _mm_sub_ps(_mm_mul_ps(x[1], y[0]), _mm_mul_ps(y[1], x[0]));
+    __m128 neg = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(e0, zero), _mm_cmplt_ps(e1, zero)), _mm_cmplt_ps(e2, zero));
+    __m128 pos = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(e0, zero), _mm_cmpgt_ps(e1, zero)), _mm_cmpgt_ps(e2, zero));
+    __m128 det = _mm_add_ps(_mm_add_ps(e0, e1), e2);
+    __m128 valid = _mm_andnot_ps(_mm_and_ps(neg, pos), _mm_cmpneq_ps(det, zero));
+    if (_mm_movemask_ps(valid) == 0)
+        return 0;
+
+    __m128 edge1[3], edge2[3], rel[3];
+    for (int axis=0; axis<3; ++axis) {
+        __m128 p0 = _mm_loadu_ps(p[0][axis]);
+        edge1[axis] = _mm_sub_ps(_mm_loadu_ps(p[1][axis]), p0);
+        edge2[axis] = _mm_sub_ps(_mm_loadu_ps(p[2][axis]), p0);
+        rel[axis] = _mm_sub_ps(p0, _mm_set1_ps(r.o[axis]));
+    }
+    __m128 n[3] = {
+        _mm_sub_ps(_mm_mul_ps(edge1[1], edge2[2]), _mm_mul_ps(edge1[2], edge2[1])),
+        _mm_sub_ps(_mm_mul_ps(edge1[2], edge2[0]), _mm_mul_ps(edge1[0], edge2[2])),
+        _mm_sub_ps(_mm_mul_ps(edge1[0], edge2[1]), _mm_mul_ps(edge1[1], edge2[0]))
+    };
+    __m128 den = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], _mm_set1_ps(r.d[0])),
+        _mm_mul_ps(n[1], _mm_set1_ps(r.d[1]))), _mm_mul_ps(n[2], _mm_set1_ps(r.d[2])));
+    __m128 num = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], rel[0]), _mm_mul_ps(n[1], rel[1])),
+        _mm_mul_ps(n[2], rel[2]));
+    valid = _mm_and_ps(valid, _mm_cmpneq_ps(den, zero));
+
+    __m128 rcpDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    __m128 tt = _mm_div_ps(num, den);
+    valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(tt, _mm_set1_ps(mint)),
+                                         _mm_cmple_ps(tt, _mm_set1_ps(maxt))));
+    _mm_storeu_ps(t, tt);
+    _mm_storeu_ps(u, _mm_mul_ps(e1, rcpDet));
+    _mm_storeu_ps(v, _mm_mul_ps(e2, rcpDet));
+    return _mm_movemask_ps(valid);
+}
+#endif
+
+#if defined(NORI_BVH_AVX)
+/// Test eight triangles at once using AVX
+template <> inline int intersectTriangles<8>(const float (&p)[3][3][8], const WatertightRay &r,
+        float mint, float maxt, float *t, float *u, float *v) {
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 ox = _mm256_set1_ps(r.o[r.kx]), oy = _mm256_set1_ps(r.o[r.ky]), oz = _mm256_set1_ps(r.o[r.kz]);
+    __m256 sx = _mm256_set1_ps(r.sx), sy = _mm256_set1_ps(r.sy);
+    __m256 x[3], y[3], z[3];
+    for (int k=0; k<3; ++k) {
+        z[k] = _mm256_sub_ps(_mm256_loadu_ps(p[k][r.kz]), oz);
+        x[k] = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(p[k][r.kx]), ox), _mm256_mul_ps(sx, z[k]));
+        y[k] = _mm256_sub_ps(_mm256_sub_ps(_mm256_loadu_ps(p[k][r.ky]), oy), _mm256_mul_ps(sy, z[k]));
+    }
+
+    __m256 e0 = _mm256_sub_ps(_mm256_mul_ps(x[2], y[1]), _mm256_mul_ps(y[2], x[1]));
+    __m256 e1 = _mm256_sub_ps(_mm256_mul_ps(x[0], y[2]), _mm256_mul_ps(y[0], x[2]));
+    __m256 e2 = _mm256_sub_ps(_mm256_mul_ps(x[1], y[0]), _mm256_mul_ps(y[1], x[0]));
+    __m256 neg = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_LT_OQ),
+        _mm256_cmp_ps(e1, zero, _CMP_LT_OQ)), _mm256_cmp_ps(e2, zero, _CMP_LT_OQ));
+    __m256 pos = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(e0, zero, _CMP_GT_OQ),
+        _mm256_cmp_ps(e1, zero, _CMP_GT_OQ)), _mm256_cmp_ps(e2, zero, _CMP_GT_OQ));
+    __m256 det = _mm256_add_ps(_mm256_add_ps(e0, e1), e2);
+    __m256 valid = _mm256_andnot_ps(_mm256_and_ps(neg, pos), _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ));
+    if (_mm256_movemask_ps(valid) == 0)
+        return 0;
+
+    __m256 edge1[3], edge2[3], rel[3];
+    for (int axis=0; axis<3; ++axis) {
+        __m256 p0 = _mm256_loadu_ps(p[0][axis]);
+        edge1[axis] = _mm256_sub_ps(_mm256_loadu_ps(p[1][axis]), p0);
+        edge2[axis] = _mm256_sub_ps(_mm256_loadu_ps(p[2][axis]), p0);
+        rel[axis] = _mm256_sub_ps(p0, _mm256_set1_ps(r.o[axis]));
+    }
+    __m256 n[3] = {
+        _mm256_sub_ps(_mm256_mul_ps(edge1[1], edge2[2]), _mm256_mul_ps(edge1[2], edge2[1])),
+        _mm256_sub_ps(_mm256_mul_ps(edge1[2], edge2[0]), _mm256_mul_ps(edge1[0], edge2[2])),
+        _mm256_sub_ps(_mm256_mul_ps(edge1[0], edge2[1]), _mm256_mul_ps(edge1[1], edge2[0]))
+    };
+    __m256 den = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0], _mm256_set1_ps(r.d[0])),
+        _mm256_mul_ps(n[1], _mm256_set1_ps(r.d[1]))), _mm256_mul_ps(n[2], _mm256_set1_ps(r.d[2])));
+    __m256 num = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0], rel[0]), _mm256_mul_ps(n[1], rel[1])),
+        _mm256_mul_ps(n[2], rel[2]));
+    valid = _mm256_and_ps(valid, _mm256_cmp_ps(den, zero, _CMP_NEQ_UQ));
+
+    __m256 rcpDet = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+    __m256 tt = _mm256_div_ps(num, den);
+    valid = _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(tt, _mm256_set1_ps(mint), _CMP_GE_OQ),
+                                               _mm256_cmp_ps(tt, _mm256_set1_ps(maxt), _CMP_LE_OQ)));
+    _mm256_storeu_ps(t, tt);
+    _mm256_storeu_ps(u, _mm256_mul_ps(e1, rcpDet));
+    _mm256_storeu_ps(v, _mm256_mul_ps(e2, rcpDet));
+    return _mm256_movemask_ps(valid);
+}
+#endif
+
+/* BVHs kept in memory by Accel::setMemoryCache(), in the format of the cache files */
+static bool s_memoryCacheEnabled = false;
+static LRUCache<uint64_t, std::string> s_memoryCache(NORI_DEFAULT_CACHE_CAPACITY);
+
+Accel::Accel(const PropertyList &propList) : m_propList(propList) {
+    m_meshOffset.push_back(0u);
+
+    std::string layout = propList.getString("accel", "bvh4");
+    if (layout == "bvh2")
+        m_layout = EBinary;
+    else if (layout == "bvh4")
+        m_layout = EWide4;
+    else if (layout == "bvh8")
+        m_layout = EWide8;
+    else
+        throw NoriException("Accel: unknown node layout \"%s\" (expected "
+                            "\"bvh2\", \"bvh4\" or \"bvh8\")", layout);
+
+    std::string builder = propList.getString("accelBuilder", "sah");
+    if (builder == "sah")
+        m_builder = EObjectSplit;
+    else if (builder == "sbvh")
+        m_builder = ESpatialSplit;
+    else if (builder == "lbvh")
+        m_builder = ELinear;
+    else
+        throw NoriException("Accel: unknown builder \"%s\" (expected "
+                            "\"sah\", \"sbvh\" or \"lbvh\")", builder);
+    m_spatialSplitAlpha = propList.getFloat("spatialSplitAlpha", 1e-5f);
+    m_lbvhRefine = propList.getBoolean("lbvhRefine", true);
+    m_cacheDir = propList.getString("accelCache", "");
+    m_memoryCache = s_memoryCacheEnabled;
+    m_quantize = propList.getBoolean("accelQuantize", false);
+    m_reorder = propList.getBoolean("accelReorder", true);
+    m_statistics = propList.getBoolean("accelStatistics", false);
+    m_refitThreshold = propList.getFloat("refitThreshold", 1.5f);
+    m_removeThreshold = propList.getFloat("removeThreshold", 0.25f);
+
+    m_params.binCount = propList.getInteger("accelBinCount", m_params.binCount);
+    m_params.serialThreshold = (uint32_t) propList.getInteger("accelSerialThreshold", (int) m_params.serialThreshold);
+    m_params.grainSize = (uint32_t) propList.getInteger("accelGrainSize", (int) m_params.grainSize);
+    m_params.traversalCost = propList.getFloat("accelTraversalCost", m_params.traversalCost);
+    m_params.intersectionCost = propList.getFloat("accelIntersectionCost", m_params.intersectionCost);
+    m_params.lbvhLeafSize = (uint32_t) propList.getInteger("lbvhLeafSize", (int) m_params.lbvhLeafSize);
+    m_autoTune = propList.getBoolean("accelAutoTune", false);
+    if (m_params.binCount < 2 || m_params.binCount > Bins::MAX_BIN_COUNT)
+        throw NoriException("Accel: accelBinCount must be between 2 and %i", (int) Bins::MAX_BIN_COUNT);
+    if ((int) m_params.grainSize <= 0 || (int) m_params.lbvhLeafSize <= 0)
+        throw NoriException("Accel: accelGrainSize and lbvhLeafSize must be positive");
+    if (m_params.traversalCost <= 0 || m_params.intersectionCost <= 0)
+        throw NoriException("Accel: the traversal and intersection costs must be positive");
+    m_buildCost = 0.0f;
+    m_removedCount = 0;
+    m_built = false;
+    if (m_quantize && m_layout == EBinary)
+        throw NoriException("Accel: quantized nodes require the \"bvh4\" or \"bvh8\" layout");
+}
+
+/* Configuration of the BVHs that Accel::addMesh() builds on the spot after
+   build(): these skip auto-tuning and aren't worth writing to the cache */
+static PropertyList getIncrementalProperties(const PropertyList &propList) {
+    PropertyList result(propList);
+    result.remove("accelAutoTune");
+    result.remove("accelCache");
+    return result;
+}
+
+void Accel::addMesh(Mesh *mesh) {
+    if (Instance *instance = dynamic_cast<Instance *>(mesh)) {
+        BVHInstance record;
+        record.instance = instance;
+        record.accel = nullptr;
+        if (m_built) {
+            /* Reuse the bottom-level BVH of the shared mesh if there is one */
+            const Mesh *prototype = instance->getPrototype();
+            for (const Accel *accel : m_prototypes) {
+                if (accel->m_meshes[0] == prototype)
+                    record.accel = accel;
+            }
+            if (!record.accel) {
+                Accel *accel = new Accel(getIncrementalProperties(m_propList));
+                accel->addMesh(const_cast<Mesh *>(prototype));
+                accel->build();
+                m_prototypes.push_back(accel);
+                record.accel = accel;
+            }
+        }
+        m_instances.push_back(record);
+        m_bbox.expandBy(mesh->getBoundingBox());
+        if (m_built)
+            updateInstances();
+        return;
+    }
+
+    if (m_built) {
+        /* The triangle BVH can't be extended, give the mesh its own BVH */
+        Accel *accel = new Accel(getIncrementalProperties(m_propList));
+        accel->addMesh(mesh);
+        accel->build();
+        m_objects.push_back(accel);
+
+        BVHInstance record;
+        record.instance = nullptr;
+        record.accel = accel;
+        m_instances.push_back(record);
+        m_bbox.expandBy(mesh->getBoundingBox());
+        updateInstances();
+        return;
+    }
+
+    m_meshes.push_back(mesh);
+    m_meshOffset.push_back(m_meshOffset.back() + mesh->getTriangleCount());
+    m_removed.push_back(0);
+    m_bbox.expandBy(mesh->getBoundingBox());
+}
+
+void Accel::removeMesh(Mesh *mesh) {
+    for (size_t i = 0; i < m_instances.size(); ++i) {
+        BVHInstance &record = m_instances[i];
+        if (record.instance ? record.instance != mesh : record.accel->m_meshes[0] != mesh)
+            continue;
+
+        if (record.instance) {
+            delete record.instance;
+        } else {
+            Accel *accel = const_cast<Accel *>(record.accel);
+            m_objects.erase(std::find(m_objects.begin(), m_objects.end(), accel));
+            delete accel;
+        }
+        m_instances.erase(m_instances.begin() + i);
+        if (m_built)
+            updateInstances();
+        updateBoundingBox();
+        return;
+    }
+
+    auto it = std::find(m_meshes.begin(), m_meshes.end(), mesh);
+    if (it == m_meshes.end() || m_removed[it - m_meshes.begin()])
+        throw NoriException("Accel::removeMesh(): the mesh is not registered with the BVH!");
+    uint32_t meshIdx = (uint32_t) (it - m_meshes.begin());
+    m_removed[meshIdx] = 1;
+    m_removedCount += mesh->getTriangleCount();
+    updateBoundingBox();
+
+    if (!m_built || m_removedCount > m_removeThreshold * getTriangleCount()) {
+        /* Too much of the tree is dead weight, start over */
+        compact();
+        return;
+    }
+
+    if (m_refOffset.empty()) {
+        /* Find the positions of all triangles in m_indices (the SBVH
+           may reference a triangle several times) */
+        uint32_t size = getTriangleCount();
+        m_refOffset.assign(size + 1, 0u);
+        for (uint32_t idx : m_indices) {
+            if (idx != PADDING_INDEX)
+                m_refOffset[idx + 1]++;
+        }
+        for (uint32_t i = 0; i < size; ++i)
+            m_refOffset[i + 1] += m_refOffset[i];
+        m_refPositions.resize(m_refOffset[size]);
+        std::vector<uint32_t> next(m_refOffset.begin(), m_refOffset.end() - 1);
+        for (uint32_t i = 0; i < (uint32_t) m_indices.size(); ++i) {
+            if (m_indices[i] != PADDING_INDEX)
+                m_refPositions[next[m_indices[i]]++] = i;
+        }
+    }
+
+    /* Collapse the triangles to a point, which no ray can hit */
+    const uint32_t W = BVHTriangleGroup::Width;
+    for (uint32_t idx = m_meshOffset[meshIdx]; idx < m_meshOffset[meshIdx + 1]; ++idx) {
+        for (uint32_t j = m_refOffset[idx]; j < m_refOffset[idx + 1]; ++j) {
+            uint32_t pos = m_refPositions[j];
+            BVHTriangleGroup &group = m_triangles[pos / W];
+            for (int k=0; k<3; ++k)
+                for (int axis=0; axis<3; ++axis)
+                    group.p[k][axis][pos % W] = 0.0f;
+        }
+    }
+}
+
+void Accel::compact() {
+    std::vector<Mesh *> meshes;
+    m_meshOffset.assign(1, 0u);
+    for (size_t i = 0; i < m_meshes.size(); ++i) {
+        if (m_removed[i]) {
+            delete m_meshes[i];
+            continue;
+        }
+        meshes.push_back(m_meshes[i]);
+        m_meshOffset.push_back(m_meshOffset.back() + m_meshes[i]->getTriangleCount());
+    }
+    m_meshes.swap(meshes);
+    m_removed.assign(m_meshes.size(), 0);
+    m_removedCount = 0;
+    if (!m_built)
+        return;
+
+    if (getTriangleCount() > 0) {
+        buildHierarchy();
+    } else {
+        m_nodes.clear();
+        m_nodes4.clear();
+        m_nodes8.clear();
+        m_qnodes4.clear();
+        m_qnodes8.clear();
+        m_indices.clear();
+        m_triangles.clear();
+        m_refOffset.clear();
+        m_refPositions.clear();
+    }
+}
+
+void Accel::updateBoundingBox() {
+    m_bbox.reset();
+    for (size_t i = 0; i < m_meshes.size(); ++i) {
+        if (!m_removed[i])
+            m_bbox.expandBy(m_meshes[i]->getBoundingBox());
+    }
+    for (const BVHInstance &record : m_instances)
+        m_bbox.expandBy(getBoundingBox(record));
+}
+
+const BoundingBox3f &Accel::getBoundingBox(const BVHInstance &record) const {
+    return record.instance ? record.instance->getBoundingBox() : record.accel->getBoundingBox();
+}
+
+void Accel::clear() {
+    for (auto mesh : m_meshes)
+        delete mesh;
+    m_meshes.clear();
+    m_meshOffset.clear();
+    m_meshOffset.push_back(0u);
+    m_nodes.clear();
+    m_nodes4.clear();
+    m_nodes8.clear();
+    m_qnodes4.clear();
+    m_qnodes8.clear();
+    m_indices.clear();
+    m_triangles.clear();
+    for (auto instance : m_instances)
+        delete instance.instance;
+    for (auto accel : m_objects)
+        delete accel;
+    for (auto accel : m_prototypes) {
+        /* The shared meshes are owned by the instances */
+        accel->m_meshes.clear();
+        delete accel;
+    }
+    m_instances.clear();
+    m_instanceNodes.clear();
+    m_prototypes.clear();
+    m_objects.clear();
+    m_removed.clear();
+    m_removedCount = 0;
+    m_refOffset.clear();
+    m_refPositions.clear();
+    m_built = false;
+    m_bbox.reset();
+    m_nodes.shrink_to_fit();
+    m_nodes4.shrink_to_fit();
+    m_nodes8.shrink_to_fit();
+    m_qnodes4.shrink_to_fit();
+    m_qnodes8.shrink_to_fit();
+    m_meshes.shrink_to_fit();
+    m_meshOffset.shrink_to_fit();
+    m_indices.shrink_to_fit();
+    m_triangles.shrink_to_fit();
+}
+
+void Accel::build() {
+    m_built = true;
+    buildInstances();
+
+    if (getTriangleCount() == 0)
+        return;
+
+    if (m_autoTune)
+        autoTune();
+    else
+        buildHierarchy();
+}
+
+void Accel::buildHierarchy() {
+    uint32_t size  = getTriangleCount();
+    Timer timer;
+
+    m_nodes.clear();
+    m_indices.clear();
+    m_refOffset.clear();
+    m_refPositions.clear();
+
+    if (sizeof(BVHNode) != 32)
+        throw NoriException("BVH Node is not packed! Investigate compiler settings.");
+
+    /* Try to reuse a BVH that an earlier scene has left in memory, or
+       that an earlier run has written to the cache */
+    std::string cacheFile;
+    uint64_t cacheKey = 0;
+    if (!m_cacheDir.empty() || m_memoryCache)
+        cacheKey = getCacheKey();
+    if (!m_cacheDir.empty())
+        cacheFile = tfm::format("%s/%016x.bvh", m_cacheDir, cacheKey);
+
+    bool shared = false;
+    if (m_memoryCache) {
+        std::shared_ptr<const std::string> data = s_memoryCache.find(cacheKey);
+        if (data) {
+            cout << "Reusing the BVH of an earlier scene .. ";
+            cout.flush();
+            Timer loadTimer;
+            shared = readCache(data->data(), data->size(), cacheKey);
+            cout << (shared ? "done. (took " + loadTimer.elapsedString() + ")" : "stale, rebuilding.") << endl;
+        }
+    }
+
+    if (!shared && (cacheFile.empty() || !loadCache(cacheFile, cacheKey))) {
+        if (m_builder == ESpatialSplit) {
+            /* The spatial split builder directly emits compact nodes */
+            SBVHBuilder(*this, m_spatialSplitAlpha).build();
+        } else {
+            /* Nodes are allocated on demand and linearized afterwards, which
+               avoids reserving (and compacting) room for 2N nodes */
+            BVHBuildTask::NodeList nodes(2 * size);
+            BVHBuildTask::allocate(nodes, m_bbox);
+            m_indices.resize(size);
+
+            if (m_builder == ELinear) {
+                LBVHBuilder(*this, nodes, m_lbvhRefine).build();
+            } else {
+                for (uint32_t i = 0; i < size; ++i)
+                    m_indices[i] = i;
+
+                uint32_t *indices = m_indices.data(), *temp = new uint32_t[size];
+                BVHBuildTask(*this, nodes, 0u, indices, indices + size, temp).execute();
+                delete[] temp;
+            }
+
+            BVHBuildTask::linearize(*this, nodes);
+        }
+
+        alignLeaves();
+        buildTriangles();
+
+        if (!cacheFile.empty())
+            saveCache(cacheFile, cacheKey);
+    }
+
+    if (m_memoryCache && !shared) {
+        std::ostringstream os;
+        writeCache(os, cacheKey);
+        auto data = std::make_shared<const std::string>(os.str());
+        s_memoryCache.insert(cacheKey, data, data->size());
+    }
+
+    buildWide();
+
+    /* Reference cost for the quality guard in refit() */
+    std::pair<float, uint32_t> stats = statistics();
+    m_buildCost = stats.first;
+
+    if (m_statistics) {
+        size_t memory = sizeof(BVHNode) * m_nodes.size() +
+            sizeof(BVHWideNode<4>) * m_nodes4.size() + sizeof(BVHWideNode<8>) * m_nodes8.size() +
+            sizeof(BVHQuantizedNode<4>) * m_qnodes4.size() + sizeof(BVHQuantizedNode<8>) * m_qnodes8.size() +
+            sizeof(uint32_t) * m_indices.size() + sizeof(BVHTriangleGroup) * m_triangles.size();
+        cout << "Accel: " << size << " triangles, " << stats.second << " nodes, SAH cost = "
+             << stats.first << ", " << memString(memory) << " (took "
+             << timer.elapsedString() << ")" << endl;
+    }
+}
+
+/* Number of rays traced per candidate by Accel::autoTune() */
+static const int AUTOTUNE_RAY_COUNT = 1 << 16;
+
+/* The workload is repeated until this many milliseconds have passed */
+static const double AUTOTUNE_MIN_TIME = 100.0;
+
+void Accel::autoTune() {
+    /* Reuse the parameters that an earlier run has chosen for these meshes,
+       the BVH itself then usually comes from the caches as well */
+    uint64_t tuningKey = 0;
+    if (!m_cacheDir.empty() || m_memoryCache) {
+        tuningKey = getTuningKey();
+        BuildParameters params;
+        if (loadTuning(tuningKey, params)) {
+            cout << "Accel: reusing the auto-tuned parameters " << params.toString() << endl;
+            m_params = params;
+            buildHierarchy();
+            return;
+        }
+    }
+
+    /* Candidate settings, starting with the configured ones. The ratio of
+       the intersection and traversal costs controls the leaf size of the
+       SAH builders, the LBVH creates leaves of a fixed size instead */
+    std::vector<BuildParameters> candidates(1, m_params);
+    if (m_builder == ELinear) {
+        const uint32_t leafSizes[] = { 1, 2, 4, 8, 16 };
+        for (uint32_t leafSize : leafSizes) {
+            if (leafSize == m_params.lbvhLeafSize)
+                continue;
+            BuildParameters params = m_params;
+            params.lbvhLeafSize = leafSize;
+            candidates.push_back(params);
+        }
+    } else {
+        const float costs[] = { 0.25f, 0.5f, 1.0f, 2.0f };
+        const int binCounts[] = { 8, 16, 32 };
+        for (float cost : costs) {
+            for (int binCount : binCounts) {
+                /* The SBVH sweeps over all triangles and doesn't use bins */
+                if (m_builder == ESpatialSplit && binCount != m_params.binCount)
+                    continue;
+                BuildParameters params = m_params;
+                params.intersectionCost = cost * m_params.traversalCost;
+                params.binCount = binCount;
+                if (params.intersectionCost != m_params.intersectionCost ||
+                    params.binCount != m_params.binCount)
+                    candidates.push_back(params);
+            }
+        }
+    }
+
+    /* Fixed workload: closest-hit and shadow rays between random points
+       in (and slightly around) the scene's bounding box */
+    std::vector<Ray3f> rays(AUTOTUNE_RAY_COUNT);
+    pcg32 rng;
+    Vector3f extents = m_bbox.getExtents();
+    auto randomPoint = [&](float margin) {
+        Point3f p;
+        for (int i=0; i<3; ++i)
+            p[i] = m_bbox.min[i] + extents[i] * (rng.nextFloat() * (1 + 2 * margin) - margin);
+        return p;
+    };
+    for (size_t i = 0; i < rays.size(); ++i) {
+        Point3f o = randomPoint(0.2f), target = randomPoint(0.0f);
+        Vector3f d = target - o;
+        float dist = d.norm();
+        if (dist == 0) {
+            d = Vector3f(0, 0, 1);
+            dist = 1;
+        }
+        rays[i] = Ray3f(o, d / dist);
+        /* Every other ray is a shadow ray that ends at the target point */
+        if (i % 2)
+            rays[i].maxt = dist;
+    }
+
+    /* Don't pollute the caches or the traversal statistics */
+    std::string cacheDir = m_cacheDir;
+    bool memoryCache = m_memoryCache, statistics = m_statistics;
+    m_cacheDir.clear();
+    m_memoryCache = false;
+    m_statistics = false;
+
+    Timer timer;
+    size_t best = 0;
+    double bestTime = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < candidates.size(); ++i) {
+        m_params = candidates[i];
+        buildHierarchy();
+        double time = benchmark(rays);
+        if (statistics)
+            cout << "Accel: auto-tuning " << m_params.toString() << ": "
+                 << timeString(time, true) << endl;
+        if (time < bestTime) {
+            bestTime = time;
+            best = i;
+        }
+    }
+
+    m_cacheDir = cacheDir;
+    m_memoryCache = memoryCache;
+    m_statistics = statistics;
+
+    cout << "Accel: auto-tuning chose " << candidates[best].toString()
+         << " (took " << timer.elapsedString() << ")" << endl;
+
+    m_params = candidates[best];
+    buildHierarchy();
+
+    if (!m_cacheDir.empty() || m_memoryCache)
+        saveTuning(tuningKey, m_params);
+}
+
+double Accel::benchmark(const std::vector<Ray3f> &rays) const {
+    /* The timer only has millisecond precision, hence repeat short workloads */
+    Timer timer;
+    int passes = 0;
+    do {
+        for (size_t i = 0; i < rays.size(); ++i) {
+            Intersection its;
+            rayIntersect(rays[i], its, i % 2 == 1);
+        }
+        ++passes;
+    } while (timer.elapsed() < AUTOTUNE_MIN_TIME);
+    return timer.elapsed() / passes;
+}
+
+std::string Accel::BuildParameters::toString() const {
+    return tfm::format("[binCount=%i, serialThreshold=%i, grainSize=%i, traversalCost=%f, "
+        "intersectionCost=%f, lbvhLeafSize=%i]", binCount, serialThreshold, grainSize,
+        traversalCost, intersectionCost, lbvhLeafSize);
+}
+
+void Accel::buildWide() {
+    m_nodes4.clear();
+    m_nodes8.clear();
+    m_qnodes4.clear();
+    m_qnodes8.clear();
+
+    /* Optionally collapse the binary tree into a wide BVH, quantizing
+       the nodes on the fly */
+    if (m_layout == EWide4) {
+        if (m_quantize)
+            collapse(m_qnodes4);
+        else
+            collapse(m_nodes4);
+    } else if (m_layout == EWide8) {
+        if (m_quantize)
+            collapse(m_qnodes8);
+        else
+            collapse(m_nodes8);
+    }
+
+    /* .. and store it in a cache-friendly order */
+    if (m_reorder) {
+        reorder(m_nodes4);
+        reorder(m_nodes8);
+        reorder(m_qnodes4);
+        reorder(m_qnodes8);
+    }
+
+    /* Traversal (including packets) and refit() only need the wide nodes */
+    if (m_layout != EBinary) {
+        m_nodes.clear();
+        m_nodes.shrink_to_fit();
+    }
+}
+
+/* Refit subtrees in parallel down to this depth */
+static const int REFIT_PARALLEL_DEPTH = 8;
+
+void Accel::refit() {
+    /* Instances only require refitting the shared meshes
+       and rebuilding the (small) top-level BVH */
+    for (Accel *accel : m_prototypes)
+        accel->refit();
+    for (Accel *accel : m_objects)
+        accel->refit();
+    for (BVHInstance &record : m_instances) {
+        if (record.instance)
+            record.instance->updateBoundingBox();
+    }
+    updateInstances();
+    updateBoundingBox();
+
+    uint32_t size = getTriangleCount();
+    if (size == 0)
+        return;
+    if (m_triangles.empty())
+        throw NoriException("Accel::refit(): the BVH has not been built yet!");
+    Timer timer;
+
+    if (!m_nodes.empty())
+        refit(0u, 0);
+    else if (!m_nodes4.empty())
+        refit(m_nodes4, 0u, 0);
+    else if (!m_nodes8.empty())
+        refit(m_nodes8, 0u, 0);
+    else if (!m_qnodes4.empty())
+        refit(m_qnodes4, 0u, 0);
+    else
+        refit(m_qnodes8, 0u, 0);
+
+    float cost = statistics().first;
+    if (cost > m_refitThreshold * m_buildCost) {
+        /* The tree has degraded too much, start over */
+        if (m_statistics)
+            cout << "Accel: SAH cost increased from " << m_buildCost << " to " << cost
+                 << " after refitting, rebuilding .." << endl;
+        compact();
+        return;
+    }
+
+    buildTriangles();
+    if (!m_nodes.empty())
+        buildWide();
+
+    if (m_statistics)
+        cout << "Accel: refitted " << size << " triangles, SAH cost = " << cost
+             << " (took " << timer.elapsedString() << ")" << endl;
+}
+
+BoundingBox3f Accel::refit(uint32_t node_idx, int depth) {
+    BVHNode &node = m_nodes[node_idx];
+    BoundingBox3f bbox;
+
+    if (node.isLeaf()) {
+        for (uint32_t i = node.start(); i < node.end(); ++i)
+            bbox.expandBy(getBoundingBox(m_indices[i]));
+    } else {
+        BoundingBox3f left, right;
+        if (depth < REFIT_PARALLEL_DEPTH) {
+            tbb::parallel_invoke(
+                [&] { left = refit(node_idx + 1u, depth + 1); },
+                [&] { right = refit(node.inner.rightChild, depth + 1); }
+            );
+        } else {
+            left = refit(node_idx + 1u, depth + 1);
+            right = refit(node.inner.rightChild, depth + 1);
+        }
+        bbox = left;
+        bbox.expandBy(right);
+    }
+
+    node.bbox = bbox;
+    return bbox;
+}
+
+template <typename Node> BoundingBox3f Accel::refit(NodeArray<Node> &nodes,
+        uint32_t node_idx, int depth) {
+    const int N = Node::Width;
+    BVHWideNode<N> node;
+    BoundingBox3f childBox[N];
+
+    auto refitChild = [&](int i) {
+        const Node &wnode = nodes[node_idx];
+        if (wnode.isLeaf(i)) {
+            for (uint32_t j = wnode.child[i]; j < wnode.child[i] + wnode.count[i]; ++j)
+                childBox[i].expandBy(getBoundingBox(m_indices[j]));
+        } else if (wnode.child[i] != 0) {
+            childBox[i] = refit(nodes, wnode.child[i], depth + 1);
+        }
+    };
+
+    /* A wide level corresponds to log2(N) binary levels */
+    if (depth * (N == 8 ? 3 : 2) < REFIT_PARALLEL_DEPTH)
+        tbb::parallel_for(0, N, refitChild);
+    else
+        for (int i=0; i<N; ++i)
+            refitChild(i);
+
+    /* Re-encode the node from the exact child boxes */
+    BoundingBox3f bbox;
+    Node &wnode = nodes[node_idx];
+    for (int i=0; i<N; ++i) {
+        /* Unused slots keep their empty box */
+        for (int axis=0; axis<3; ++axis) {
+            node.bounds[axis][i] = childBox[i].min[axis];
+            node.bounds[axis+3][i] = childBox[i].max[axis];
+        }
+        node.child[i] = wnode.child[i];
+        node.count[i] = wnode.count[i];
+        bbox.expandBy(childBox[i]);
+    }
+    encode(node, wnode);
+    return bbox;
+}
+
+void Accel::buildInstances() {
+    if (m_instances.empty())
+        return;
+
+    /* Build one bottom-level BVH per shared mesh */
+    std::map<const Mesh *, Accel *> prototypes;
+    for (BVHInstance &record : m_instances) {
+        const Mesh *mesh = record.instance->getPrototype();
+        Accel *&accel = prototypes[mesh];
+        if (!accel) {
+            accel = new Accel(m_propList);
+            accel->addMesh(const_cast<Mesh *>(mesh));
+            accel->build();
+            m_prototypes.push_back(accel);
+        }
+        record.accel = accel;
+    }
+
+    updateInstances();
+}
+
+void Accel::updateInstances() {
+    m_instanceNodes.clear();
+    if (m_instances.empty())
+        return;
+
+    for (BVHInstance &record : m_instances) {
+        if (!record.instance) {
+            record.toLocal.setIdentity();
+            record.toLocalOffset.setZero();
+            continue;
+        }
+        Eigen::Matrix4f inv = record.instance->getTransform().getInverseMatrix();
+        record.toLocal = inv.topLeftCorner<3, 3>();
+        record.toLocalOffset = inv.topRightCorner<3, 1>();
+    }
+
+    /* Build the top-level BVH, which stores the instances in leaf order */
+    m_instanceNodes.reserve(2 * m_instances.size());
+    buildInstances(0u, (uint32_t) m_instances.size());
+}
+
+uint32_t Accel::buildInstances(uint32_t start, uint32_t end) {
+    uint32_t node_idx = (uint32_t) m_instanceNodes.size();
+    uint32_t size = end - start;
+    m_instanceNodes.emplace_back();
+
+    BoundingBox3f bbox, centroids;
+    for (uint32_t i = start; i < end; ++i) {
+        const BoundingBox3f &instanceBBox = getBoundingBox(m_instances[i]);
+        bbox.expandBy(instanceBBox);
+        centroids.expandBy(instanceBBox.getCenter());
+    }
+    m_instanceNodes[node_idx].data = 0;
+    m_instanceNodes[node_idx].bbox = bbox;
+
+    if (size == 1) {
+        BVHNode &node = m_instanceNodes[node_idx];
+        node.leaf.flag = 1;
+        node.leaf.start = start;
+        node.leaf.size = 1;
+        return node_idx;
+    }
+
+    /* Sort along the axis with the largest centroid extent and
+       split where the SAH cost is lowest. Instances are expensive
+       to intersect, hence every leaf contains exactly one */
+    int axis = centroids.getLargestAxis();
+    std::sort(m_instances.begin() + start, m_instances.begin() + end,
+        [this, axis](const BVHInstance &i1, const BVHInstance &i2) {
+            return getBoundingBox(i1).getCenter()[axis] <
+                   getBoundingBox(i2).getCenter()[axis];
+        });
+
+    std::vector<float> left_areas(size);
+    BoundingBox3f box;
+    for (uint32_t i = 0; i < size; ++i) {
+        box.expandBy(getBoundingBox(m_instances[start + i]));
+        left_areas[i] = box.getSurfaceArea();
+    }
+
+    box.reset();
+    uint32_t best_index = size / 2;
+    float best_cost = std::numeric_limits<float>::infinity();
+    for (uint32_t i = size - 1; i >= 1; --i) {
+        box.expandBy(getBoundingBox(m_instances[start + i]));
+        float cost = i * left_areas[i - 1] + (size - i) * box.getSurfaceArea();
+        if (cost < best_cost) {
+            best_cost = cost;
+            best_index = i;
+        }
+    }
+
+    buildInstances(start, start + best_index);
+    uint32_t right_idx = buildInstances(start + best_index, end);
+
+    BVHNode &node = m_instanceNodes[node_idx];
+    node.inner.flag = 0;
+    node.inner.axis = axis;
+    node.inner.rightChild = right_idx;
+    return node_idx;
+}
+
+void Accel::buildTriangles() {
+    const uint32_t W = BVHTriangleGroup::Width;
+
+    /* Padding and the unused lanes of the last group are zero-initialized (degenerate) */
+    m_triangles.resize(getGroupCount(m_indices.size()));
+    memset(m_triangles.data(), 0, sizeof(BVHTriangleGroup) * m_triangles.size());
+
+    tbb::parallel_for(
+        tbb::blocked_range<uint32_t>(0u, (uint32_t) m_indices.size(), m_params.grainSize),
+        [&](const tbb::blocked_range<uint32_t> &range) {
+            for (uint32_t i = range.begin(); i != range.end(); ++i) {
+                uint32_t idx = m_indices[i];
+                if (idx == PADDING_INDEX)
+                    continue; /* Keep padding degenerate */
+                uint32_t meshIdx = findMesh(idx);
+                const MatrixXf &V = m_meshes[meshIdx]->getVertexPositions();
+                const MatrixXu &F = m_meshes[meshIdx]->getIndices();
+
+                BVHTriangleGroup &group = m_triangles[i / W];
+                uint32_t lane = i % W;
+                group.mesh[lane] = meshIdx;
+                group.index[lane] = idx;
+                if (m_removed[meshIdx])
+                    continue; /* Keep removed triangles degenerate */
+                for (int k=0; k<3; ++k)
+                    for (int axis=0; axis<3; ++axis)
+                        group.p[k][axis][lane] = V(axis, F(k, idx));
+            }
+        }
+    );
+}
+
+void Accel::alignLeaves() {
+    uint32_t size = 0;
+    for (const BVHNode &node : m_nodes) {
+        if (node.isLeaf())
+            size += getPaddedCount(node.leaf.size);
+    }
+    if (size == m_indices.size())
+        return;
+
+    /* Move every leaf to the next group boundary */
+    std::vector<uint32_t> indices(size, PADDING_INDEX);
+    uint32_t pos = 0;
+    for (BVHNode &node : m_nodes) {
+        if (!node.isLeaf())
+            continue;
+        std::copy(m_indices.begin() + node.start(), m_indices.begin() + node.end(),
+                  indices.begin() + pos);
+        node.leaf.start = pos;
+        pos += getPaddedCount(node.leaf.size);
+    }
+    m_indices.swap(indices);
+}
+
+/// Header of a BVH cache file, followed by the node, index and triangle arrays
+struct BVHCacheHeader {
+    enum {
+        /// Increment whenever the layout of the cached data changes
+        VERSION = 3
+    };
+
+    char magic[8];           ///< "NORIBVH"
+    uint32_t version;        ///< File format version
+    uint32_t nodeCount;      ///< Number of entries in Accel::m_nodes
+    uint32_t indexCount;     ///< Number of entries in Accel::m_indices
+    uint32_t reserved;
+    uint64_t key;            ///< Accel::getCacheKey() of the cached BVH
+};
+
+/// Read-only view of a file that is memory-mapped where supported
+class MappedFile {
+public:
+    MappedFile(const std::string &filename) {
+#if defined(_WIN32)
+        std::ifstream is(filename, std::ios::binary);
+        if (is.fail())
+            return;
+        m_buffer.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+        m_data = m_buffer.data();
+        m_size = m_buffer.size();
+#else
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd == -1)
+            return;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void *ptr = mmap(nullptr, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (ptr != MAP_FAILED) {
+                m_data = (const char *) ptr;
+                m_size = (size_t) st.st_size;
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    ~MappedFile() {
+#if !defined(_WIN32)
+        if (m_data)
+            munmap((void *) m_data, m_size);
+#endif
+    }
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+#if defined(_WIN32)
+    std::vector<char> m_buffer;
+#endif
+};
+
+/// Add data to a 64 bit FNV-1a hash
+static void addHash(uint64_t &hash, const void *data, size_t size) {
+    const uint8_t *ptr = (const uint8_t *) data;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= ptr[i];
+        hash *= 1099511628211ull;
+    }
+}
+
+/// Initial value of a 64 bit FNV-1a hash
+static const uint64_t HASH_OFFSET = 14695981039346656037ull;
+
+uint64_t Accel::getMeshKey() const {
+    uint64_t hash = HASH_OFFSET;
+    uint32_t meshCount = (uint32_t) m_meshes.size();
+    addHash(hash, &meshCount, sizeof(uint32_t));
+
+    for (const Mesh *mesh : m_meshes) {
+        const MatrixXf &V = mesh->getVertexPositions();
+        const MatrixXu &F = mesh->getIndices();
+        uint32_t sizes[] = { (uint32_t) V.cols(), (uint32_t) F.cols() };
+        addHash(hash, sizes, sizeof(sizes));
+        addHash(hash, V.data(), sizeof(float) * V.size());
+        addHash(hash, F.data(), sizeof(uint32_t) * F.size());
+    }
+
+    return hash;
+}
+
+uint64_t Accel::getCacheKey() const {
+    uint64_t hash = HASH_OFFSET;
+    uint32_t params[] = {
+        (uint32_t) BVHCacheHeader::VERSION, (uint32_t) sizeof(BVHNode),
+        (uint32_t) sizeof(BVHTriangleGroup), (uint32_t) m_builder,
+        (uint32_t) m_lbvhRefine
+    };
+    addHash(hash, params, sizeof(params));
+    addHash(hash, &m_spatialSplitAlpha, sizeof(float));
+    int32_t buildParams[] = {
+        m_params.binCount, (int32_t) m_params.serialThreshold, (int32_t) m_params.lbvhLeafSize
+    };
+    addHash(hash, buildParams, sizeof(buildParams));
+    addHash(hash, &m_params.traversalCost, sizeof(float));
+    addHash(hash, &m_params.intersectionCost, sizeof(float));
+
+    uint64_t meshKey = getMeshKey();
+    addHash(hash, &meshKey, sizeof(uint64_t));
+    return hash;
+}
+
+/// Parameters chosen by Accel::autoTune(), kept next to the cached BVHs
+struct BVHTuningRecord {
+    char magic[8];                  ///< "NORITUN"
+    uint32_t version;               ///< BVHCacheHeader::VERSION
+    uint32_t reserved;
+    uint64_t key;                   ///< Accel::getTuningKey() of the tuned BVH
+    Accel::BuildParameters params;  ///< The fastest parameters
+};
+
+uint64_t Accel::getTuningKey() const {
+    /* The candidates depend on the configured parameters, their timings
+       on the node layout that is traversed */
+    uint64_t hash = HASH_OFFSET;
+    const char tag[] = "NORITUN";
+    addHash(hash, tag, sizeof(tag));
+    uint32_t settings[] = {
+        (uint32_t) BVHCacheHeader::VERSION, (uint32_t) m_builder, (uint32_t) m_lbvhRefine,
+        (uint32_t) m_layout, (uint32_t) m_quantize, (uint32_t) m_reorder
+    };
+    addHash(hash, settings, sizeof(settings));
+    addHash(hash, &m_spatialSplitAlpha, sizeof(float));
+    int32_t buildParams[] = {
+        m_params.binCount, (int32_t) m_params.serialThreshold, (int32_t) m_params.lbvhLeafSize
+    };
+    addHash(hash, buildParams, sizeof(buildParams));
+    addHash(hash, &m_params.traversalCost, sizeof(float));
+    addHash(hash, &m_params.intersectionCost, sizeof(float));
+
+    uint64_t meshKey = getMeshKey();
+    addHash(hash, &meshKey, sizeof(uint64_t));
+    return hash;
+}
+
+bool Accel::loadTuning(uint64_t key, BuildParameters &params) const {
+    BVHTuningRecord record;
+    bool found = false;
+
+    if (m_memoryCache) {
+        std::shared_ptr<const std::string> data = s_memoryCache.find(key);
+        if (data && data->size() == sizeof(BVHTuningRecord)) {
+            memcpy(&record, data->data(), sizeof(BVHTuningRecord));
+            found = true;
+        }
+    }
+
+    if (!found && !m_cacheDir.empty()) {
+        std::ifstream is(tfm::format("%s/%016x.tune", m_cacheDir, key), std::ios::binary);
+        found = is.read((char *) &record, sizeof(BVHTuningRecord)) &&
+                is.peek() == std::char_traits<char>::eof();
+    }
+
+    if (!found || memcmp(record.magic, "NORITUN", 8) != 0 ||
+        record.version != BVHCacheHeader::VERSION || record.key != key)
+        return false;
+
+    params = record.params;
+    return true;
+}
+
+void Accel::saveTuning(uint64_t key, const BuildParameters &params) const {
+    BVHTuningRecord record;
+    memcpy(record.magic, "NORITUN", 8);
+    record.version = BVHCacheHeader::VERSION;
+    record.reserved = 0;
+    record.key = key;
+    record.params = params;
+    std::string data((const char *) &record, sizeof(BVHTuningRecord));
+
+    if (m_memoryCache)
+        s_memoryCache.insert(key, std::make_shared<const std::string>(data), data.size());
+
+    if (!m_cacheDir.empty()) {
+        /* Written like the BVH cache files, see saveCache() */
+        std::string filename = tfm::format("%s/%016x.tune", m_cacheDir, key);
+        std::string tempname = tfm::format("%s.%016x.tmp", filename,
+            (uint64_t) std::chrono::high_resolution_clock::now().time_since_epoch().count());
+        {
+            std::ofstream os(tempname, std::ios::binary);
+            os.write(data.data(), data.size());
+            if (os.fail()) {
+                cerr << "Warning: unable to write the BVH cache file \"" << tempname << "\"" << endl;
+                os.close();
+                std::remove(tempname.c_str());
+                return;
+            }
+        }
+        if (std::rename(tempname.c_str(), filename.c_str()) != 0)
+            std::remove(tempname.c_str());
+    }
+}
+
+bool Accel::loadCache(const std::string &filename, uint64_t key) {
+    MappedFile file(filename);
+    if (!file.data() || file.size() < sizeof(BVHCacheHeader))
+        return false;
+
+    cout << "Loading cached BVH \"" << filename << "\" .. ";
+    cout.flush();
+    Timer timer;
+
+    if (!readCache(file.data(), file.size(), key)) {
+        cout << "stale, rebuilding." << endl;
+        return false;
+    }
+
+    cout << "done. (took " << timer.elapsedString() << ")" << endl;
+    return true;
+}
+
+bool Accel::readCache(const char *data, size_t size, uint64_t key) {
+    if (size < sizeof(BVHCacheHeader))
+        return false;
+
+    BVHCacheHeader header;
+    memcpy(&header, data, sizeof(BVHCacheHeader));
+    size_t expectedSize = sizeof(BVHCacheHeader) +
+        sizeof(BVHNode) * header.nodeCount +
+        sizeof(uint32_t) * header.indexCount +
+        sizeof(BVHTriangleGroup) * getGroupCount(header.indexCount);
+
+    if (memcmp(header.magic, "NORIBVH", 8) != 0 ||
+        header.version != BVHCacheHeader::VERSION ||
+        header.key != key || header.nodeCount == 0 ||
+        size != expectedSize)
+        return false;
+
+    const char *ptr = data + sizeof(BVHCacheHeader);
+    m_nodes.resize(header.nodeCount);
+    memcpy(reinterpret_cast<char *>(m_nodes.data()), ptr, sizeof(BVHNode) * header.nodeCount);
+    ptr += sizeof(BVHNode) * header.nodeCount;
+
+    m_indices.resize(header.indexCount);
+    memcpy(m_indices.data(), ptr, sizeof(uint32_t) * header.indexCount);
+    ptr += sizeof(uint32_t) * header.indexCount;
+
+    m_triangles.resize(getGroupCount(header.indexCount));
+    memcpy(m_triangles.data(), ptr, sizeof(BVHTriangleGroup) * m_triangles.size());
+    return true;
+}
+
+void Accel::saveCache(const std::string &filename, uint64_t key) const {
+    /* Several renders may run concurrently -- write to a temporary file
+       and move it into place so that readers never see a partial file */
+    std::string tempname = tfm::format("%s.%016x.tmp", filename,
+        (uint64_t) std::chrono::high_resolution_clock::now().time_since_epoch().count());
+    {
+        std::ofstream os(tempname, std::ios::binary);
+        writeCache(os, key);
+        if (os.fail()) {
+            cerr << "Warning: unable to write the BVH cache file \"" << tempname << "\"" << endl;
+            os.close();
+            std::remove(tempname.c_str());
+            return;
+        }
+    }
+
+    if (std::rename(tempname.c_str(), filename.c_str()) != 0)
+        std::remove(tempname.c_str());
+}
+
+void Accel::writeCache(std::ostream &os, uint64_t key) const {
+    BVHCacheHeader header;
+    memset(&header, 0, sizeof(BVHCacheHeader));
+    memcpy(header.magic, "NORIBVH", 8);
+    header.version = BVHCacheHeader::VERSION;
+    header.nodeCount = (uint32_t) m_nodes.size();
+    header.indexCount = (uint32_t) m_indices.size();
+    header.key = key;
+
+    os.write((const char *) &header, sizeof(BVHCacheHeader));
+    os.write((const char *) m_nodes.data(), sizeof(BVHNode) * m_nodes.size());
+    os.write((const char *) m_indices.data(), sizeof(uint32_t) * m_indices.size());
+    os.write((const char *) m_triangles.data(), sizeof(BVHTriangleGroup) * m_triangles.size());
+}
+
+void Accel::setMemoryCache(bool enabled, size_t capacity) {
+    s_memoryCacheEnabled = enabled;
+    s_memoryCache.setCapacity(capacity);
+}
+
+void Accel::clearMemoryCache() {
+    s_memoryCache.clear();
+}
+
+template <int N> int Accel::gather(uint32_t node_idx, uint32_t (&children)[N]) const {
+    /* Repeatedly open the inner node with the largest surface area */
+    int count = 1;
+    children[0] = node_idx;
+
+    while (count < N) {
+        int best = -1;
+        float best_area = -1;
+        for (int i=0; i<count; ++i) {
+            const BVHNode &child = m_nodes[children[i]];
+            if (child.isInner() && child.bbox.getSurfaceArea() > best_area) {
+                best = i;
+                best_area = child.bbox.getSurfaceArea();
+            }
+        }
+        if (best == -1)
+            break;
+        uint32_t idx = children[best];
+        children[best] = idx + 1;
+        children[count++] = m_nodes[idx].inner.rightChild;
+    }
+
+    return count;
+}
+
+template <int N> uint32_t Accel::countWide(uint32_t node_idx) const {
+    uint32_t children[N];
+    int count = gather(node_idx, children);
+    uint32_t result = 1;
+    for (int i=0; i<count; ++i) {
+        if (m_nodes[children[i]].isInner())
+            result += countWide<N>(children[i]);
+    }
+    return result;
+}
+
+template <typename Node> void Accel::collapse(NodeArray<Node> &nodes) const {
+    /* Count the nodes first, so that the array is allocated exactly once
+       (including the padding that reorder() inserts at page boundaries) */
+    size_t count = countWide<Node::Width>(0u);
+    if (m_reorder && NORI_PAGE_SIZE % sizeof(Node) != 0)
+        count += count * sizeof(Node) / (NORI_PAGE_SIZE - sizeof(Node)) + 2;
+    nodes.clear();
+    nodes.reserve(count);
+    collapse(nodes, 0u);
+}
+
+template <typename Node> uint32_t Accel::collapse(NodeArray<Node> &nodes, uint32_t node_idx) const {
+    const int N = Node::Width;
+    uint32_t children[N];
+    int count = gather(node_idx, children);
+
+    uint32_t wide_idx = (uint32_t) nodes.size();
+    nodes.emplace_back();
+
+    BVHWideNode<N> wide;
+    for (int i=0; i<N; ++i) {
+        const BVHNode *child = i < count ? &m_nodes[children[i]] : nullptr;
+
+        if (!child || (child->isLeaf() && child->leaf.size == 0)) {
+            /* Unused slot: an empty box that is never hit */
+            for (int axis=0; axis<3; ++axis) {
+                wide.bounds[axis][i] = std::numeric_limits<float>::infinity();
+                wide.bounds[axis+3][i] = -std::numeric_limits<float>::infinity();
+            }
+            wide.child[i] = wide.count[i] = 0;
+            continue;
+        }
+
+        for (int axis=0; axis<3; ++axis) {
+            wide.bounds[axis][i] = child->bbox.min[axis];
+            wide.bounds[axis+3][i] = child->bbox.max[axis];
+        }
+
+        if (child->isLeaf()) {
+            wide.child[i] = child->start();
+            wide.count[i] = child->leaf.size;
+        } else {
+            wide.count[i] = 0;
+            wide.child[i] = collapse(nodes, children[i]);
+        }
+    }
+
+    /* Note: the recursion may have reallocated 'nodes' */
+    encode(wide, nodes[wide_idx]);
+    return wide_idx;
+}
+
+template <typename Node> void Accel::reorder(NodeArray<Node> &nodes) {
+    if (nodes.empty())
+        return;
+
+    /* Entries of 'order' starting at 'count' refer to padding nodes */
+    const uint32_t count = (uint32_t) nodes.size();
+    uint32_t padding = count;
+    std::vector<uint32_t> order, treelet;
+    std::deque<uint32_t> roots;
+    order.reserve(nodes.capacity());
+    roots.push_back(0u);
+
+    while (!roots.empty()) {
+        uint32_t root = roots.front();
+        roots.pop_front();
+
+        /* Every treelet fills the rest of the current page. Nodes that
+           would straddle a page boundary are replaced by padding */
+        size_t capacity;
+        while ((capacity = (NORI_PAGE_SIZE - order.size() * sizeof(Node) % NORI_PAGE_SIZE) / sizeof(Node)) == 0)
+            order.push_back(padding++);
+
+        /* Grow the treelet breadth-first, children that no longer
+           fit become the roots of later treelets */
+        treelet.clear();
+        treelet.push_back(root);
+        for (size_t head = 0; head < treelet.size(); ++head) {
+            const Node &node = nodes[treelet[head]];
+            order.push_back(treelet[head]);
+            for (int i=0; i<Node::Width; ++i) {
+                /* Skip leaves and unused slots (the root is never a child) */
+                if (node.isLeaf(i) || node.child[i] == 0)
+                    continue;
+                if (treelet.size() < capacity)
+                    treelet.push_back(node.child[i]);
+                else
+                    roots.push_back(node.child[i]);
+            }
+        }
+    }
+
+    /* Padding nodes have no children and are never referenced */
+    nodes.resize(padding, Node());
+
+    std::vector<uint32_t> position(nodes.size());
+    for (uint32_t i = 0; i < (uint32_t) order.size(); ++i)
+        position[order[i]] = i;
+    std::vector<uint32_t>().swap(order);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        Node &node = nodes[i];
+        for (int j=0; j<Node::Width; ++j) {
+            if (!node.isLeaf(j) && node.child[j] != 0)
+                node.child[j] = position[node.child[j]];
+        }
+    }
+
+    /* Apply the permutation in place by following its cycles */
+    for (uint32_t i = 0; i < (uint32_t) nodes.size(); ++i) {
+        while (position[i] != i) {
+            uint32_t j = position[i];
+            std::swap(nodes[i], nodes[j]);
+            std::swap(position[i], position[j]);
+        }
+    }
+}
+
+template <int N> void Accel::encode(const BVHWideNode<N> &node, BVHQuantizedNode<N> &qnode) {
+    for (int axis=0; axis<3; ++axis) {
+        /* The grid spans the union of all (valid) child boxes */
+        float min = std::numeric_limits<float>::infinity(),
+              max = -std::numeric_limits<float>::infinity();
+        for (int i=0; i<N; ++i) {
+            if (node.bounds[axis][i] > node.bounds[axis+3][i])
+                continue;
+            min = std::min(min, node.bounds[axis][i]);
+            max = std::max(max, node.bounds[axis+3][i]);
+        }
+        if (!(min <= max))
+            min = max = 0;
+
+        /* Make sure that the last grid cell reaches the maximum
+           despite rounding errors during decoding */
+        float scale = max > min ? (max - min) / 255.0f : 1.0f;
+        while (min + 255.0f * scale < max)
+            scale = std::nextafter(scale, std::numeric_limits<float>::infinity());
+        qnode.origin[axis] = min;
+        qnode.scale[axis] = scale;
+
+        for (int i=0; i<N; ++i) {
+            float bmin = node.bounds[axis][i], bmax = node.bounds[axis+3][i];
+            if (bmin > bmax) {
+                /* Unused slot: an empty box that is never hit */
+                qnode.bounds[axis][i] = 255;
+                qnode.bounds[axis+3][i] = 0;
+                continue;
+            }
+
+            /* Round outwards, then fix up any remaining rounding errors */
+            int qmin = std::min(std::max((int) std::floor((bmin - min) / scale), 0), 255);
+            int qmax = std::min(std::max((int) std::ceil((bmax - min) / scale), 0), 255);
+            while (qmin > 0 && min + (float) qmin * scale > bmin)
+                --qmin;
+            while (qmax < 255 && min + (float) qmax * scale < bmax)
+                ++qmax;
+            qnode.bounds[axis][i] = (uint8_t) qmin;
+            qnode.bounds[axis+3][i] = (uint8_t) qmax;
+        }
+    }
+
+    for (int i=0; i<N; ++i) {
+        qnode.child[i] = node.child[i];
+        qnode.count[i] = node.count[i];
+    }
+}
+
+std::pair<float, uint32_t> Accel::statistics() const {
+    /* Without the binary tree, evaluate the tree that is traversed */
+    if (m_nodes.empty()) {
+        if (!m_nodes4.empty())
+            return statistics(m_nodes4, 0u);
+        if (!m_nodes8.empty())
+            return statistics(m_nodes8, 0u);
+        if (!m_qnodes4.empty())
+            return statistics(m_qnodes4, 0u);
+        if (!m_qnodes8.empty())
+            return statistics(m_qnodes8, 0u);
+        return std::make_pair(0.0f, 0u);
+    }
+    return statistics(0u);
+}
+
+std::pair<float, uint32_t> Accel::statistics(uint32_t node_idx) const {
+    const BVHNode &node = m_nodes[node_idx];
+    if (node.isLeaf()) {
+        return std::make_pair(m_params.intersectionCost * node.leaf.size, 1u);
+    } else {
+        std::pair<float, uint32_t> stats_left = statistics(node_idx + 1u);
+        std::pair<float, uint32_t> stats_right = statistics(node.inner.rightChild);
+        float saLeft = m_nodes[node_idx + 1u].bbox.getSurfaceArea();
+        float saRight = m_nodes[node.inner.rightChild].bbox.getSurfaceArea();
+        float saCur = node.bbox.getSurfaceArea();
+        float sahCost =
+            2 * m_params.traversalCost +
+            (saLeft * stats_left.first + saRight * stats_right.first) / saCur;
+        return std::make_pair(
+            sahCost,
+            stats_left.second + stats_right.second + 1u
+        );
+    }
+}
+
+template <typename Node> std::pair<float, uint32_t> Accel::statistics(
+        const NodeArray<Node> &nodes, uint32_t node_idx) const {
+    const Node &node = nodes[node_idx];
+    typename Node::Bounds storage;
+    const typename Node::Bounds &bounds = node.getBounds(storage);
+
+    /* Each visit tests all child boxes, just like two boxes per binary node */
+    float cost = 0.0f;
+    uint32_t count = 1u;
+    BoundingBox3f bbox;
+    for (int i=0; i<Node::Width; ++i) {
+        if (!node.isLeaf(i) && node.child[i] == 0)
+            continue;
+        BoundingBox3f childBox(
+            Point3f(bounds[0][i], bounds[1][i], bounds[2][i]),
+            Point3f(bounds[3][i], bounds[4][i], bounds[5][i]));
+        bbox.expandBy(childBox);
+
+        if (node.isLeaf(i)) {
+            cost += childBox.getSurfaceArea() * m_params.intersectionCost * node.count[i];
+        } else {
+            std::pair<float, uint32_t> stats = statistics(nodes, node.child[i]);
+            cost += childBox.getSurfaceArea() * stats.first;
+            count += stats.second;
+        }
+    }
+
+    return std::make_pair(Node::Width * m_params.traversalCost + cost / bbox.getSurfaceArea(), count);
+}
+
+/* Per-thread traversal statistics of all BVHs with 'accelStatistics' enabled */
+static tbb::enumerable_thread_specific<Accel::TraversalStatistics,
+    tbb::cache_aligned_allocator<Accel::TraversalStatistics>,
+    tbb::ets_key_per_instance> s_statistics;
+
+/* Redirected statistics of the current thread, see Accel::setThreadStatistics() */
+static thread_local Accel::TraversalStatistics *t_statistics = nullptr;
+
+Accel::TraversalStatistics Accel::getStatistics() {
+    TraversalStatistics result;
+    for (const TraversalStatistics &stats : s_statistics)
+        result += stats;
+    return result;
+}
+
+void Accel::resetStatistics() {
+    for (TraversalStatistics &stats : s_statistics)
+        stats = TraversalStatistics();
+}
+
+Accel::TraversalStatistics *Accel::setThreadStatistics(TraversalStatistics *stats) {
+    TraversalStatistics *previous = t_statistics;
+    t_statistics = stats;
+    return previous;
+}
+
+/* Remaining closest-hit queries of the current thread that are camera rays */
+static thread_local uint32_t t_primaryRays = 0;
+
+void Accel::countPrimaryRays(uint32_t count) {
+    t_primaryRays = count;
+}
+
+/* Return the type of the next "count" queries of the current thread */
+static Accel::ERayType nextRayType(bool shadowRay, uint32_t count = 1) {
+    if (shadowRay)
+        return Accel::EShadow;
+    if (t_primaryRays == 0)
+        return Accel::EClosestHit;
+    t_primaryRays -= std::min(count, t_primaryRays);
+    return Accel::EPrimary;
+}
+
+std::string Accel::TraversalStatistics::toString() const {
+    const char *names[ERayTypeCount] = { "primary", "secondary", "shadow" };
+    std::string result = "TraversalStatistics[\n";
+    for (int i=0; i<ERayTypeCount; ++i) {
+        const TraversalCounters &c = counters[i];
+        double rays = (double) std::max(c.rays, (uint64_t) 1);
+        result += tfm::format("  %-11s: %llu rays (%.1f%% hit), %.2f nodes, "
+                              "%.2f boxes, %.2f triangles per ray\n",
+            names[i], (unsigned long long) c.rays, 100.0 * c.hits / rays,
+            c.nodes / rays, c.boxes / rays, c.triangles / rays);
+    }
+    return result + "]";
+}
+
+Accel::TraversalCounters *Accel::getCounters(ERayType type) const {
+    TraversalStatistics *stats = t_statistics;
+    if (!stats && m_statistics)
+        stats = &s_statistics.local();
+    return stats ? &stats->counters[type] : nullptr;
+}
+
+bool Accel::rayIntersect(const Ray3f &_ray, Intersection &its, bool shadowRay) const {
+    its.t = std::numeric_limits<float>::infinity();
+
+    TraversalCounters *counters = getCounters(nextRayType(shadowRay));
+    if (counters)
+        counters->rays++;
+
+    /* Use an adaptive ray epsilon */
+    Ray3f ray(_ray);
+    if (ray.mint == Epsilon)
+        ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+
+    if ((m_triangles.empty() && m_instances.empty()) || ray.maxt < ray.mint)
+        return false;
+
+    bool foundIntersection = false;
+    uint32_t f = 0;
+    const BVHInstance *instance = nullptr;
+
+    if (!m_triangles.empty())
+        foundIntersection = traverse(ray, its, shadowRay, f, counters);
+
+    if (!m_instances.empty() && !(foundIntersection && shadowRay)) {
+        /* The bottom-level BVHs only report hits closer than ray.maxt */
+        if (traverseInstances(ray, its, shadowRay, f, instance, counters))
+            foundIntersection = true;
+    }
+
+    if (foundIntersection && counters)
+        counters->hits++;
+
+    if (foundIntersection && !shadowRay) {
+        fillIntersection(its, f);
+        if (instance)
+            fillIntersection(its, *instance);
+    }
+
+    return foundIntersection;
+}
+
+bool Accel::traverseInstances(Ray3f &ray, Intersection &its, bool shadowRay,
+        uint32_t &f, const BVHInstance *&instance, TraversalCounters *counters) const {
+    uint32_t node_idx = 0, stack_idx = 0, stack[64];
+    bool foundIntersection = false;
+    bool dirIsNeg[3] = { ray.d.x() < 0, ray.d.y() < 0, ray.d.z() < 0 };
+
+    while (true) {
+        const BVHNode &node = m_instanceNodes[node_idx];
+        if (counters)
+            counters->boxes++;
+
+        if (!node.bbox.rayIntersect(ray)) {
+            if (stack_idx == 0)
+                break;
+            node_idx = stack[--stack_idx];
+            continue;
+        }
+
+        if (counters)
+            counters->nodes++;
+
+        if (node.isInner()) {
+            if (dirIsNeg[node.inner.axis]) {
+                stack[stack_idx++] = node_idx + 1;
+                node_idx = node.inner.rightChild;
+            } else {
+                stack[stack_idx++] = node.inner.rightChild;
+                node_idx++;
+            }
+            assert(stack_idx<64);
+        } else {
+            const BVHInstance &record = m_instances[node.start()];
+
+            /* Move the ray into object space, keeping its parameterization */
+            Ray3f localRay(record.toLocal * ray.o + record.toLocalOffset,
+                           record.toLocal * ray.d, ray.mint, ray.maxt);
+
+            if (record.accel->traverse(localRay, its, shadowRay, f, counters)) {
+                if (shadowRay)
+                    return true;
+                foundIntersection = true;
+                ray.maxt = localRay.maxt;
+                instance = &record;
+            }
+            if (stack_idx == 0)
+                break;
+            node_idx = stack[--stack_idx];
+            continue;
+        }
+    }
+
+    return foundIntersection;
+}
+
+bool Accel::traverse(Ray3f &ray, Intersection &its, bool shadowRay, uint32_t &f,
+        TraversalCounters *counters) const {
+    switch (m_layout) {
+        case EWide4:
+            return m_quantize ? traverseWide(m_qnodes4, ray, its, shadowRay, f, counters)
+                              : traverseWide(m_nodes4, ray, its, shadowRay, f, counters);
+        case EWide8:
+            return m_quantize ? traverseWide(m_qnodes8, ray, its, shadowRay, f, counters)
+                              : traverseWide(m_nodes8, ray, its, shadowRay, f, counters);
+        default:
+            return traverseBinary(ray, its, shadowRay, f, counters);
+    }
+}
+
+uint32_t Accel::rayIntersectPacket(const Ray3f *_rays, Intersection *its, uint32_t mask) const {
+    Ray3f rays[NORI_PACKET_SIZE];
+    uint32_t f[NORI_PACKET_SIZE];
+    PacketRays packet;
+
+    mask &= (uint32_t) ((1ull << NORI_PACKET_SIZE) - 1);
+
+    if (!m_instances.empty()) {
+        /* The two-level BVH is traversed one ray at a time */
+        uint32_t hits = 0;
+        for (int i=0; i<NORI_PACKET_SIZE; ++i) {
+            if ((mask & (1u << i)) && rayIntersect(_rays[i], its[i]))
+                hits |= 1u << i;
+        }
+        return hits;
+    }
+
+    ERayType type = nextRayType(false, bitCount(mask));
+
+    for (int i=0; i<NORI_PACKET_SIZE; ++i) {
+        /* Inactive rays are given an empty interval */
+        packet.mint[i] = 1.0f;
+        packet.maxt[i] = 0.0f;
+        for (int axis=0; axis<3; ++axis)
+            packet.o[axis][i] = packet.rcp[axis][i] = 0.0f;
+
+        if (!(mask & (1u << i)))
+            continue;
+
+        its[i].t = std::numeric_limits<float>::infinity();
+
+        /* Use an adaptive ray epsilon */
+        Ray3f &ray = rays[i];
+        ray = _rays[i];
+        if (ray.mint == Epsilon)
+            ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+
+        if (ray.maxt < ray.mint) {
+            mask &= ~(1u << i);
+            continue;
+        }
+
+        WideRay wray(ray);
+        for (int axis=0; axis<3; ++axis) {
+            packet.o[axis][i] = wray.o[axis];
+            packet.rcp[axis][i] = wray.rcp[axis];
+        }
+        packet.mint[i] = ray.mint;
+        packet.maxt[i] = ray.maxt;
+    }
+
+    TraversalCounters *counters = getCounters(type);
+    if (counters)
+        counters->rays += bitCount(mask);
+
+    if (m_triangles.empty() || mask == 0)
+        return 0u;
+
+    uint32_t hit_mask;
+    switch (m_layout) {
+        case EWide4:
+            hit_mask = m_quantize ? traversePacketWide(m_qnodes4, rays, its, f, packet, mask, counters)
+                                  : traversePacketWide(m_nodes4, rays, its, f, packet, mask, counters);
+            break;
+        case EWide8:
+            hit_mask = m_quantize ? traversePacketWide(m_qnodes8, rays, its, f, packet, mask, counters)
+                                  : traversePacketWide(m_nodes8, rays, its, f, packet, mask, counters);
+            break;
+        default:
+            hit_mask = traversePacketBinary(rays, its, f, packet, mask, counters);
+    }
+
+    for (int i=0; i<NORI_PACKET_SIZE; ++i) {
+        if (hit_mask & (1u << i))
+            fillIntersection(its[i], f[i]);
+    }
+
+    if (counters)
+        counters->hits += bitCount(hit_mask);
+
+    return hit_mask;
+}
+
+uint32_t Accel::traversePacketBinary(Ray3f *rays, Intersection *its, uint32_t *f,
+        PacketRays &packet, uint32_t mask, TraversalCounters *counters) const {
+    /* Children are visited in the order preferred by the first active ray */
+    int first = 0;
+    while (!(mask & (1u << first)))
+        ++first;
+    bool dirNeg[3] = { rays[first].d.x() < 0, rays[first].d.y() < 0, rays[first].d.z() < 0 };
+
+    struct StackEntry {
+        uint32_t node_idx, mask;
+    };
+
+    StackEntry stack[64];
+    uint32_t node_idx = 0, stack_idx = 0, node_mask = mask, hit_mask = 0;
+
+    while (true) {
+        const BVHNode &node = m_nodes[node_idx];
+        if (counters)
+            counters->boxes += bitCount(node_mask);
+        node_mask = intersectBoxPacket(node.bbox, packet, node_mask);
+
+        if (node_mask != 0) {
+            if (counters)
+                counters->nodes++;
+            if (node.isInner()) {
+                uint32_t near = node_idx + 1, far = node.inner.rightChild;
+                if (dirNeg[node.inner.axis])
+                    std::swap(near, far);
+                stack[stack_idx++] = StackEntry { far, node_mask };
+                assert(stack_idx<64);
+                node_idx = near;
+                continue;
+            }
+
+            for (int i=0; i<NORI_PACKET_SIZE; ++i) {
+                if (!(node_mask & (1u << i)))
+                    continue;
+                if (intersectLeaf(node.start(), node.end(), rays[i], its[i], false, f[i], counters)) {
+                    hit_mask |= 1u << i;
+                    packet.maxt[i] = rays[i].maxt;
+                }
+            }
+        }
+
+        if (stack_idx == 0)
+            break;
+        --stack_idx;
+        node_idx = stack[stack_idx].node_idx;
+        node_mask = stack[stack_idx].mask;
+    }
+
+    return hit_mask;
+}
+
+template <typename Node> uint32_t Accel::traversePacketWide(const NodeArray<Node> &nodes,
+        Ray3f *rays, Intersection *its, uint32_t *f, PacketRays &packet, uint32_t mask,
+        TraversalCounters *counters) const {
+    enum { N = Node::Width };
+    struct StackEntry {
+        uint32_t child, count, mask;
+    };
+
+    /* Children are visited in the order preferred by the first active ray */
+    int first = 0;
+    while (!(mask & (1u << first)))
+        ++first;
+    const Vector3f &d = rays[first].d;
+
+    /* Every level pushes at most N entries */
+    StackEntry stack[64 * N];
+    uint32_t stack_idx = 0, hit_mask = 0;
+    typename Node::Bounds storage;
+    float order[N];
+
+    stack[stack_idx++] = StackEntry { 0u, 0u, mask };
+
+    while (stack_idx > 0) {
+        StackEntry entry = stack[--stack_idx];
+        if (counters)
+            counters->nodes++;
+
+        if (entry.count > 0) {
+            for (int i=0; i<NORI_PACKET_SIZE; ++i) {
+                if (!(entry.mask & (1u << i)))
+                    continue;
+                if (intersectLeaf(entry.child, entry.child + entry.count, rays[i], its[i], false, f[i], counters)) {
+                    hit_mask |= 1u << i;
+                    packet.maxt[i] = rays[i].maxt;
+                }
+            }
+            continue;
+        }
+
+        const Node &node = nodes[entry.child];
+        const typename Node::Bounds &bounds = node.getBounds(storage);
+        if (counters)
+            counters->boxes += N * bitCount(entry.mask);
+
+        /* Push the children that overlap any of the rays, sorted so that the
+           nearest one along the first active ray ends up on top */
+        uint32_t firstChild = stack_idx;
+        for (int i=0; i<N; ++i) {
+            /* Skip unused slots (and children that became empty in refit()) */
+            if (bounds[0][i] > bounds[3][i] || bounds[1][i] > bounds[4][i] || bounds[2][i] > bounds[5][i])
+                continue;
+            BoundingBox3f bbox(Point3f(bounds[0][i], bounds[1][i], bounds[2][i]),
+                               Point3f(bounds[3][i], bounds[4][i], bounds[5][i]));
+            uint32_t childMask = intersectBoxPacket(bbox, packet, entry.mask);
+            if (childMask == 0)
+                continue;
+
+            StackEntry child { node.child[i], node.count[i], childMask };
+            float distance = d.dot(bbox.getCenter());
+            uint32_t j = stack_idx++;
+            while (j > firstChild && order[j-1-firstChild] < distance) {
+                stack[j] = stack[j-1];
+                order[j-firstChild] = order[j-1-firstChild];
+                --j;
+            }
+            stack[j] = child;
+            order[j-firstChild] = distance;
+        }
+        assert(stack_idx <= 64 * N);
+    }
+
+    return hit_mask;
+}
+
+bool Accel::traverseBinary(Ray3f &ray, Intersection &its, bool shadowRay, uint32_t &f,
+        TraversalCounters *counters) const {
+    uint32_t node_idx = 0, stack_idx = 0, stack[64];
+    bool foundIntersection = false;
+
+    /* The sign of the ray direction along each axis decides which child
+       of an inner node lies nearer to the ray origin */
+    bool dirIsNeg[3] = { ray.d.x() < 0, ray.d.y() < 0, ray.d.z() < 0 };
+
+    while (true) {
+        const BVHNode &node = m_nodes[node_idx];
+        if (counters)
+            counters->boxes++;
+
+        if (!node.bbox.rayIntersect(ray)) {
+            if (stack_idx == 0)
+                break;
+            node_idx = stack[--stack_idx];
+            continue;
+        }
+
+        if (counters)
+            counters->nodes++;
+
+        if (node.isInner()) {
+            /* Visit the near child first so that the ray's maxt shrinks
+               early and the far child can be culled by its bounding box */
+            if (dirIsNeg[node.inner.axis]) {
+                stack[stack_idx++] = node_idx + 1;
+                node_idx = node.inner.rightChild;
+            } else {
+                stack[stack_idx++] = node.inner.rightChild;
+                node_idx++;
+            }
+            assert(stack_idx<64);
+        } else {
+            if (intersectLeaf(node.start(), node.end(), ray, its, shadowRay, f, counters)) {
+                if (shadowRay)
+                    return true;
+                foundIntersection = true;
+            }
+            if (stack_idx == 0)
+                break;
+            node_idx = stack[--stack_idx];
+            continue;
+        }
+    }
+
+    return foundIntersection;
+}
+
+template <typename Node> bool Accel::traverseWide(const NodeArray<Node> &nodes,
+        Ray3f &ray, Intersection &its, bool shadowRay, uint32_t &f,
+        TraversalCounters *counters) const {
+    enum { N = Node::Width };
+    struct StackEntry {
+        uint32_t child, count;
+        float tNear;
+    };
+
+    /* Every level pushes at most N entries */
+    StackEntry stack[64 * N];
+    uint32_t stack_idx = 0;
+    bool foundIntersection = false;
+    WideRay wray(ray);
+    float tNear[N];
+    typename Node::Bounds bounds;
+
+    stack[stack_idx++] = StackEntry { 0u, 0u, ray.mint };
+
+    while (stack_idx > 0) {
+        StackEntry entry = stack[--stack_idx];
+
+        /* Skip subtrees that lie beyond the closest intersection found so far */
+        if (entry.tNear > ray.maxt)
+            continue;
+
+        if (counters)
+            counters->nodes++;
+
+        if (entry.count > 0) {
+            if (intersectLeaf(entry.child, entry.child + entry.count, ray, its, shadowRay, f, counters)) {
+                if (shadowRay)
+                    return true;
+                foundIntersection = true;
+            }
+            continue;
+        }
+
+        const Node &node = nodes[entry.child];
+        if (counters)
+            counters->boxes += N;
+        int mask = intersectBoxes<N>(node.getBounds(bounds), wray, ray.mint, ray.maxt, tNear);
+
+        /* Push the children that were hit, sorted so that the closest one ends
+           up on top (any hit suffices for shadow rays, so don't bother sorting) */
+        uint32_t first = stack_idx;
+        for (int i=0; i<N; ++i) {
+            if (!(mask & (1 << i)))
+                continue;
+            StackEntry child { node.child[i], node.count[i], tNear[i] };
+            uint32_t j = stack_idx++;
+            while (!shadowRay && j > first && stack[j-1].tNear < child.tNear) {
+                stack[j] = stack[j-1];
+                --j;
+            }
+            stack[j] = child;
+        }
+        assert(stack_idx <= 64 * N);
+    }
+
+    return foundIntersection;
+}
+
+bool Accel::intersectLeaf(uint32_t start, uint32_t end, Ray3f &ray,
+        Intersection &its, bool shadowRay, uint32_t &f, TraversalCounters *counters) const {
+    const uint32_t W = BVHTriangleGroup::Width;
+    bool foundIntersection = false;
+    uint32_t closest = 0;
+    float t[W], u[W], v[W];
+    WatertightRay wray(ray);
+
+    if (counters)
+        counters->triangles += end - start;
+
+    for (uint32_t group = start / W; group * W < end; ++group) {
+        /* Leaves start at a group boundary, mask out the padding of the last group */
+        uint32_t first = group * W;
+        int lanes = (1 << W) - 1;
+        if (first + W > end)
+            lanes &= (1 << (end - first)) - 1;
+
+        int mask = intersectTriangles<W>(m_triangles[group].p, wray,
+            ray.mint, ray.maxt, t, u, v) & lanes;
+        if (mask == 0)
+            continue;
+        if (shadowRay)
+            return true;
+
+        int best = -1;
+        for (uint32_t i = 0; i < W; ++i) {
+            if ((mask & (1 << i)) && (best < 0 || t[i] < t[best]))
+                best = (int) i;
+        }
+
+        foundIntersection = true;
+        ray.maxt = its.t = t[best];
+        its.uv = Point2f(u[best], v[best]);
+        closest = first + best;
+    }
+
+    /* Only resolve the mesh of the closest triangle in this leaf */
+    if (foundIntersection) {
+        const BVHTriangleGroup &group = m_triangles[closest / W];
+        its.mesh = m_meshes[group.mesh[closest % W]];
+        f = group.index[closest % W];
+    }
+
+    return foundIntersection;
+}
+
+void Accel::fillIntersection(Intersection &its, uint32_t f) const {
+    /* Find the barycentric coordinates */
+    Vector3f bary;
+    bary << 1-its.uv.sum(), its.uv;
+
+    /* References to all relevant mesh buffers */
+    const Mesh *mesh   = its.mesh;
+    const MatrixXf &V  = mesh->getVertexPositions();
+    const MatrixXf &N  = mesh->getVertexNormals();
+    const MatrixXf &UV = mesh->getVertexTexCoords();
+    const MatrixXu &F  = mesh->getIndices();
+
+    /* Vertex indices of the triangle */
+    uint32_t idx0 = F(0, f), idx1 = F(1, f), idx2 = F(2, f);
+
+    Point3f p0 = V.col(idx0), p1 = V.col(idx1), p2 = V.col(idx2);
+
+    /* Compute the intersection positon accurately
+       using barycentric coordinates */
+    its.p = bary.x() * p0 + bary.y() * p1 + bary.z() * p2;
+
+    /* Compute proper texture coordinates if provided by the mesh */
+    if (UV.size() > 0)
+        its.uv = bary.x() * UV.col(idx0),
+            bary.y() * UV.col(idx1),
+            bary.z() * UV.col(idx2);
+
+    /* Compute the geometry frame */
+    its.geoFrame = Frame((p1-p0).cross(p2-p0).normalized());
+
+    if (N.size() > 0) {
+        /* Compute the shading frame. Note that for simplicity,
+           the current implementation doesn't attempt to provide
+           tangents that are continuous across the surface. That
+           means that this code will need to be modified to be able
+           use anisotropic BRDFs, which need tangent continuity */
+
+        its.shFrame = Frame(
+            (bary.x() * N.col(idx0) +
+             bary.y() * N.col(idx1) +
+             bary.z() * N.col(idx2)).normalized());
+    } else {
+        its.shFrame = its.geoFrame;
+    }
+}
+
+void Accel::fillIntersection(const Ray3f &ray, const Mesh *mesh, uint32_t f,
+        const Point2f &bary, Intersection &its) const {
+    const Instance *instance = dynamic_cast<const Instance *>(mesh);
+
+    /* Instances are filled in object space first, like in rayIntersect() */
+    its.mesh = instance ? instance->getPrototype() : mesh;
+    its.uv = bary;
+    fillIntersection(its, f);
+
+    if (instance) {
+        BVHInstance record;
+        record.instance = const_cast<Instance *>(instance);
+        record.accel = nullptr;
+        record.toLocal = instance->getTransform().getInverseMatrix().topLeftCorner<3, 3>();
+        fillIntersection(its, record);
+    }
+
+    its.t = (its.p - ray.o).dot(ray.d);
+}
+
+void Accel::fillIntersection(Intersection &its, const BVHInstance &instance) const {
+    if (!instance.instance)
+        return; /* Meshes added after build() aren't transformed */
+
+    const Transform &toWorld = instance.instance->getTransform();
+
+    /* Transformations that flip the orientation also flip the geometric
+       normal of the transformed triangles (as if the mesh was baked) */
+    Normal3f geoNormal = toWorld * its.geoFrame.n;
+    if (instance.toLocal.determinant() < 0)
+        geoNormal = -geoNormal;
+
+    its.p = toWorld * its.p;
+    its.geoFrame = Frame(geoNormal.normalized());
+    its.shFrame = Frame((toWorld * its.shFrame.n).normalized());
+    its.mesh = instance.instance;
 }
 
 NORI_NAMESPACE_END
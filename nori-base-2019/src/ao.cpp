@@ -1,6 +1,7 @@
 #include <nori/integrator.h>
 #include <nori/scene.h>
 #include <nori/warp.h>
+#include <nori/raystream.h>
 #include <pcg32.h>
 
 NORI_NAMESPACE_BEGIN
@@ -39,6 +40,34 @@ public:
 		return res;
 		
 	}
+	void LiStream(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+			Color3f *result, uint32_t count) const {
+		/* Find the first intersections of all camera rays */
+		RayStream stream(scene);
+		for (uint32_t i = 0; i < count; ++i)
+			stream.addRay(rays[i]);
+		stream.trace();
+
+		/* Sample one direction per hit, then trace all visibility rays together */
+		RayStream shadowRays(scene);
+		std::vector<uint32_t> shadowIndex(count, (uint32_t) -1);
+		for (uint32_t i = 0; i < count; ++i) {
+			if (!stream.hit(i))
+				continue;
+			const Intersection &its = stream.getIntersection(i);
+			Vector3f wiSample = its.geoFrame.toWorld(Warp::squareToCosineHemisphere(sampler->next2D()));
+			shadowIndex[i] = shadowRays.addShadowRay(Ray3f(its.p, wiSample));
+		}
+		shadowRays.trace();
+
+		for (uint32_t i = 0; i < count; ++i) {
+			bool visible = shadowIndex[i] != (uint32_t) -1 && !shadowRays.hit(shadowIndex[i]);
+			result[i] = Color3f(visible ? 1.f : 0.f);
+		}
+	}
+
+	bool supportsRayStreams() const { return true; }
+
 	std::string toString() const {
 		return "AoIntegrator[]";
 	}
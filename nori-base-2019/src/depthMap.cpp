@@ -26,7 +26,13 @@ public:
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
 	{
 		Intersection its;
-		if (!scene->rayIntersect(ray, its))
+		scene->rayIntersect(ray, its);
+		return shade(scene, sampler, ray, its);
+	}
+
+	Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection &its) const
+	{
+		if (!its.mesh)
 		{
 			return Color3f(0.0f);
 		}
@@ -47,6 +53,11 @@ public:
 		return EIntegratorType::EDepthMap;
 	}
 
+	bool supportsPrimaryHits() const
+	{
+		return true;
+	}
+
 	Point3f position; // postion of point light source
 	Color3f energy; // energy of point light source
 	float maxDist;
@@ -28,7 +28,13 @@ public:
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
 	{
 		Intersection its;
-		if (!scene->rayIntersect(ray, its))
+		scene->rayIntersect(ray, its);
+		return shade(scene, sampler, ray, its);
+	}
+
+	Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection &its) const
+	{
+		if (!its.mesh)
 		{
 			return Color3f(0.f);
 		}
@@ -48,6 +54,11 @@ public:
 		return EIntegratorType::EDepthMapArea;
 	}
 
+	bool supportsPrimaryHits() const
+	{
+		return true;
+	}
+
 
 };
 
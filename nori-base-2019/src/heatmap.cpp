@@ -0,0 +1,96 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Visualizes the BVH traversal cost of the camera rays
+ *
+ * Every pixel is colored by the number of nodes, ray-box tests or
+ * ray-triangle tests that were needed to find the first intersection,
+ * ranging from blue (free) over green to red (<tt>maxCost</tt> or more).
+ * This makes it easy to spot meshes that result in pathological trees.
+ */
+class HeatmapIntegrator : public Integrator {
+public:
+	enum EMetric {
+		ENodes = 0,
+		EBoxes,
+		ETriangles,
+		ETotal
+	};
+
+	HeatmapIntegrator(const PropertyList &props) {
+		std::string metric = props.getString("metric", "nodes");
+		if (metric == "nodes")
+			m_metric = ENodes;
+		else if (metric == "boxes")
+			m_metric = EBoxes;
+		else if (metric == "triangles")
+			m_metric = ETriangles;
+		else if (metric == "total")
+			m_metric = ETotal;
+		else
+			throw NoriException("HeatmapIntegrator: unknown metric \"%s\" (expected "
+			                    "\"nodes\", \"boxes\", \"triangles\" or \"total\")", metric);
+
+		/* Cost that is mapped to the top of the color scale */
+		m_maxCost = props.getFloat("maxCost", 100.0f);
+		if (m_maxCost <= 0)
+			throw NoriException("HeatmapIntegrator: maxCost must be positive");
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
+		/* Count the work done by this thread while tracing the camera ray */
+		Accel::TraversalStatistics stats;
+		Accel::TraversalStatistics *previous = Accel::setThreadStatistics(&stats);
+		Intersection its;
+		scene->rayIntersect(ray, its);
+		Accel::setThreadStatistics(previous);
+
+		/* The camera ray is counted as primary when rendered by the main loop */
+		Accel::TraversalCounters c = stats.counters[Accel::EPrimary];
+		c += stats.counters[Accel::EClosestHit];
+		float cost;
+		switch (m_metric) {
+			case EBoxes: cost = (float) c.boxes; break;
+			case ETriangles: cost = (float) c.triangles; break;
+			case ETotal: cost = (float) (c.boxes + c.triangles); break;
+			default: cost = (float) c.nodes; break;
+		}
+
+		return colorMap(std::min(cost / m_maxCost, 1.0f));
+	}
+
+	/// Map a value in [0, 1] to blue -> cyan -> green -> yellow -> red
+	static Color3f colorMap(float value) {
+		const Color3f colors[5] = {
+			Color3f(0.0f, 0.0f, 1.0f), Color3f(0.0f, 1.0f, 1.0f), Color3f(0.0f, 1.0f, 0.0f),
+			Color3f(1.0f, 1.0f, 0.0f), Color3f(1.0f, 0.0f, 0.0f)
+		};
+		float pos = value * 4.0f;
+		int idx = std::min((int) pos, 3);
+		float t = pos - (float) idx;
+
+		/* The colors are given in sRGB, while the image is stored linearly */
+		Color3f result = colors[idx] * (1.0f - t) + colors[idx + 1] * t;
+		return result.toLinearRGB();
+	}
+
+	std::string toString() const {
+		const char *metrics[] = { "nodes", "boxes", "triangles", "total" };
+		return tfm::format("HeatmapIntegrator[metric=%s, maxCost=%f]",
+			metrics[m_metric], m_maxCost);
+	}
+
+	EIntegratorType getIntegratorType() const {
+		return EIntegratorType::EHeatmap;
+	}
+
+private:
+	EMetric m_metric;
+	float m_maxCost;
+};
+
+NORI_REGISTER_CLASS(HeatmapIntegrator, "heatmap");
+NORI_NAMESPACE_END
@@ -0,0 +1,84 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/instance.h>
+#include <nori/bsdf.h>
+#include <filesystem/resolver.h>
+#include <map>
+
+NORI_NAMESPACE_BEGIN
+
+Instance::Instance(const PropertyList &propList) {
+    /* Meshes that are referenced by several instances are only loaded
+       once and stay alive as long as any of the instances do */
+    static std::map<std::string, std::weak_ptr<Mesh>> prototypes;
+
+    filesystem::path filename =
+        getFileResolver()->resolve(propList.getString("filename"));
+
+    std::weak_ptr<Mesh> &entry = prototypes[filename.str()];
+    m_prototype = entry.lock();
+    if (!m_prototype) {
+        PropertyList objProps;
+        objProps.setString("filename", filename.str());
+        m_prototype.reset(static_cast<Mesh *>(
+            NoriObjectFactory::createInstance("obj", objProps)));
+        m_prototype->activate();
+        entry = m_prototype;
+    }
+
+    m_toWorld = propList.getTransform("toWorld", Transform());
+    m_name = m_prototype->getName();
+    updateBoundingBox();
+}
+
+void Instance::transform(const Transform &trafo) {
+    m_toWorld = trafo * m_toWorld;
+    updateBoundingBox();
+}
+
+void Instance::updateBoundingBox() {
+    const BoundingBox3f &bbox = m_prototype->getBoundingBox();
+    m_bbox.reset();
+    for (int i=0; i<8; ++i)
+        m_bbox.expandBy(m_toWorld * bbox.getCorner(i));
+}
+
+void Instance::addChild(NoriObject *obj) {
+    if (obj->getClassType() == EEmitter)
+        throw NoriException("Instance: instanced meshes cannot be emitters!");
+    Mesh::addChild(obj);
+}
+
+std::string Instance::toString() const {
+    return tfm::format(
+        "Instance[\n"
+        "  name = \"%s\",\n"
+        "  triangleCount = %i,\n"
+        "  toWorld = %s,\n"
+        "  bsdf = %s\n"
+        "]",
+        m_name,
+        m_prototype->getTriangleCount(),
+        indent(m_toWorld.toString(), 12),
+        m_bsdf ? indent(m_bsdf->toString()) : std::string("null")
+    );
+}
+
+NORI_REGISTER_CLASS(Instance, "instance");
+NORI_NAMESPACE_END
@@ -38,7 +38,13 @@ public:
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
 	{
 		Intersection its;
-		if (!scene->rayIntersect(ray, its))
+		scene->rayIntersect(ray, its);
+		return shade(scene, sampler, ray, its);
+	}
+
+	Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection &its) const
+	{
+		if (!its.mesh)
 		{
 			return Color3f(0.f);
 		}
@@ -61,6 +67,11 @@ public:
 		return EIntegratorType::ELightDepthArea;
 	}
 
+	bool supportsPrimaryHits() const
+	{
+		return true;
+	}
+
     std::vector<Mesh *> emitterMeshes;
     Point3f meshCenter;
 
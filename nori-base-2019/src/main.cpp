@@ -24,23 +24,40 @@
 #include <nori/bitmap.h>
 #include <nori/sampler.h>
 #include <nori/integrator.h>
+#include <nori/raystream.h>
+#include <nori/rasterizer.h>
 #include <nori/gui.h>
 #include <tbb/parallel_for.h>
 #include <tbb/blocked_range.h>
 #include <filesystem/resolver.h>
+#include <algorithm>
+#include <fstream>
+#include <future>
 #include <thread>
 
 using namespace nori;
 
-static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block) {
-    const Camera *camera = scene->getCamera();
-    const Integrator *integrator = scene->getIntegrator();
-
+/// Camera samples of a block that are rendered together, see generateSamples()
+struct SampleBatch {
+    std::vector<Point2f> pixelSamples;  ///< Image plane positions
+    std::vector<Ray3f> rays;            ///< Camera rays
+    std::vector<Color3f> weights;       ///< Importance weights of the camera rays
+    uint32_t count = 0;                 ///< Number of samples in the batch
+
+    SampleBatch(uint32_t size) : pixelSamples(size), rays(size), weights(size) { }
+};
+
+/**
+ * Generate the camera samples of a block and render them in batches of up
+ * to \c batchSize by calling <tt>flush(batch)</tt>. The samples of a pixel
+ * are consecutive, followed by those of its neighbor, which keeps the rays
+ * of a batch coherent.
+ */
+template <typename Flush> static void generateSamples(const Camera *camera, Sampler *sampler,
+        const ImageBlock &block, uint32_t batchSize, const Flush &flush) {
     Point2i offset = block.getOffset();
     Vector2i size  = block.getSize();
-
-    /* Clear the block contents */
-    block.clear();
+    SampleBatch batch(batchSize);
 
     /* For each pixel and pixel sample sample */
     for (int y=0; y<size.y(); ++y) {
@@ -50,34 +67,209 @@ static void renderBlock(const Scene *scene, Sampler *sampler, ImageBlock &block)
                 Point2f apertureSample = sampler->next2D();
 
                 /* Sample a ray from the camera */
-                Ray3f ray;
-                Color3f value = camera->sampleRay(ray, pixelSample, apertureSample);
+                batch.pixelSamples[batch.count] = pixelSample;
+                batch.weights[batch.count] = camera->sampleRay(batch.rays[batch.count], pixelSample, apertureSample);
 
-                /* Compute the incident radiance */
-                value *= integrator->Li(scene, sampler, ray);
-
-                /* Store in the image block */
-                block.put(pixelSample, value);
+                if (++batch.count == batchSize) {
+                    flush(batch);
+                    batch.count = 0;
+                }
             }
         }
     }
+
+    if (batch.count > 0)
+        flush(batch);
+}
+
+static void renderBlock(const Scene *scene, const Camera *camera, Sampler *sampler, ImageBlock &block) {
+    const Integrator *integrator = scene->getIntegrator();
+
+    /* Clear the block contents */
+    block.clear();
+
+    generateSamples(camera, sampler, block, 1, [&](const SampleBatch &batch) {
+        /* Compute the incident radiance, the first query is the camera ray */
+        Accel::countPrimaryRays(1);
+        Color3f value = batch.weights[0] * integrator->Li(scene, sampler, batch.rays[0]);
+        Accel::countPrimaryRays(0);
+
+        /* Store in the image block */
+        block.put(batch.pixelSamples[0], value);
+    });
+}
+
+/**
+ * Render a block by tracing camera rays in packets of NORI_PACKET_SIZE.
+ * Consecutive samples (i.e. the samples of one pixel, or neighboring
+ * pixels when rendering with few samples per pixel) are grouped together,
+ * which keeps the rays of a packet coherent.
+ */
+static void renderBlockPackets(const Scene *scene, const Camera *camera, Sampler *sampler, ImageBlock &block) {
+    const Integrator *integrator = scene->getIntegrator();
+
+    /* Clear the block contents */
+    block.clear();
+
+    /* Trace the collected rays and shade their first intersections */
+    generateSamples(camera, sampler, block, NORI_PACKET_SIZE, [&](const SampleBatch &batch) {
+        Intersection its[NORI_PACKET_SIZE];
+        Accel::countPrimaryRays(batch.count);
+        scene->rayIntersectPacket(batch.rays.data(), its, (uint32_t) ((1ull << batch.count) - 1));
+        Accel::countPrimaryRays(0);
+
+        for (uint32_t i=0; i<batch.count; ++i) {
+            Color3f value = batch.weights[i] * integrator->shade(scene, sampler, batch.rays[i], its[i]);
+            block.put(batch.pixelSamples[i], value);
+        }
+    });
+}
+
+/**
+ * Render a block by handing batches of up to NORI_STREAM_SIZE camera
+ * samples to the integrator at once, which then traces the secondary
+ * rays of all samples in a batch together (see Integrator::LiStream()).
+ */
+static void renderBlockStream(const Scene *scene, const Camera *camera, Sampler *sampler, ImageBlock &block) {
+    const Integrator *integrator = scene->getIntegrator();
+    std::vector<Color3f> values(NORI_STREAM_SIZE);
+
+    /* Clear the block contents */
+    block.clear();
+
+    generateSamples(camera, sampler, block, NORI_STREAM_SIZE, [&](const SampleBatch &batch) {
+        /* Streaming integrators trace all camera rays before any other ray */
+        Accel::countPrimaryRays(batch.count);
+        integrator->LiStream(scene, sampler, batch.rays.data(), values.data(), batch.count);
+        Accel::countPrimaryRays(0);
+        for (uint32_t i=0; i<batch.count; ++i)
+            block.put(batch.pixelSamples[i], batch.weights[i] * values[i]);
+    });
+}
+
+/**
+ * Render a block by finding the first intersections of batches of up to
+ * NORI_STREAM_SIZE camera rays using the rasterizer, and shading them
+ * (see Integrator::shade()).
+ */
+static void renderBlockRaster(const Scene *scene, const Camera *camera,
+        const Rasterizer *rasterizer, Sampler *sampler, ImageBlock &block) {
+    const Integrator *integrator = scene->getIntegrator();
+    std::vector<Intersection> its(NORI_STREAM_SIZE);
+
+    /* Clear the block contents */
+    block.clear();
+
+    generateSamples(camera, sampler, block, NORI_STREAM_SIZE, [&](const SampleBatch &batch) {
+        rasterizer->rayIntersect(batch.pixelSamples.data(), batch.rays.data(), its.data(), batch.count);
+        for (uint32_t i=0; i<batch.count; ++i)
+            block.put(batch.pixelSamples[i], batch.weights[i] * integrator->shade(scene, sampler, batch.rays[i], its[i]));
+    });
+}
+
+/**
+ * Render the blocks of all outputs of an integrator with several outputs
+ * (see Integrator::getOutputCount()). The first intersections of batches
+ * of up to NORI_STREAM_SIZE camera rays are found once, using the
+ * rasterizer or packet tracing when enabled, and all outputs are then
+ * shaded from these records (see Integrator::shadeOutputs()).
+ */
+static void renderBlockOutputs(const Scene *scene, const Camera *camera,
+        const Rasterizer *rasterizer, Sampler *sampler, std::vector<ImageBlock *> &blocks) {
+    const Integrator *integrator = scene->getIntegrator();
+    uint32_t outputCount = (uint32_t) blocks.size();
+
+    std::vector<Color3f> values(outputCount * NORI_STREAM_SIZE);
+    std::vector<Intersection> its(NORI_STREAM_SIZE);
+
+    /* Clear the block contents */
+    for (ImageBlock *block : blocks)
+        block->clear();
+
+    generateSamples(camera, sampler, *blocks[0], NORI_STREAM_SIZE, [&](const SampleBatch &batch) {
+        uint32_t count = batch.count;
+        const Ray3f *rays = batch.rays.data();
+        if (rasterizer) {
+            rasterizer->rayIntersect(batch.pixelSamples.data(), rays, its.data(), count);
+        } else {
+            Accel::countPrimaryRays(count);
+            for (uint32_t i=0; i<count; i += NORI_PACKET_SIZE) {
+                uint32_t n = std::min(count - i, (uint32_t) NORI_PACKET_SIZE);
+                for (uint32_t j=0; j<n; ++j)
+                    its[i + j].mesh = nullptr;
+                if (scene->usePacketTracing()) {
+                    scene->rayIntersectPacket(&rays[i], &its[i], (uint32_t) ((1ull << n) - 1));
+                } else {
+                    for (uint32_t j=0; j<n; ++j)
+                        scene->rayIntersect(rays[i + j], its[i + j]);
+                }
+            }
+            Accel::countPrimaryRays(0);
+        }
+
+        integrator->shadeOutputs(scene, sampler, rays, its.data(), values.data(), count);
+        for (uint32_t k=0; k<outputCount; ++k)
+            for (uint32_t i=0; i<count; ++i)
+                blocks[k]->put(batch.pixelSamples[i], batch.weights[i] * values[k * count + i]);
+    });
 }
 
-static void render(Scene *scene, const std::string &filename) {
-    const Camera *camera = scene->getCamera();
-    Vector2i outputSize = camera->getOutputSize();
+/// Rendered images and the names (without extension) of the files they are saved to
+typedef std::vector<std::pair<std::string, std::unique_ptr<ImageBlock>>> RenderOutputs;
+
+static RenderOutputs render(Scene *scene, const std::string &filename) {
+    /* All views of the scene are rendered in one parallel pass */
+    const std::vector<const Camera *> &cameras = scene->getCameras();
+    uint32_t viewCount = (uint32_t) cameras.size();
     scene->getIntegrator()->preprocess(scene);
 
-    /* Create a block generator (i.e. a work scheduler) */
-    BlockGenerator blockGenerator(outputSize, NORI_BLOCK_SIZE);
+    /* Trace camera rays in packets if the integrator can shade precomputed hits */
+    bool usePackets = scene->usePacketTracing() &&
+        scene->getIntegrator()->supportsPrimaryHits();
+
+    /* .. or render whole batches of samples as sorted ray streams */
+    bool useStreams = scene->useRayStreams() &&
+        scene->getIntegrator()->supportsRayStreams();
+
+    /* .. or find the first hits without tracing rays at all (only possible
+       for views with a single projection, e.g. not for panoramic cameras) */
+    std::vector<std::unique_ptr<Rasterizer>> rasterizers(viewCount);
+    if (scene->useRasterization() && scene->getIntegrator()->supportsPrimaryHits()) {
+        for (uint32_t v=0; v<viewCount; ++v) {
+            Eigen::Matrix4f worldToRaster;
+            float nearClip, farClip;
+            if (cameras[v]->getRasterTransform(worldToRaster, nearClip, farClip))
+                rasterizers[v].reset(new Rasterizer(scene, cameras[v]));
+        }
+    }
+
+    /* Integrators with several outputs shade all of them from the same first hits */
+    uint32_t outputCount = scene->getIntegrator()->getOutputCount();
+    if (outputCount > 1 && !scene->getIntegrator()->supportsPrimaryHits())
+        throw NoriException("Integrators with several outputs must support precomputed primary hits!");
+
+    /* Create a block generator (i.e. a work scheduler) for every view. The
+       blocks of all views are numbered consecutively */
+    std::vector<std::unique_ptr<BlockGenerator>> blockGenerators;
+    std::vector<int> firstBlock(1, 0);
+    for (const Camera *camera : cameras) {
+        blockGenerators.emplace_back(new BlockGenerator(camera->getOutputSize(), NORI_BLOCK_SIZE));
+        firstBlock.push_back(firstBlock.back() + blockGenerators.back()->getBlockCount());
+    }
 
-    /* Allocate memory for the entire output image and clear it */
-    ImageBlock result(outputSize, camera->getReconstructionFilter());
-    result.clear();
+    /* Allocate memory for the entire output images and clear them,
+       output k of view v is stored at index v * outputCount + k */
+    std::vector<std::unique_ptr<ImageBlock>> results;
+    for (const Camera *camera : cameras) {
+        for (uint32_t k=0; k<outputCount; ++k) {
+            results.emplace_back(new ImageBlock(camera->getOutputSize(), camera->getReconstructionFilter()));
+            results.back()->clear();
+        }
+    }
 
     /* Create a window that visualizes the partially rendered result */
     //nanogui::init();
-    //NoriScreen *screen = new NoriScreen(result);
+    //NoriScreen *screen = new NoriScreen(*results[0]);
 
     /* Do the following in parallel and asynchronously */
     std::thread render_thread([&] {
@@ -85,30 +277,58 @@ static void render(Scene *scene, const std::string &filename) {
         cout.flush();
         Timer timer;
 
-        tbb::blocked_range<int> range(0, blockGenerator.getBlockCount());
+        tbb::blocked_range<int> range(0, firstBlock.back());
 
         auto map = [&](const tbb::blocked_range<int> &range) {
-            /* Allocate memory for a small image block to be rendered
-               by the current thread */
-            ImageBlock block(Vector2i(NORI_BLOCK_SIZE),
-                camera->getReconstructionFilter());
+            /* Small image blocks to be rendered by the current thread, one
+               per output of every view (allocated when first needed) */
+            std::vector<std::vector<std::unique_ptr<ImageBlock>>> viewBlocks(viewCount);
 
             /* Create a clone of the sampler for the current thread */
             std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
 
             for (int i=range.begin(); i<range.end(); ++i) {
+                uint32_t view = (uint32_t) (std::upper_bound(firstBlock.begin(),
+                    firstBlock.end(), i) - firstBlock.begin()) - 1;
+                const Camera *camera = cameras[view];
+                const Rasterizer *rasterizer = rasterizers[view].get();
+
+                if (viewBlocks[view].empty()) {
+                    for (uint32_t k=0; k<outputCount; ++k)
+                        viewBlocks[view].emplace_back(new ImageBlock(Vector2i(NORI_BLOCK_SIZE),
+                            camera->getReconstructionFilter()));
+                }
+                std::vector<ImageBlock *> blocks;
+                for (auto &block : viewBlocks[view])
+                    blocks.push_back(block.get());
+                ImageBlock &block = *blocks[0];
+
                 /* Request an image block from the block generator */
-                blockGenerator.next(block);
+                blockGenerators[view]->next(block);
+                for (uint32_t k=1; k<outputCount; ++k) {
+                    blocks[k]->setOffset(block.getOffset());
+                    blocks[k]->setSize(block.getSize());
+                }
 
                 /* Inform the sampler about the block to be rendered */
                 sampler->prepare(block);
 
                 /* Render all contained pixels */
-                renderBlock(scene, sampler.get(), block);
+                if (outputCount > 1)
+                    renderBlockOutputs(scene, camera, rasterizer, sampler.get(), blocks);
+                else if (rasterizer)
+                    renderBlockRaster(scene, camera, rasterizer, sampler.get(), block);
+                else if (useStreams)
+                    renderBlockStream(scene, camera, sampler.get(), block);
+                else if (usePackets)
+                    renderBlockPackets(scene, camera, sampler.get(), block);
+                else
+                    renderBlock(scene, camera, sampler.get(), block);
 
                 /* The image block has been processed. Now add it to
                    the "big" block that represents the entire image */
-                result.put(block);
+                for (uint32_t k=0; k<outputCount; ++k)
+                    results[view * outputCount + k]->put(*blocks[k]);
             }
         };
 
@@ -120,6 +340,9 @@ static void render(Scene *scene, const std::string &filename) {
 		cout << "center of mass = " << scene->getCenterOfMass() << endl;
 
         cout << "done. (took " << timer.elapsedString() << ")" << endl;
+
+        if (scene->getAccel()->collectsStatistics())
+            cout << Accel::getStatistics().toString() << endl;
     });
 
     /* Enter the application main loop */
@@ -131,44 +354,127 @@ static void render(Scene *scene, const std::string &filename) {
     //delete screen;
    // nanogui::shutdown();
 
-    /* Now turn the rendered image block into
-       a properly normalized bitmap */
-    std::unique_ptr<Bitmap> bitmap(result.toBitmap());
-
     /* Determine the filename of the output bitmap */
     std::string outputName = filename;
     size_t lastdot = outputName.find_last_of(".");
     if (lastdot != std::string::npos)
         outputName.erase(lastdot, std::string::npos);
 
-	std::string integType;
-	switch (scene->getIntegrator()->getIntegratorType())
-	{
-	case Integrator::EIntegratorType::ESimple:
-		integType = "_simple";
-		break;
-	case Integrator::EIntegratorType::EDepthMap:
-		integType = "_depthMap";
-		break;
-	case Integrator::EIntegratorType::ELightDepth:
-		integType = "_lightDepth";
-		break;
-	case Integrator::EIntegratorType::ENoShadows:
-		integType = "_noShadows";
-		break;
-	}
 	auto minMaxVec = scene->getIntegrator()->getMinMaxVector();
 	/*for (auto it = minMaxVec.begin(); it != minMaxVec.end(); it++)
 	{
 		cout << *it << endl;
 	}*/
-    /* Save tonemapped (sRGB) output using the PNG format */
-    bitmap->savePNG(outputName + integType);
+    /* With several views, the images of view v are named <name>_view<v><suffix> */
+    RenderOutputs outputs;
+    for (uint32_t v=0; v<viewCount; ++v) {
+        std::string viewName = viewCount > 1 ? outputName + "_view" + std::to_string(v) : outputName;
+        for (uint32_t k=0; k<outputCount; ++k)
+            outputs.emplace_back(viewName + scene->getIntegrator()->getOutputSuffix(k),
+                std::move(results[v * outputCount + k]));
+    }
+    return outputs;
+}
+
+static void save(const RenderOutputs &outputs) {
+    for (const auto &output : outputs) {
+        /* Now turn the rendered image block into
+           a properly normalized bitmap */
+        std::unique_ptr<Bitmap> bitmap(output.second->toBitmap());
+
+        /* Save tonemapped (sRGB) output using the PNG format */
+        bitmap->savePNG(output.first);
+    }
+}
+
+/**
+ * Render all jobs of a manifest in one process. Every line of the manifest
+ * names a scene file and optionally the file name of its output (both
+ * relative to the manifest), empty lines and lines starting with '#' are
+ * skipped. Compared to one process per scene, the worker threads are
+ * started only once, OBJ files and BVHs are shared between scenes that
+ * use the same meshes, and the images of a job are written while the next
+ * one is rendering.
+ */
+static int renderBatch(const std::string &filename) {
+    std::ifstream is(filename);
+    if (is.fail())
+        throw NoriException("Unable to open the batch file \"%s\"!", filename);
+
+    filesystem::path basePath = filesystem::path(filename).parent_path();
+    std::vector<std::pair<std::string, std::string>> jobs;
+    std::string line;
+    while (std::getline(is, line)) {
+        std::vector<std::string> tokens = tokenize(line, " \t\r");
+        if (tokens.empty() || tokens[0][0] == '#')
+            continue;
+        if (tokens.size() > 2)
+            throw NoriException("Invalid batch job \"%s\" (expected <scene.xml> [output])", line);
+
+        auto resolve = [&](const std::string &name) {
+            filesystem::path path(name);
+            return (path.is_absolute() || basePath.empty() ? path : basePath / path).str();
+        };
+        jobs.emplace_back(resolve(tokens[0]), tokens.size() > 1 ? resolve(tokens[1]) : resolve(tokens[0]));
+    }
+
+    setOBJCache(true);
+    Accel::setMemoryCache(true);
+
+    filesystem::resolver baseResolver = *getFileResolver();
+    std::future<void> writer;
+    int failed = 0;
+    Timer timer;
+
+    /* Wait for the images of the previous job, a failed save fails its job */
+    auto finishWriting = [&] {
+        if (!writer.valid())
+            return;
+        try {
+            writer.get();
+        } catch (const std::exception &e) {
+            cerr << "Error: unable to save the rendered images: " << e.what() << endl;
+            ++failed;
+        }
+    };
+
+    for (size_t i=0; i<jobs.size(); ++i) {
+        cout << "Batch job " << (i + 1) << "/" << jobs.size() << ": \"" << jobs[i].first << "\"" << endl;
+        try {
+            /* Resources are resolved relative to the scene file of the job */
+            *getFileResolver() = baseResolver;
+            getFileResolver()->prepend(filesystem::path(jobs[i].first).parent_path());
+
+            std::unique_ptr<NoriObject> root(loadFromXML(jobs[i].first));
+            if (root->getClassType() != NoriObject::EScene)
+                throw NoriException("The root object is not a scene!");
+            RenderOutputs outputs = render(static_cast<Scene *>(root.get()), jobs[i].second);
+
+            /* Write the images of this job while the next one renders */
+            finishWriting();
+            writer = std::async(std::launch::async,
+                [outputs = std::move(outputs)] { save(outputs); });
+        } catch (const std::exception &e) {
+            cerr << "Error in batch job \"" << jobs[i].first << "\": " << e.what() << endl;
+            ++failed;
+        }
+    }
+
+    finishWriting();
+
+    setOBJCache(false);
+    clearOBJCache();
+    Accel::setMemoryCache(false);
+    Accel::clearMemoryCache();
+
+    cout << "Batch done: " << (jobs.size() - failed) << "/" << jobs.size()
+         << " jobs succeeded (took " << timer.elapsedString() << ")" << endl;
+    return failed == 0 ? 0 : -1;
 }
 
 int main(int argc, char **argv) {
     if (argc != 2) {
-        cerr << "Syntax: " << argv[0] << " <scene.xml>" << endl;
+        cerr << "Syntax: " << argv[0] << " <scene.xml | batch.txt>" << endl;
         return -1;
     }
 
@@ -185,7 +491,10 @@ int main(int argc, char **argv) {
 
             /* When the XML root object is a scene, start rendering it .. */
             if (root->getClassType() == NoriObject::EScene)
-                render(static_cast<Scene *>(root.get()), argv[1]);
+                save(render(static_cast<Scene *>(root.get()), argv[1]));
+        } else if (path.extension() == "txt") {
+            /* Render all scenes listed in a batch file */
+            return renderBatch(argv[1]);
         } else if (path.extension() == "exr") {
             /* Alternatively, provide a basic OpenEXR image viewer */
             Bitmap bitmap(argv[1]);
@@ -198,7 +507,7 @@ int main(int argc, char **argv) {
             nanogui::shutdown();
         } else {
             cerr << "Fatal error: unknown file \"" << argv[1]
-                 << "\", expected an extension of type .xml or .exr" << endl;
+                 << "\", expected an extension of type .xml, .txt or .exr" << endl;
         }
     } catch (const std::exception &e) {
         cerr << "Fatal error: " << e.what() << endl;
@@ -46,6 +46,35 @@ void Mesh::activate() {
 	}
 }
 
+void Mesh::setVertexPositions(const MatrixXf &V) {
+    if (V.rows() != 3 || V.cols() != m_V.cols())
+        throw NoriException("Mesh::setVertexPositions(): expected %i vertices, got %i!",
+                            m_V.cols(), V.cols());
+    m_V = V;
+
+    m_bbox.reset();
+    for (int i=0; i<m_V.cols(); ++i)
+        m_bbox.expandBy(m_V.col(i));
+
+    /* The triangle areas may have changed as well */
+    if (m_dPdf.size() > 0) {
+        m_dPdf.clear();
+        m_dPdf.reserve(getTriangleCount());
+        float meshSurfaceArea = getMeshSurfaceArea();
+        for (uint32_t i = 0; i < getTriangleCount(); i++)
+            m_dPdf.append(surfaceArea(i) * meshSurfaceArea);
+    }
+}
+
+void Mesh::transform(const Transform &trafo) {
+    MatrixXf V(3, m_V.cols());
+    for (int i=0; i<m_V.cols(); ++i)
+        V.col(i) = trafo * Point3f(m_V.col(i));
+    for (int i=0; i<m_N.cols(); ++i)
+        m_N.col(i) = (trafo * Normal3f(m_N.col(i))).normalized();
+    setVertexPositions(V);
+}
+
 Point2f squareToUniformBary(const Point2f& sample)
 {
 	return Point2f(1 - std::sqrt(1 - sample[0]), sample[1] * std::sqrt(1 - sample[0]));
@@ -0,0 +1,103 @@
+#include <nori/multi.h>
+#include <nori/scene.h>
+#include <set>
+
+NORI_NAMESPACE_BEGIN
+
+//renders the images of several integrators (e.g. simple, noShadow, depthMap and lightDepth) in one pass.
+//the integrators are nested in the XML file. the first hit of every camera sample is found once and then
+//shaded by all of them (see Integrator::shadeOutputs()), and each image is saved with the suffix of its integrator
+MultiIntegrator::MultiIntegrator(const PropertyList &props)
+{
+	/* No parameters, the outputs are given by the nested integrators */
+}
+
+MultiIntegrator::~MultiIntegrator()
+{
+	for (Integrator *integrator : integrators)
+		delete integrator;
+}
+
+void MultiIntegrator::addChild(NoriObject *obj)
+{
+	if (obj->getClassType() != EIntegrator)
+		throw NoriException("MultiIntegrator::addChild(<%s>) is not supported!",
+			classTypeName(obj->getClassType()));
+	integrators.push_back(static_cast<Integrator *>(obj));
+}
+
+void MultiIntegrator::activate()
+{
+	if (integrators.empty())
+		throw NoriException("MultiIntegrator: no nested integrators were specified!");
+
+	//every output needs its own file name
+	std::set<std::string> suffixes;
+	for (uint32_t i = 0; i < getOutputCount(); ++i)
+	{
+		std::string suffix = getOutputSuffix(i);
+		if (!suffixes.insert(suffix).second)
+			throw NoriException("MultiIntegrator: several outputs would be saved with the suffix \"%s\"!", suffix);
+	}
+}
+
+void MultiIntegrator::preprocess(const Scene *scene)
+{
+	for (Integrator *integrator : integrators)
+		integrator->preprocess(scene);
+}
+
+Color3f MultiIntegrator::Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+{
+	return integrators[0]->Li(scene, sampler, ray);
+}
+
+Color3f MultiIntegrator::shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection &its) const
+{
+	return integrators[0]->shade(scene, sampler, ray, its);
+}
+
+//the outputs of the nested integrators follow each other, every integrator shades the whole batch
+void MultiIntegrator::shadeOutputs(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+	const Intersection *its, Color3f *result, uint32_t count) const
+{
+	for (const Integrator *integrator : integrators)
+	{
+		integrator->shadeOutputs(scene, sampler, rays, its, result, count);
+		result += integrator->getOutputCount() * count;
+	}
+}
+
+uint32_t MultiIntegrator::getOutputCount() const
+{
+	uint32_t count = 0;
+	for (const Integrator *integrator : integrators)
+		count += integrator->getOutputCount();
+	return count;
+}
+
+std::string MultiIntegrator::getOutputSuffix(uint32_t index) const
+{
+	for (const Integrator *integrator : integrators)
+	{
+		if (index < integrator->getOutputCount())
+			return integrator->getOutputSuffix(index);
+		index -= integrator->getOutputCount();
+	}
+	throw NoriException("MultiIntegrator: output %i does not exist!", index);
+}
+
+Integrator::EIntegratorType MultiIntegrator::getIntegratorType() const
+{
+	return integrators[0]->getIntegratorType();
+}
+
+std::string MultiIntegrator::toString() const {
+	std::string children;
+	for (const Integrator *integrator : integrators)
+		children += "  " + indent(integrator->toString()) + "\n";
+	return tfm::format("MultiIntegrator[\n%s]", children);
+}
+
+NORI_REGISTER_CLASS(MultiIntegrator, "multi");
+NORI_NAMESPACE_END
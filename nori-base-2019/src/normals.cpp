@@ -12,7 +12,12 @@ public:
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const {
 		/* Find the surface that is visible in the requested direction */
 		Intersection its;
-		if (!scene->rayIntersect(ray, its))
+		scene->rayIntersect(ray, its);
+		return shade(scene, sampler, ray, its);
+	}
+
+	Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection &its) const {
+		if (!its.mesh)
 			return Color3f(0.0f);
 
 		/* Return the component-wise absolute
@@ -21,6 +26,14 @@ public:
 		return Color3f(n.x(), n.y(), n.z());
 	}
 
+	bool supportsPrimaryHits() const {
+		return true;
+	}
+
+	EIntegratorType getIntegratorType() const {
+		return EIntegratorType::ENormals;
+	}
+
 	std::string toString() const {
 		return "NormalIntegrator[]";
 	}
@@ -17,13 +17,34 @@
 */
 
 #include <nori/mesh.h>
+#include <nori/lrucache.h>
 #include <nori/timer.h>
 #include <filesystem/resolver.h>
 #include <unordered_map>
 #include <fstream>
+#include <sys/stat.h>
 
 NORI_NAMESPACE_BEGIN
 
+/// Geometry of an OBJ file kept in memory, see setOBJCache()
+struct OBJCacheEntry {
+    MatrixXf V, N, UV;
+    MatrixXu F;
+    BoundingBox3f bbox;
+};
+
+static bool s_objCacheEnabled = false;
+static LRUCache<std::string, OBJCacheEntry> s_objCache(NORI_DEFAULT_CACHE_CAPACITY);
+
+void setOBJCache(bool enabled, size_t capacity) {
+    s_objCacheEnabled = enabled;
+    s_objCache.setCapacity(capacity);
+}
+
+void clearOBJCache() {
+    s_objCache.clear();
+}
+
 /**
  * \brief Loader for Wavefront OBJ triangle meshes
  */
@@ -40,6 +61,34 @@ public:
             throw NoriException("Unable to open OBJ file \"%s\"!", filename);
         Transform trafo = propList.getTransform("toWorld", Transform());
 
+        /* Files are identified by their name, size, modification time and
+           the transformation that is applied to them */
+        std::string cacheKey;
+        if (s_objCacheEnabled) {
+            struct stat status;
+            if (stat(filename.str().c_str(), &status) != 0)
+                throw NoriException("Unable to query OBJ file \"%s\"!", filename);
+            uint64_t fileSize = (uint64_t) status.st_size,
+                     fileTime = (uint64_t) status.st_mtime;
+            cacheKey = filename.str();
+            cacheKey.append((const char *) &fileSize, sizeof(uint64_t));
+            cacheKey.append((const char *) &fileTime, sizeof(uint64_t));
+            cacheKey.append((const char *) trafo.getMatrix().data(), sizeof(float) * 16);
+
+            std::shared_ptr<const OBJCacheEntry> entry = s_objCache.find(cacheKey);
+            if (entry) {
+                m_V = entry->V;
+                m_N = entry->N;
+                m_UV = entry->UV;
+                m_F = entry->F;
+                m_bbox = entry->bbox;
+                m_name = filename.str();
+                cout << "Reusing \"" << filename << "\" (V=" << m_V.cols()
+                     << ", F=" << m_F.cols() << ")" << endl;
+                return;
+            }
+        }
+
         cout << "Loading \"" << filename << "\" .. ";
         cout.flush();
         Timer timer;
@@ -124,6 +173,18 @@ public:
         }
 
         m_name = filename.str();
+
+        if (s_objCacheEnabled) {
+            std::shared_ptr<OBJCacheEntry> entry(new OBJCacheEntry());
+            entry->V = m_V;
+            entry->N = m_N;
+            entry->UV = m_UV;
+            entry->F = m_F;
+            entry->bbox = m_bbox;
+            s_objCache.insert(cacheKey, entry, m_F.size() * sizeof(uint32_t) +
+                sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()));
+        }
+
         cout << "done. (V=" << m_V.cols() << ", F=" << m_F.cols() << ", took "
              << timer.elapsedString() << " and "
              << memString(m_F.size() * sizeof(uint32_t) +
@@ -0,0 +1,186 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/camera.h>
+#include <nori/rfilter.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Base class of cameras that see all directions around a point
+ *
+ * The camera sits at the origin of its <tt>toWorld</tt> transformation
+ * (e.g. at the position of a light source). Like the perspective camera,
+ * it looks along +z with +y pointing up, and the right side of the image
+ * corresponds to -x. The subclasses map film positions to directions.
+ * Since there is no single linear projection, these cameras can't be
+ * rasterized; their first hits are found by tracing rays instead.
+ */
+class PanoramicCamera : public Camera {
+public:
+    PanoramicCamera(const PropertyList &propList) {
+        /* Specifies an optional camera-to-world transformation. Default: none */
+        m_cameraToWorld = propList.getTransform("toWorld", Transform());
+
+        /* Minimum and maximum distance of visible surfaces in world-space units */
+        m_nearClip = propList.getFloat("nearClip", 1e-4f);
+        m_farClip = propList.getFloat("farClip", 1e4f);
+
+        m_rfilter = NULL;
+    }
+
+    void activate() {
+        m_invOutputSize = m_outputSize.cast<float>().cwiseInverse();
+
+        /* If no reconstruction filter was assigned, instantiate a Gaussian filter */
+        if (!m_rfilter)
+            m_rfilter = static_cast<ReconstructionFilter *>(
+                NoriObjectFactory::createInstance("gaussian", PropertyList()));
+    }
+
+    Color3f sampleRay(Ray3f &ray,
+            const Point2f &samplePosition,
+            const Point2f &apertureSample) const {
+        Vector3f d = sampleDirection(Point2f(
+            samplePosition.x() * m_invOutputSize.x(),
+            samplePosition.y() * m_invOutputSize.y()));
+
+        ray.o = m_cameraToWorld * Point3f(0, 0, 0);
+        ray.d = m_cameraToWorld * d;
+        ray.mint = m_nearClip;
+        ray.maxt = m_farClip;
+        ray.update();
+
+        return Color3f(1.0f);
+    }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EReconstructionFilter:
+                if (m_rfilter)
+                    throw NoriException("Camera: tried to register multiple reconstruction filters!");
+                m_rfilter = static_cast<ReconstructionFilter *>(obj);
+                break;
+
+            default:
+                throw NoriException("Camera::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+protected:
+    /// Map a position on the film (in [0, 1]^2) to a normalized direction in camera space
+    virtual Vector3f sampleDirection(const Point2f &uv) const = 0;
+
+    /// Summary of the properties shared by all panoramic cameras
+    std::string summary(const std::string &name) const {
+        return tfm::format(
+            "%s[\n"
+            "  cameraToWorld = %s,\n"
+            "  outputSize = %s,\n"
+            "  clip = [%f, %f],\n"
+            "  rfilter = %s\n"
+            "]",
+            name,
+            indent(m_cameraToWorld.toString(), 18),
+            m_outputSize.toString(),
+            m_nearClip,
+            m_farClip,
+            indent(m_rfilter->toString())
+        );
+    }
+
+    Vector2f m_invOutputSize;
+    Transform m_cameraToWorld;
+    float m_nearClip;
+    float m_farClip;
+};
+
+/**
+ * \brief Camera that captures all directions in a latitude-longitude image
+ *
+ * The horizontal axis covers 360 degrees of longitude (the viewing
+ * direction is in the center), and the vertical axis covers 180 degrees
+ * of latitude from straight up to straight down.
+ */
+class EquirectangularCamera : public PanoramicCamera {
+public:
+    EquirectangularCamera(const PropertyList &propList) : PanoramicCamera(propList) {
+        /* Width and height in pixels. Default: 1024x512 */
+        m_outputSize.x() = propList.getInteger("width", 1024);
+        m_outputSize.y() = propList.getInteger("height", m_outputSize.x() / 2);
+    }
+
+    Vector3f sampleDirection(const Point2f &uv) const {
+        float phi = 2 * M_PI * (uv.x() - 0.5f), theta = M_PI * uv.y();
+        float sinTheta = std::sin(theta);
+        return Vector3f(-sinTheta * std::sin(phi), std::cos(theta), sinTheta * std::cos(phi));
+    }
+
+    std::string toString() const {
+        return summary("EquirectangularCamera");
+    }
+};
+
+/**
+ * \brief Camera that renders the six faces of a cube map into one image
+ *
+ * The faces of \c faceSize x \c faceSize pixels are arranged in a grid of
+ * 3 x 2 faces: +x, -x, +y in the first row and -y, +z, -z in the second
+ * one. Every face is a perspective view with a field of view of 90
+ * degrees; the +z face matches a perspective camera with the same
+ * <tt>toWorld</tt> transformation. Reconstruction filters blend pixels
+ * across the borders of the faces, use the <tt>box</tt> filter to keep
+ * them separate.
+ */
+class CubeMapCamera : public PanoramicCamera {
+public:
+    CubeMapCamera(const PropertyList &propList) : PanoramicCamera(propList) {
+        /* Size of one face in pixels. Default: 512 */
+        m_faceSize = propList.getInteger("faceSize", 512);
+        m_outputSize = Vector2i(3 * m_faceSize, 2 * m_faceSize);
+    }
+
+    Vector3f sampleDirection(const Point2f &uv) const {
+        /* Find the face and the position on it */
+        float x = uv.x() * 3, y = uv.y() * 2;
+        int column = std::min((int) x, 2), row = std::min((int) y, 1);
+        int face = 3 * row + column, axis = face / 2;
+        float a = 2 * (x - column) - 1, b = 1 - 2 * (y - row);
+
+        Vector3f forward(0.0f), up(0.0f, 1.0f, 0.0f);
+        forward[axis] = (face % 2 == 0) ? 1.0f : -1.0f;
+        if (axis == 1)
+            up = Vector3f(0.0f, 0.0f, -forward.y());
+
+        /* The right side of a face corresponds to forward x up */
+        return (forward + a * forward.cross(up) + b * up).normalized();
+    }
+
+    std::string toString() const {
+        return summary("CubeMapCamera");
+    }
+
+private:
+    int m_faceSize;
+};
+
+NORI_REGISTER_CLASS(EquirectangularCamera, "equirectangular");
+NORI_REGISTER_CLASS(CubeMapCamera, "cubemap");
+NORI_NAMESPACE_END
@@ -3,6 +3,7 @@
 #include <nori/sampler.h>
 #include <nori/bsdf.h>
 #include <nori/emitter.h>
+#include <nori/raystream.h>
 #include <math.h>
 
 NORI_NAMESPACE_BEGIN
@@ -21,54 +22,49 @@ public:
 	}
 
 	//returns true if the x and y are mutually visible
-	//if ray from x to y hits anything other than the y then it's invisible
-	//input : scene, point x on mesh, point y on emitter, pointer to mesh that y is on.
-	bool isVisible(const Scene *scene, const Point3f& x, const Point3f& y, const Mesh* yMesh) const
+	//if the segment from x to y hits anything before reaching y then it's invisible
+	//input : scene, point x on mesh, point y on emitter.
+	bool isVisible(const Scene *scene, const Point3f& x, const Point3f& y) const
 	{
-		Ray3f ray(x, y - x);
-		Intersection its;
-		//not using shadowRay here as i need to know what mesh it hit
-		scene->rayIntersect(ray, its);//it will definitely at least hit the mesh that y is on so no need to check return value
-		return yMesh == its.mesh;//only returns true if ray intersected with y (and so missed all other meshes)
-
+		return !scene->occluded(x, y);//any-hit query that stops just before y, so the emitter itself is not reported
 	}
 
-	Color3f pathTracer(const Scene *scene, Sampler *sampler, const Ray3f &ray, int k) const {
-
-		Intersection its;
-		if (!scene->rayIntersect(ray, its))
-			return Color3f(0.0f);
-
+	//what is sampled at one vertex of a path. the rays are traced by the caller, so that
+	//pathTracer() can trace them one by one and LiStream() together with the other paths
+	struct VertexSample {
+		bool specular;       //only the continuation ray is used at non-diffuse vertices
+		Ray3f next;          //BSDF-sampled ray, which continues the path
+		Color3f bsdfSample;  //weight of the BSDF sample
+		float bsdfPdf;       //density of the BSDF-sampled direction
+		Point3f lightPoint;  //sampled point on an emitter
+		bool lit;            //false if the emitter sample can't contribute at all
+		Color3f lightSample; //MIS-weighted contribution of the emitter sample, if lightPoint is visible
+		float survival;      //probability that the path was continued
+	};
+
+	//samples the emitter, the BSDF and the termination at its (the k-th vertex, hit by ray).
+	//returns false if the path terminates here
+	bool sampleVertex(Sampler *sampler, const Ray3f &ray, const Intersection &its, int k, VertexSample &v) const
+	{
 		Point3f x = its.p;
-
-		// if we directly hit a light source then return emission
-		if (k == 0 && its.mesh->isEmitter())
-		{
-			return its.mesh->getEmitter()->getRadiance();
-		}
 		const BSDF * bsdf = its.mesh->getBSDF();
 		if (!bsdf->isDiffuse())
 		{
 			BSDFQueryRecord record(its.shFrame.toLocal((-ray.d).normalized()));
 			record.measure = EMeasure::ESolidAngle;
-			Color3f bsdfSample = bsdf->sample(record, sampler->next2D());
+			v.bsdfSample = bsdf->sample(record, sampler->next2D());
 			//now record would hold the refracted/reflected dir in wo
 			float sampleStuck = sampler->next1D();
 			if (sampleStuck >= 0.95f)
 			{
 				//in case algorithm gets stuck in reflection/refraction events
-				return Color3f(0.0f);
+				return false;
 			}
-			Intersection its2;
-			Color3f lightEmission = 0.f;
-			if (scene->rayIntersect(Ray3f(x, its.shFrame.toWorld(record.wo)), its2))
-			{
-				if (its2.mesh->isEmitter())
-				{
-					lightEmission = its2.mesh->getEmitter()->getRadiance();
-				}
-			}
-			return lightEmission* bsdfSample + bsdfSample * pathTracer(scene, sampler, Ray3f(x, its.shFrame.toWorld(record.wo)), k + 1) / 0.95f;
+			v.specular = true;
+			v.lit = false;
+			v.survival = 0.95f;
+			v.next = Ray3f(x, its.shFrame.toWorld(record.wo));
+			return true;
 		}
 
 		//now we sample a point on one of the emitters
@@ -86,54 +82,167 @@ public:
 		float lightPdfArea = surfSample.pdf / (float) emitterMeshes.size();
 
 		Color3f Le = emitterMeshes[emitterIdx]->getEmitter()->getRadiance();
-		bool visible = isVisible(scene, x, surfSample.p, emitterMeshes[emitterIdx]);
 
 		float CosWithLight = surfSample.n.dot((x - surfSample.p).normalized());
 
 		//instead of calculating geometric term, it will be easier and more efficient to calculate cosTheta and lightPdfAngle seperately
 		float cosTheta = its.shFrame.cosTheta(its.shFrame.toLocal((surfSample.p - x).normalized()));
 		float lightPdfAngle = lightPdfArea * (x-surfSample.p).squaredNorm() / CosWithLight;
-		Color3f lightSample = (cosTheta >= 0 && CosWithLight > 0 && visible) ? Le * fr * cosTheta / lightPdfAngle : Color3f(0.f);
 
 		BSDFQueryRecord hypotheticalRec(its.shFrame.toLocal(-ray.d.normalized()), its.shFrame.toLocal((surfSample.p-x).normalized()), ESolidAngle);
 		//bsdf->pdf(hypotheticalRec) = hypothetically the density with which the bsdf will choose same random point on light
 		float wLight = lightPdfAngle / (lightPdfAngle + bsdf->pdf(hypotheticalRec));
 		wLight = std::isfinite(wLight) ? wLight : 0.f;
 
-		//now that we have both wLight and lightSample value, we will calculate wBRDF and bsdfSample
+		v.lightPoint = surfSample.p;
+		v.lit = cosTheta >= 0 && CosWithLight > 0;
+		v.lightSample = v.lit ? Le * fr * cosTheta / lightPdfAngle * wLight : Color3f(0.f);
 
+		//now that we have both wLight and lightSample value, we will sample the bsdf. wBRDF
+		//depends on what the sampled ray hits, see emission()
 		BSDFQueryRecord bsdfRec(its.shFrame.toLocal(-ray.d.normalized()));
-		Color3f bsdfSample = bsdf->sample(bsdfRec, sampler->next2D());
+		v.bsdfSample = bsdf->sample(bsdfRec, sampler->next2D());
+		v.bsdfPdf = bsdf->pdf(bsdfRec);
+		v.specular = false;
+		v.next = Ray3f(x, its.shFrame.toWorld(bsdfRec.wo));
+
+		//terminate by probablity q which is 0 for first two vertices
+		float q = (k <= 1) ? 0.f : 0.5f;
+		if (sampler->next1D() < q) { return false; }
+		v.survival = 1.f - q;
+		return true;
+	}
+
+	//radiance that the sampled ray v.next brings to x when it hits its2 (nullptr if it hits nothing),
+	//weighted by the BSDF sample and by wBRDF at diffuse vertices
+	Color3f emission(const VertexSample &v, const Point3f &x, const Intersection *its2) const
+	{
+		if (!its2 || !its2->mesh->isEmitter())
+			return Color3f(0.f);
+		if (v.specular)
+			return its2->mesh->getEmitter()->getRadiance() * v.bsdfSample;
+
 		Color3f Le2 = 0.f;
-		lightPdfArea = 0.f; // we want to reuse this variable
 		float lightPdfAngleHypothetical = 0.f;
-		// check if this new sampled direction hits an emitter
-		Intersection its2;
-		bool intersectionFound = scene->rayIntersect(Ray3f(x, its.shFrame.toWorld(bsdfRec.wo)), its2);
-		if (intersectionFound && its2.mesh->isEmitter()) {
-			CosWithLight = its2.shFrame.cosTheta(its2.shFrame.toLocal((x - its2.p).normalized()));
-			//if cosWithLight is less than 0 then we are on the side of the object that doesn't emit light and so we leave everything to be 0
-			if (CosWithLight > 0) {
-				Le2 = its2.mesh->getEmitter()->getRadiance();
-				lightPdfArea = its2.mesh->getMeshSurfaceArea() / (float)emitterMeshes.size();
-				//again we convert light pdf to solid angles
-				//lightPdfAngleHypothetical is the density with which we would have randomly chosen the same point on the same light in solid angles
-				lightPdfAngleHypothetical = lightPdfArea * (x - its2.p).squaredNorm() / CosWithLight;
-			}
+		float CosWithLight = its2->shFrame.cosTheta(its2->shFrame.toLocal((x - its2->p).normalized()));
+		//if cosWithLight is less than 0 then we are on the side of the object that doesn't emit light and so we leave everything to be 0
+		if (CosWithLight > 0) {
+			Le2 = its2->mesh->getEmitter()->getRadiance();
+			float lightPdfArea = its2->mesh->getMeshSurfaceArea() / (float)emitterMeshes.size();
+			//again we convert light pdf to solid angles
+			//lightPdfAngleHypothetical is the density with which we would have randomly chosen the same point on the same light in solid angles
+			lightPdfAngleHypothetical = lightPdfArea * (x - its2->p).squaredNorm() / CosWithLight;
 		}
 
-		float wBRDF = bsdf->pdf(bsdfRec) / (bsdf->pdf(bsdfRec) + lightPdfAngleHypothetical);
+		float wBRDF = v.bsdfPdf / (v.bsdfPdf + lightPdfAngleHypothetical);
 		wBRDF = std::isfinite(wBRDF) ? wBRDF : 0.f;
+		return Le2 * v.bsdfSample * wBRDF;
+	}
 
-		//now we also have wBRDF and bsdfSample so we have everything we need
+	Color3f pathTracer(const Scene *scene, Sampler *sampler, const Ray3f &ray, int k) const {
 
-		//terminate by probablity q which is 0 for first two vertices
-		float q = (k <= 1) ? 0.f : 0.5f;
-		if (sampler->next1D() < q) { return Color3f(0.f); }
+		Intersection its;
+		if (!scene->rayIntersect(ray, its))
+			return Color3f(0.0f);
+
+		// if we directly hit a light source then return emission
+		if (k == 0 && its.mesh->isEmitter())
+		{
+			return its.mesh->getEmitter()->getRadiance();
+		}
+
+		VertexSample v;
+		if (!sampleVertex(sampler, ray, its, k, v))
+			return Color3f(0.0f);
+
+		Color3f result = (v.lit && isVisible(scene, its.p, v.lightPoint)) ? v.lightSample : Color3f(0.f);
 
-		return lightSample * wLight + Le2 * bsdfSample * wBRDF + pathTracer(scene, sampler, Ray3f(x, its.shFrame.toWorld(bsdfRec.wo)), k + 1) * bsdfSample / ((1.f - q));
+		// check if the sampled direction hits an emitter
+		Intersection its2;
+		bool intersectionFound = scene->rayIntersect(v.next, its2);
+		result += emission(v, its.p, intersectionFound ? &its2 : nullptr);
+
+		return result + v.bsdfSample * pathTracer(scene, sampler, v.next, k + 1) / v.survival;
+	}
+
+	/**
+	 * Same estimator as pathTracer(), but all samples advance one bounce at
+	 * a time. The shadow rays and BSDF-sampled rays of a bounce are traced
+	 * together, and the BSDF-sampled ray is only traced once even though it
+	 * is used both for MIS and for continuing the path.
+	 */
+	void LiStream(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+			Color3f *result, uint32_t count) const {
+		/* Per-sample path state */
+		std::vector<Ray3f> paths(rays, rays + count);
+		std::vector<Intersection> hits(count);
+		std::vector<Color3f> throughput(count, Color3f(1.f));
+		std::vector<int> depth(count, 0);
+
+		/* Samples of the current bounce, which are used after tracing */
+		std::vector<VertexSample> vertices(count);
+		std::vector<uint32_t> rayIndex(count), shadowIndex(count);
+
+		RayStream stream(scene);
+		for (uint32_t i = 0; i < count; ++i) {
+			result[i] = Color3f(0.f);
+			stream.addRay(rays[i]);
+		}
+		stream.trace();
+
+		std::vector<uint32_t> active;
+		for (uint32_t i = 0; i < count; ++i) {
+			if (!stream.hit(i))
+				continue;
+			hits[i] = stream.getIntersection(i);
+			// if we directly hit a light source then return emission
+			if (hits[i].mesh->isEmitter())
+				result[i] = hits[i].mesh->getEmitter()->getRadiance();
+			else
+				active.push_back(i);
+		}
+
+		while (!active.empty()) {
+			stream.clear();
+			std::vector<uint32_t> traced;
+
+			for (uint32_t i : active) {
+				VertexSample &v = vertices[i];
+				if (!sampleVertex(sampler, paths[i], hits[i], depth[i], v))
+					continue;
+				shadowIndex[i] = v.lit ? stream.addShadowRay(hits[i].p, v.lightPoint) : (uint32_t) -1;
+				rayIndex[i] = stream.addRay(v.next);
+				traced.push_back(i);
+			}
+
+			stream.trace();
+
+			std::vector<uint32_t> next;
+			for (uint32_t i : traced) {
+				const VertexSample &v = vertices[i];
+				bool hit = stream.hit(rayIndex[i]);
+				const Intersection *its2 = hit ? &stream.getIntersection(rayIndex[i]) : nullptr;
+
+				if (shadowIndex[i] != (uint32_t) -1 && !stream.hit(shadowIndex[i]))
+					result[i] += throughput[i] * v.lightSample;
+				result[i] += throughput[i] * emission(v, hits[i].p, its2);
+				throughput[i] *= v.bsdfSample / v.survival;
+
+				/* Continue the path along the sampled ray */
+				if (hit) {
+					paths[i] = v.next;
+					hits[i] = *its2;
+					depth[i]++;
+					next.push_back(i);
+				}
+			}
+
+			active.swap(next);
+		}
 	}
 
+	bool supportsRayStreams() const { return true; }
+
 	std::string toString() const {
 		return "PathIntegrator[]";
 	}
@@ -108,6 +108,19 @@ public:
         return Color3f(1.0f);
     }
 
+    bool getRasterTransform(Eigen::Matrix4f &worldToRaster,
+            float &nearClip, float &farClip) const {
+        /* The sample-to-camera transformation is a perspective projection,
+           whose inverse leaves the camera-space depth in the w coordinate */
+        Eigen::DiagonalMatrix<float, 4> sampleToRaster(Eigen::Vector4f(
+            (float) m_outputSize.x(), (float) m_outputSize.y(), 1.0f, 1.0f));
+        worldToRaster = sampleToRaster * m_sampleToCamera.getInverseMatrix() *
+            m_cameraToWorld.getInverseMatrix();
+        nearClip = m_nearClip;
+        farClip = m_farClip;
+        return true;
+    }
+
     void addChild(NoriObject *obj) {
         switch (obj->getClassType()) {
             case EReconstructionFilter:
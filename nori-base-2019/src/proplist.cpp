@@ -58,5 +58,29 @@ DEFINE_PROPERTY_ACCESSOR(Vector3f, Vector, vector)
 DEFINE_PROPERTY_ACCESSOR(std::string, String, string)
 DEFINE_PROPERTY_ACCESSOR(Transform, Transform, transform)
 
+bool PropertyList::has(const std::string &name) const {
+    return m_properties.find(name) != m_properties.end();
+}
+
+std::string PropertyList::getType(const std::string &name) const {
+    auto it = m_properties.find(name);
+    if (it == m_properties.end())
+        throw NoriException("Property '%s' is missing!", name);
+    switch (it->second.type) {
+        case Property::boolean_type: return "boolean";
+        case Property::integer_type: return "integer";
+        case Property::float_type: return "float";
+        case Property::string_type: return "string";
+        case Property::color_type: return "color";
+        case Property::point_type: return "point";
+        case Property::vector_type: return "vector";
+        default: return "transform";
+    }
+}
+
+bool PropertyList::remove(const std::string &name) {
+    return m_properties.erase(name) != 0;
+}
+
 NORI_NAMESPACE_END
 
@@ -0,0 +1,305 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/rasterizer.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/instance.h>
+#include <nori/block.h>
+#include <Eigen/Geometry>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+
+NORI_NAMESPACE_BEGIN
+
+Rasterizer::Rasterizer(const Scene *scene) : Rasterizer(scene, scene->getCamera()) { }
+
+Rasterizer::Rasterizer(const Scene *scene, const Camera *camera) : m_scene(scene) {
+    Eigen::Matrix4f worldToRaster;
+    if (!camera->getRasterTransform(worldToRaster, m_nearClip, m_farClip))
+        throw NoriException("Rasterizer: the camera has no center of projection "
+                            "and can't be rasterized!");
+
+    m_size = camera->getOutputSize();
+    build(worldToRaster);
+}
+
+Rasterizer::Rasterizer(const Scene *scene, const Eigen::Matrix4f &worldToRaster,
+        const Vector2i &size, float nearClip, float farClip)
+    : m_scene(scene), m_nearClip(nearClip), m_farClip(farClip), m_size(size) {
+    build(worldToRaster);
+}
+
+void Rasterizer::build(const Eigen::Matrix4f &worldToRaster) {
+    const Scene *scene = m_scene;
+    m_binCount = Vector2i((m_size.x() + NORI_BLOCK_SIZE - 1) / NORI_BLOCK_SIZE,
+                          (m_size.y() + NORI_BLOCK_SIZE - 1) / NORI_BLOCK_SIZE);
+
+    /* Project the vertices of every mesh and set up its visible triangles */
+    for (const Mesh *mesh : scene->getMeshes()) {
+        Eigen::Matrix4f trafo = worldToRaster;
+        const Mesh *geometry = mesh;
+        if (const Instance *instance = dynamic_cast<const Instance *>(mesh)) {
+            trafo = worldToRaster * instance->getTransform().getMatrix();
+            geometry = instance->getPrototype();
+        }
+
+        const MatrixXf &V = geometry->getVertexPositions();
+        const MatrixXu &F = geometry->getIndices();
+        std::vector<Vector3f> projected(V.cols());
+        for (uint32_t i = 0; i < (uint32_t) V.cols(); ++i) {
+            Eigen::Vector4f p = trafo * Eigen::Vector4f(V(0, i), V(1, i), V(2, i), 1.0f);
+            projected[i] = Vector3f(p.x(), p.y(), p.w());
+        }
+
+        for (uint32_t f = 0; f < (uint32_t) F.cols(); ++f) {
+            Vector3f p[3] = { projected[F(0, f)], projected[F(1, f)], projected[F(2, f)] };
+            RasterTriangle tri;
+            tri.mesh = mesh;
+            tri.index = f;
+            if (setup(p, tri))
+                m_triangles.push_back(tri);
+        }
+    }
+
+    /* Sort the triangles into the bins they overlap */
+    uint32_t binCount = (uint32_t) (m_binCount.x() * m_binCount.y());
+    m_binOffset.assign(binCount + 1, 0u);
+    for (int pass = 0; pass < 2; ++pass) {
+        std::vector<uint32_t> next(m_binOffset.begin(), m_binOffset.end() - 1);
+        for (uint32_t i = 0; i < (uint32_t) m_triangles.size(); ++i) {
+            const int *bounds = m_triangles[i].bounds;
+            for (int y = bounds[1] / NORI_BLOCK_SIZE; y <= bounds[3] / NORI_BLOCK_SIZE; ++y) {
+                for (int x = bounds[0] / NORI_BLOCK_SIZE; x <= bounds[2] / NORI_BLOCK_SIZE; ++x) {
+                    uint32_t bin = (uint32_t) (y * m_binCount.x() + x);
+                    if (pass == 0)
+                        m_binOffset[bin + 1]++;
+                    else
+                        m_binTriangles[next[bin]++] = i;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (uint32_t i = 0; i < binCount; ++i)
+                m_binOffset[i + 1] += m_binOffset[i];
+            m_binTriangles.resize(m_binOffset.back());
+        }
+    }
+}
+
+bool Rasterizer::setup(const Vector3f *p, RasterTriangle &tri) const {
+    /* Skip triangles that lie entirely in front of the near
+       or behind the far clipping plane */
+    if ((p[0].z() < m_nearClip && p[1].z() < m_nearClip && p[2].z() < m_nearClip) ||
+        (p[0].z() > m_farClip && p[1].z() > m_farClip && p[2].z() > m_farClip))
+        return false;
+
+    /* Find the bounds of the part in front of the near plane, which
+       is a polygon with up to four vertices */
+    float bounds[4] = {
+        std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(),
+        -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity()
+    };
+    auto expand = [&](const Vector3f &v) {
+        float x = v.x() / v.z(), y = v.y() / v.z();
+        bounds[0] = std::min(bounds[0], x); bounds[1] = std::min(bounds[1], y);
+        bounds[2] = std::max(bounds[2], x); bounds[3] = std::max(bounds[3], y);
+    };
+    for (int i=0; i<3; ++i) {
+        const Vector3f &a = p[i], &b = p[(i + 1) % 3];
+        if (a.z() >= m_nearClip)
+            expand(a);
+        if ((a.z() < m_nearClip) != (b.z() < m_nearClip))
+            expand(a + (b - a) * ((m_nearClip - a.z()) / (b.z() - a.z())));
+    }
+
+    /* Convert to (inclusive) pixel bounds on the film */
+    tri.bounds[0] = (int) std::max(std::floor(bounds[0]), 0.0f);
+    tri.bounds[1] = (int) std::max(std::floor(bounds[1]), 0.0f);
+    tri.bounds[2] = (int) std::min(std::floor(bounds[2]), (float) (m_size.x() - 1));
+    tri.bounds[3] = (int) std::min(std::floor(bounds[3]), (float) (m_size.y() - 1));
+    if (tri.bounds[0] > tri.bounds[2] || tri.bounds[1] > tri.bounds[3])
+        return false;
+
+    /* The edge functions are the rows of the adjugate of the matrix whose
+       columns are the vertices, i.e. the cross products of pairs of
+       vertices. Dividing them by the determinant turns them into the
+       barycentric coordinates of the sample times its inverse depth.
+       They are set up in double precision relative to the center of the
+       triangle, since small triangles otherwise suffer from cancellation */
+    tri.origin[0] = 0.5f * (tri.bounds[0] + tri.bounds[2] + 1);
+    tri.origin[1] = 0.5f * (tri.bounds[1] + tri.bounds[3] + 1);
+    Eigen::Vector3d q[3];
+    for (int i=0; i<3; ++i)
+        q[i] = Eigen::Vector3d(p[i].x() - (double) tri.origin[0] * p[i].z(),
+                               p[i].y() - (double) tri.origin[1] * p[i].z(), p[i].z());
+
+    double det = q[0].dot(q[1].cross(q[2]));
+    if (det == 0)
+        return false; /* Seen edge-on, or degenerate */
+
+    for (int i=0; i<3; ++i) {
+        Eigen::Vector3d edge = q[(i + 1) % 3].cross(q[(i + 2) % 3]) / det;
+        for (int k=0; k<3; ++k)
+            tri.edge[i][k] = (float) edge[k];
+    }
+    return true;
+}
+
+void Rasterizer::rayIntersect(const Point2f *samples, const Ray3f *rays,
+        Intersection *its, uint32_t count) const {
+    if (count == 0)
+        return;
+
+    std::vector<float> invDepth(count);
+    std::vector<uint32_t> closest(count);
+    resolve(samples, count, invDepth.data(), closest.data());
+
+    /* Compute the intersection records of the visible triangles */
+    const Accel *accel = m_scene->getAccel();
+    for (uint32_t i = 0; i < count; ++i) {
+        if (closest[i] == (uint32_t) -1) {
+            its[i].mesh = nullptr;
+            continue;
+        }
+
+        const RasterTriangle &tri = m_triangles[closest[i]];
+        float sx = samples[i].x() - tri.origin[0], sy = samples[i].y() - tri.origin[1];
+        float depth = 1.0f / invDepth[i];
+        Point2f bary(
+            (tri.edge[1][0] * sx + tri.edge[1][1] * sy + tri.edge[1][2]) * depth,
+            (tri.edge[2][0] * sx + tri.edge[2][1] * sy + tri.edge[2][2]) * depth);
+        accel->fillIntersection(rays[i], tri.mesh, tri.index, bary, its[i]);
+    }
+}
+
+void Rasterizer::renderDepth(float *depth) const {
+    /* Every bin is rendered as one batch of pixel centers */
+    tbb::parallel_for(tbb::blocked_range<int>(0, m_binCount.x() * m_binCount.y()),
+        [&](const tbb::blocked_range<int> &range) {
+            std::vector<Point2f> samples;
+            std::vector<float> invDepth;
+            std::vector<uint32_t> closest;
+
+            for (int bin = range.begin(); bin != range.end(); ++bin) {
+                Point2i offset((bin % m_binCount.x()) * NORI_BLOCK_SIZE,
+                               (bin / m_binCount.x()) * NORI_BLOCK_SIZE);
+                Vector2i size(std::min(NORI_BLOCK_SIZE, m_size.x() - offset.x()),
+                              std::min(NORI_BLOCK_SIZE, m_size.y() - offset.y()));
+
+                samples.clear();
+                for (int y = 0; y < size.y(); ++y)
+                    for (int x = 0; x < size.x(); ++x)
+                        samples.push_back(Point2f(offset.x() + x + 0.5f, offset.y() + y + 0.5f));
+                invDepth.resize(samples.size());
+                closest.resize(samples.size());
+                resolve(samples.data(), (uint32_t) samples.size(), invDepth.data(), closest.data());
+
+                for (int y = 0, i = 0; y < size.y(); ++y)
+                    for (int x = 0; x < size.x(); ++x, ++i)
+                        depth[(offset.y() + y) * m_size.x() + offset.x() + x] = closest[i] == (uint32_t) -1
+                            ? std::numeric_limits<float>::infinity() : 1.0f / invDepth[i];
+            }
+        }
+    );
+}
+
+void Rasterizer::resolve(const Point2f *samples, uint32_t count,
+        float *invDepth, uint32_t *closest) const {
+    for (uint32_t i = 0; i < count; ++i) {
+        invDepth[i] = 0.0f;
+        closest[i] = (uint32_t) -1;
+    }
+    if (count == 0)
+        return;
+
+    /* Pixel region covered by the batch */
+    int region[4] = { m_size.x(), m_size.y(), -1, -1 };
+    for (uint32_t i = 0; i < count; ++i) {
+        int x = std::min(std::max((int) std::floor(samples[i].x()), 0), m_size.x() - 1);
+        int y = std::min(std::max((int) std::floor(samples[i].y()), 0), m_size.y() - 1);
+        region[0] = std::min(region[0], x); region[1] = std::min(region[1], y);
+        region[2] = std::max(region[2], x); region[3] = std::max(region[3], y);
+    }
+
+    /* Sort the samples by pixel */
+    int width = region[2] - region[0] + 1, height = region[3] - region[1] + 1;
+    std::vector<uint32_t> pixelOffset(width * height + 1, 0u), order(count);
+    std::vector<uint32_t> pixel(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        int x = std::min(std::max((int) std::floor(samples[i].x()), region[0]), region[2]);
+        int y = std::min(std::max((int) std::floor(samples[i].y()), region[1]), region[3]);
+        pixel[i] = (uint32_t) ((y - region[1]) * width + (x - region[0]));
+        pixelOffset[pixel[i] + 1]++;
+    }
+    for (int i = 0; i < width * height; ++i)
+        pixelOffset[i + 1] += pixelOffset[i];
+    {
+        std::vector<uint32_t> next(pixelOffset.begin(), pixelOffset.end() - 1);
+        for (uint32_t i = 0; i < count; ++i)
+            order[next[pixel[i]]++] = i;
+    }
+
+    /* Z-buffer test against the triangles of all bins overlapping the batch */
+    const float minInvDepth = 1.0f / m_farClip, maxInvDepth = 1.0f / m_nearClip;
+
+    for (int by = region[1] / NORI_BLOCK_SIZE; by <= region[3] / NORI_BLOCK_SIZE; ++by) {
+        for (int bx = region[0] / NORI_BLOCK_SIZE; bx <= region[2] / NORI_BLOCK_SIZE; ++bx) {
+            /* Triangles overlapping several bins are only rasterized within the current one */
+            int binRegion[4] = {
+                std::max(region[0], bx * NORI_BLOCK_SIZE),
+                std::max(region[1], by * NORI_BLOCK_SIZE),
+                std::min(region[2], (bx + 1) * NORI_BLOCK_SIZE - 1),
+                std::min(region[3], (by + 1) * NORI_BLOCK_SIZE - 1)
+            };
+            uint32_t bin = (uint32_t) (by * m_binCount.x() + bx);
+
+            for (uint32_t j = m_binOffset[bin]; j < m_binOffset[bin + 1]; ++j) {
+                uint32_t triIdx = m_binTriangles[j];
+                const RasterTriangle &tri = m_triangles[triIdx];
+                int x0 = std::max(tri.bounds[0], binRegion[0]), x1 = std::min(tri.bounds[2], binRegion[2]);
+                int y0 = std::max(tri.bounds[1], binRegion[1]), y1 = std::min(tri.bounds[3], binRegion[3]);
+
+                for (int y = y0; y <= y1; ++y) {
+                    for (int x = x0; x <= x1; ++x) {
+                        uint32_t p = (uint32_t) ((y - region[1]) * width + (x - region[0]));
+                        for (uint32_t k = pixelOffset[p]; k < pixelOffset[p + 1]; ++k) {
+                            uint32_t i = order[k];
+                            float sx = samples[i].x() - tri.origin[0], sy = samples[i].y() - tri.origin[1];
+                            float e0 = tri.edge[0][0] * sx + tri.edge[0][1] * sy + tri.edge[0][2];
+                            float e1 = tri.edge[1][0] * sx + tri.edge[1][1] * sy + tri.edge[1][2];
+                            float e2 = tri.edge[2][0] * sx + tri.edge[2][1] * sy + tri.edge[2][2];
+                            if (e0 < 0 || e1 < 0 || e2 < 0)
+                                continue;
+
+                            /* The edge functions sum up to the inverse depth */
+                            float inv = e0 + e1 + e2;
+                            if (inv > invDepth[i] && inv >= minInvDepth && inv <= maxInvDepth) {
+                                invDepth[i] = inv;
+                                closest[i] = triIdx;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+}
+
+NORI_NAMESPACE_END
@@ -0,0 +1,155 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/raystream.h>
+#include <nori/scene.h>
+
+NORI_NAMESPACE_BEGIN
+
+/* Number of bits used to quantize the ray origins along each axis */
+static const int ORIGIN_BITS = 5;
+
+/* Total number of bits of the sort keys (origin cell, octant, shadow flag) */
+static const int KEY_BITS = 3 * ORIGIN_BITS + 4;
+
+/// Interleave the lower ORIGIN_BITS bits of x with two zero bits each
+static uint32_t expandBits(uint32_t x) {
+    uint32_t result = 0;
+    for (int i = 0; i < ORIGIN_BITS; ++i)
+        result |= ((x >> i) & 1u) << (3 * i);
+    return result;
+}
+
+RayStream::RayStream(const Scene *scene) : m_scene(scene) {
+    m_bbox = scene->getBoundingBox();
+}
+
+uint32_t RayStream::addRay(const Ray3f &ray) {
+    m_rays.push_back(ray);
+    m_shadow.push_back(0);
+    return (uint32_t) m_rays.size() - 1;
+}
+
+uint32_t RayStream::addShadowRay(const Ray3f &ray) {
+    m_rays.push_back(ray);
+    m_shadow.push_back(1);
+    return (uint32_t) m_rays.size() - 1;
+}
+
+uint32_t RayStream::addShadowRay(const Point3f &p, const Point3f &q) {
+    Vector3f d = q - p;
+    float dist = d.norm();
+    if (dist == 0) /* Empty segment, which is never occluded */
+        return addShadowRay(Ray3f(p, Vector3f(0, 0, 1), 1, 0));
+    return addShadowRay(Ray3f(p, d / dist, Epsilon, dist * (1 - Epsilon)));
+}
+
+void RayStream::clear() {
+    m_rays.clear();
+    m_shadow.clear();
+    m_hit.clear();
+    m_order.clear();
+    m_temp.clear();
+}
+
+uint32_t RayStream::getSortKey(const Ray3f &ray, bool shadowRay) const {
+    const uint32_t cells = 1u << ORIGIN_BITS;
+    Vector3f extents = m_bbox.getExtents();
+
+    uint32_t cell[3], octant = 0;
+    for (int i=0; i<3; ++i) {
+        float pos = extents[i] > 0 ? (ray.o[i] - m_bbox.min[i]) / extents[i] : 0.0f;
+        cell[i] = (uint32_t) std::min(std::max(pos * cells, 0.0f), (float) (cells - 1));
+        if (ray.d[i] < 0)
+            octant |= 1u << i;
+    }
+
+    uint32_t morton = (expandBits(cell[0]) << 2) | (expandBits(cell[1]) << 1) | expandBits(cell[2]);
+    return ((shadowRay ? 1u : 0u) << (3 * ORIGIN_BITS + 3)) | (octant << (3 * ORIGIN_BITS)) | morton;
+}
+
+void RayStream::trace() {
+    uint32_t count = size();
+    m_hit.assign(count, 0);
+    /* Records are only valid for rays that hit, no need to reset them */
+    if (m_its.size() < count)
+        m_its.resize(count);
+
+    /* Sort the rays, closest-hit queries come first. The keys only have
+       KEY_BITS bits, hence a two-pass radix sort is much faster than
+       a comparison sort */
+    const int DIGIT_BITS = (KEY_BITS + 1) / 2, BUCKETS = 1 << DIGIT_BITS;
+    m_order.resize(count);
+    m_temp.resize(count);
+    for (uint32_t i = 0; i < count; ++i)
+        m_temp[i] = ((uint64_t) getSortKey(m_rays[i], m_shadow[i] != 0) << 32) | i;
+    for (int shift = 32; shift < 32 + KEY_BITS; shift += DIGIT_BITS) {
+        uint32_t offsets[BUCKETS] = { 0 };
+        for (uint32_t i = 0; i < count; ++i)
+            offsets[(m_temp[i] >> shift) & (BUCKETS - 1)]++;
+        for (uint32_t i = 0, sum = 0; i < BUCKETS; ++i) {
+            uint32_t bucket = offsets[i];
+            offsets[i] = sum;
+            sum += bucket;
+        }
+        for (uint32_t i = 0; i < count; ++i)
+            m_order[offsets[(m_temp[i] >> shift) & (BUCKETS - 1)]++] = m_temp[i];
+        m_order.swap(m_temp);
+    }
+    m_order.swap(m_temp);
+
+    bool packets = m_scene->usePacketTracing();
+    Ray3f rays[NORI_PACKET_SIZE];
+    Intersection its[NORI_PACKET_SIZE];
+    uint32_t indices[NORI_PACKET_SIZE];
+
+    uint32_t i = 0;
+    while (i < count) {
+        uint32_t index = (uint32_t) m_order[i];
+
+        if (m_shadow[index]) {
+            m_hit[index] = m_scene->rayIntersect(m_rays[index]);
+            ++i;
+            continue;
+        }
+
+        if (!packets) {
+            m_hit[index] = m_scene->rayIntersect(m_rays[index], m_its[index]);
+            ++i;
+            continue;
+        }
+
+        /* Trace consecutive closest-hit queries together */
+        uint32_t n = 0;
+        while (n < NORI_PACKET_SIZE && i < count && !m_shadow[(uint32_t) m_order[i]]) {
+            indices[n] = (uint32_t) m_order[i++];
+            rays[n] = m_rays[indices[n]];
+            ++n;
+        }
+
+        uint32_t hits = m_scene->rayIntersectPacket(rays, its, (uint32_t) ((1ull << n) - 1));
+        for (uint32_t j = 0; j < n; ++j) {
+            if (hits & (1u << j)) {
+                m_hit[indices[j]] = 1;
+                m_its[indices[j]] = its[j];
+            }
+        }
+    }
+}
+
+NORI_NAMESPACE_END
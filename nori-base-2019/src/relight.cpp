@@ -0,0 +1,109 @@
+#include <nori/integrator.h>
+#include <nori/scene.h>
+#include <nori/bsdf.h>
+
+NORI_NAMESPACE_BEGIN
+
+//renders the "simple" and "noShadow" images of a view for a whole list of point light positions.
+//the first hits of the camera rays are only found once per sample (see Integrator::shadeOutputs()),
+//only the shadow rays differ between the lights
+class RelightIntegrator : public Integrator {
+public:
+	RelightIntegrator(const PropertyList &props)
+	{
+		//positions of the point light, separated by semicolons, e.g. "0, 1, 0; 1, 1, 0"
+		std::vector<std::string> tokens = tokenize(props.getString("positions"), ";");
+		for (const std::string &token : tokens)
+		{
+			//skip empty entries, e.g. after a trailing semicolon
+			if (token.find_first_not_of(" \t\r\n") != std::string::npos)
+				positions.push_back(Point3f(toVector3f(token)));
+		}
+		if (positions.empty())
+			throw NoriException("RelightIntegrator: no light positions were specified!");
+		energy = props.getColor("energy");
+		cout << "energy = " << energy.toString() << ", " << positions.size() << " light positions" << endl;
+	}
+
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+	{
+		Intersection its;
+		scene->rayIntersect(ray, its);
+		return shade(scene, sampler, ray, its);
+	}
+
+	//shadowed image of the first light, only used when a single image is rendered
+	Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection &its) const
+	{
+		Color3f value = unshadowed(ray, its, positions[0]);
+		if (value.isZero() || scene->occluded(its.p, positions[0]))
+			return Color3f(0.0f);
+		return value;
+	}
+
+	//outputs 2*i and 2*i+1 hold the shadowed and the unshadowed image of light i
+	void shadeOutputs(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+		const Intersection *its, Color3f *result, uint32_t count) const
+	{
+		for (size_t light = 0; light < positions.size(); ++light)
+		{
+			Color3f *shadowed = result + 2 * light * count;
+			Color3f *noShadow = shadowed + count;
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				noShadow[i] = unshadowed(rays[i], its[i], positions[light]);
+				//the shadow ray is only needed if the light can contribute at all
+				if (noShadow[i].isZero() || scene->occluded(its[i].p, positions[light]))
+					shadowed[i] = Color3f(0.0f);
+				else
+					shadowed[i] = noShadow[i];
+			}
+		}
+	}
+
+	//radiance reflected towards the camera when light is not blocked (same as the noShadow integrator)
+	Color3f unshadowed(const Ray3f &ray, const Intersection &its, const Point3f &position) const
+	{
+		if (!its.mesh)
+		{
+			return Color3f(0.0f);
+		}
+		Point3f x = its.p; //where the ray hits the mesh
+		const BSDF* bsdf = its.mesh->getBSDF();
+		Vector3f v = (position - x).normalized();
+		Normal3f n = its.shFrame.n.normalized();
+		float cosRes = v.dot(n);
+		if (cosRes <= 0)
+		{
+			return Color3f(0.0f);
+		}
+
+		BSDFQueryRecord record(its.shFrame.toLocal(v), its.shFrame.toLocal((-ray.d).normalized()), EMeasure::ESolidAngle);
+		return (energy / (4 * M_PI*M_PI)) * bsdf->eval(record) * (cosRes / (x - position).squaredNorm());
+	}
+
+	uint32_t getOutputCount() const
+	{
+		return (uint32_t) (2 * positions.size());
+	}
+
+	std::string getOutputSuffix(uint32_t index) const
+	{
+		return getTypeSuffix(index % 2 == 0 ? ESimple : ENoShadows) + "_" + std::to_string(index / 2);
+	}
+
+	bool supportsPrimaryHits() const
+	{
+		return true;
+	}
+
+	std::string toString() const {
+		return tfm::format("RelightIntegrator[lights = %i]", positions.size());
+	}
+
+	std::vector<Point3f> positions; // postions of the point light source
+	Color3f energy; // energy of point light source
+};
+
+NORI_REGISTER_CLASS(RelightIntegrator, "relight");
+NORI_NAMESPACE_END
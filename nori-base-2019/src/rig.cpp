@@ -0,0 +1,140 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/camera.h>
+#include <nori/rfilter.h>
+#include <Eigen/Geometry>
+
+NORI_NAMESPACE_BEGIN
+
+/**
+ * \brief Camera rig that renders several views around a common center
+ *
+ * The rig creates \c rigViews cameras of type \c rigCamera (default:
+ * <tt>perspective</tt>), which receive all other properties of the rig.
+ * View \c i is placed by rotating the <tt>toWorld</tt> transformation of
+ * the rig by <tt>rigAngle * i / rigViews</tt> degrees (default: 360) about
+ * the axis \c rigAxis (default: up) through the point \c rigCenter. All
+ * views are rendered in one pass, see \ref Scene::getCameras().
+ */
+class CameraRig : public Camera {
+public:
+    CameraRig(const PropertyList &propList) : m_propList(propList) {
+        m_type = propList.getString("rigCamera", "perspective");
+        m_viewCount = propList.getInteger("rigViews");
+        m_center = propList.getPoint("rigCenter", Point3f(0.0f));
+        m_axis = propList.getVector("rigAxis", Vector3f(0.0f, 1.0f, 0.0f)).normalized();
+        m_angle = propList.getFloat("rigAngle", 360.0f);
+
+        if (m_viewCount < 1)
+            throw NoriException("CameraRig: rigViews must be positive!");
+
+        m_rfilter = nullptr;
+    }
+
+    ~CameraRig() {
+        for (auto view : m_views)
+            delete view;
+    }
+
+    void activate() {
+        Transform toWorld = m_propList.getTransform("toWorld", Transform());
+
+        for (int i = 0; i < m_viewCount; ++i) {
+            Eigen::Affine3f rotation = Eigen::Translation3f(m_center) *
+                Eigen::AngleAxisf(degToRad(m_angle * i / m_viewCount), m_axis) *
+                Eigen::Translation3f(-m_center);
+
+            PropertyList propList = m_propList;
+            propList.remove("toWorld");
+            propList.setTransform("toWorld", Transform(rotation.matrix()) * toWorld);
+
+            NoriObject *view = NoriObjectFactory::createInstance(m_type, propList);
+            if (view->getClassType() != ECamera) {
+                delete view;
+                throw NoriException("CameraRig: \"%s\" is not a camera!", m_type);
+            }
+            m_views.push_back(static_cast<Camera *>(view));
+
+            /* The views share the reconstruction filter of the rig */
+            if (m_rfilter)
+                view->addChild(m_rfilter);
+            view->activate();
+        }
+
+        m_outputSize = m_views[0]->getOutputSize();
+        m_rfilter = const_cast<ReconstructionFilter *>(m_views[0]->getReconstructionFilter());
+    }
+
+    Color3f sampleRay(Ray3f &ray, const Point2f &samplePosition,
+            const Point2f &apertureSample) const {
+        return m_views[0]->sampleRay(ray, samplePosition, apertureSample);
+    }
+
+    bool getRasterTransform(Eigen::Matrix4f &worldToRaster,
+            float &nearClip, float &farClip) const {
+        return m_views[0]->getRasterTransform(worldToRaster, nearClip, farClip);
+    }
+
+    uint32_t getViewCount() const { return (uint32_t) m_views.size(); }
+
+    const Camera *getView(uint32_t index) const { return m_views[index]; }
+
+    void addChild(NoriObject *obj) {
+        switch (obj->getClassType()) {
+            case EReconstructionFilter:
+                if (m_rfilter)
+                    throw NoriException("Camera: tried to register multiple reconstruction filters!");
+                m_rfilter = static_cast<ReconstructionFilter *>(obj);
+                break;
+
+            default:
+                throw NoriException("Camera::addChild(<%s>) is not supported!",
+                    classTypeName(obj->getClassType()));
+        }
+    }
+
+    /// Return a human-readable summary
+    std::string toString() const {
+        return tfm::format(
+            "CameraRig[\n"
+            "  views = %i,\n"
+            "  center = %s,\n"
+            "  axis = %s,\n"
+            "  angle = %f,\n"
+            "  camera = %s\n"
+            "]",
+            m_viewCount,
+            m_center.toString(),
+            m_axis.toString(),
+            m_angle,
+            m_views.empty() ? m_type : indent(m_views[0]->toString())
+        );
+    }
+private:
+    PropertyList m_propList;
+    std::string m_type;
+    int m_viewCount;
+    Point3f m_center;
+    Vector3f m_axis;
+    float m_angle;
+    std::vector<Camera *> m_views;
+};
+
+NORI_REGISTER_CLASS(CameraRig, "rig");
+NORI_NAMESPACE_END
@@ -26,14 +26,18 @@
 
 NORI_NAMESPACE_BEGIN
 
-Scene::Scene(const PropertyList &) {
-    m_accel = new Accel();
+Scene::Scene(const PropertyList &propList) {
+    m_accel = new Accel(propList);
+    m_packetTracing = propList.getBoolean("packetTracing", true);
+    m_rayStreams = propList.getBoolean("rayStreams", false);
+    m_rasterize = propList.getBoolean("rasterize", false);
 }
 
 Scene::~Scene() {
     delete m_accel;
     delete m_sampler;
-    delete m_camera;
+    for (auto camera : m_cameras)
+        delete camera;
     delete m_integrator;
 }
 
@@ -48,7 +52,7 @@ void Scene::activate() {
 
     if (!m_integrator)
         throw NoriException("No integrator was specified!");
-    if (!m_camera)
+    if (m_views.empty())
         throw NoriException("No camera was specified!");
     
     if (!m_sampler) {
@@ -61,6 +65,7 @@ void Scene::activate() {
     //cout << "Configuration: " << toString() << endl;
     //cout << endl;
 	//add all meshes that are emitters to m_emitters;
+	m_emitters.clear();
 	for(int i = 0; i < m_meshes.size();i++)
 	{
 		if (m_meshes[i]->isEmitter())
@@ -93,10 +98,13 @@ void Scene::addChild(NoriObject *obj) {
             m_sampler = static_cast<Sampler *>(obj);
             break;
 
-        case ECamera:
-            if (m_camera)
-                throw NoriException("There can only be one camera per scene!");
-            m_camera = static_cast<Camera *>(obj);
+        case ECamera: {
+                /* Several cameras (or camera rigs) are rendered in one pass */
+                Camera *camera = static_cast<Camera *>(obj);
+                m_cameras.push_back(camera);
+                for (uint32_t i=0; i<camera->getViewCount(); ++i)
+                    m_views.push_back(camera->getView(i));
+            }
             break;
         
         case EIntegrator:
@@ -111,6 +119,22 @@ void Scene::addChild(NoriObject *obj) {
     }
 }
 
+void Scene::addMesh(Mesh *mesh) {
+    m_accel->addMesh(mesh);
+    m_meshes.push_back(mesh);
+    if (mesh->isEmitter())
+        m_emitters.push_back(mesh);
+}
+
+void Scene::removeMesh(Mesh *mesh) {
+    auto it = std::find(m_meshes.begin(), m_meshes.end(), mesh);
+    if (it == m_meshes.end())
+        throw NoriException("Scene::removeMesh(): the mesh is not part of the scene!");
+    m_meshes.erase(it);
+    m_emitters.erase(std::remove(m_emitters.begin(), m_emitters.end(), mesh), m_emitters.end());
+    m_accel->removeMesh(mesh);
+}
+
 Vector3f Scene::getCenterOfMass() const
 {
 	Vector3f centerOfMass(0.f);
@@ -137,6 +161,13 @@ std::string Scene::toString() const {
         meshes += "\n";
     }
 
+    std::string cameras;
+    for (size_t i=0; i<m_cameras.size(); ++i) {
+        if (i > 0)
+            cameras += ",\n";
+        cameras += m_cameras[i]->toString();
+    }
+
     return tfm::format(
         "Scene[\n"
         "  integrator = %s,\n"
@@ -147,7 +178,7 @@ std::string Scene::toString() const {
         "]",
         indent(m_integrator->toString()),
         indent(m_sampler->toString()),
-        indent(m_camera->toString()),
+        indent(cameras),
         indent(meshes, 2)
     );
 }
@@ -0,0 +1,99 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/shadowmap.h>
+#include <nori/rasterizer.h>
+
+NORI_NAMESPACE_BEGIN
+
+/* Face 2*a+k looks along the positive (k=0) or negative (k=1) direction of
+   axis a. Its texel coordinates are the two other axes, in cyclic order,
+   divided by the depth along a and mapped from [-1, 1] to [0, resolution] */
+
+ShadowMap::ShadowMap(const Scene *scene, const Point3f &position, int resolution, float bias)
+    : m_position(position), m_resolution(resolution), m_bias(bias) {
+    if (resolution <= 0)
+        throw NoriException("ShadowMap: the resolution must be positive");
+
+    size_t faceSize = (size_t) resolution * resolution;
+    m_depth.resize(6 * faceSize);
+    float half = 0.5f * resolution;
+
+    for (int face = 0; face < 6; ++face) {
+        int axis = face / 2, u = (axis + 1) % 3, v = (axis + 2) % 3;
+        float sign = (face % 2 == 0) ? 1.0f : -1.0f;
+
+        /* Projection relative to the light, maps to (x*w, y*w, 0, w) */
+        Eigen::Matrix4f toFace = Eigen::Matrix4f::Zero();
+        toFace(3, axis) = sign;
+        toFace(0, u) = toFace(1, v) = half;
+        toFace(0, axis) = toFace(1, axis) = half * sign;
+
+        Eigen::Matrix4f translate = Eigen::Matrix4f::Identity();
+        translate.topRightCorner<3, 1>() = -position;
+
+        Rasterizer rasterizer(scene, toFace * translate, Vector2i(resolution, resolution),
+            Epsilon, std::numeric_limits<float>::infinity());
+        rasterizer.renderDepth(m_depth.data() + face * faceSize);
+    }
+}
+
+float ShadowMap::visibility(const Point3f &p) const {
+    Vector3f d = p - m_position;
+    int axis = 0;
+    float depth = d.cwiseAbs().maxCoeff(&axis);
+    if (depth == 0)
+        return 1.0f;
+
+    int face = 2 * axis + (d[axis] < 0 ? 1 : 0);
+    const float *map = m_depth.data() + (size_t) face * m_resolution * m_resolution;
+
+    /* Continuous texel coordinates relative to the texel centers */
+    float half = 0.5f * m_resolution;
+    float x = (d[(axis + 1) % 3] / depth + 1.0f) * half - 0.5f;
+    float y = (d[(axis + 2) % 3] / depth + 1.0f) * half - 0.5f;
+    int x0 = (int) std::floor(x), y0 = (int) std::floor(y);
+    float fx = x - x0, fy = y - y0;
+
+    /* Percentage-closer filtering over the four nearest texels */
+    float threshold = depth * (1.0f - m_bias), result = 0.0f;
+    for (int j = 0; j < 2; ++j) {
+        for (int i = 0; i < 2; ++i) {
+            int tx = std::min(std::max(x0 + i, 0), m_resolution - 1);
+            int ty = std::min(std::max(y0 + j, 0), m_resolution - 1);
+            if (threshold <= map[ty * m_resolution + tx])
+                result += (i ? fx : 1.0f - fx) * (j ? fy : 1.0f - fy);
+        }
+    }
+    return result;
+}
+
+std::string ShadowMap::toString() const {
+    return tfm::format(
+        "ShadowMap[\n"
+        "  position = %s,\n"
+        "  resolution = %i,\n"
+        "  bias = %f\n"
+        "]",
+        m_position.toString(),
+        m_resolution,
+        m_bias
+    );
+}
+
+NORI_NAMESPACE_END
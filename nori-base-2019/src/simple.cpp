@@ -1,6 +1,8 @@
 #include <nori/integrator.h>
 #include <nori/scene.h>
 #include <nori/bsdf.h>
+#include <nori/shadowmap.h>
+#include <memory>
 
 NORI_NAMESPACE_BEGIN
 
@@ -11,25 +13,47 @@ public:
 		position = props.getPoint("position");
 		energy = props.getColor("energy");
 		cout << "energy = " << energy.toString() << endl;
+		//look up the visibility of the light in a cube shadow map instead of tracing shadow rays
+		useShadowMap = props.getBoolean("shadowMap", false);
+		shadowMapResolution = props.getInteger("shadowMapResolution", 512);
+		shadowMapBias = props.getFloat("shadowMapBias", 0.01f);
 		first = true;
 		//min x max x, min y max y, min z max z
 		minMaxVector = { 100,-100,100,-100,100,-100 };
 	}
 
+	void preprocess(const Scene *scene)
+	{
+		//the shadow map is rendered once from the light, shading points only look it up
+		if (useShadowMap)
+			shadowMap.reset(new ShadowMap(scene, position, shadowMapResolution, shadowMapBias));
+	}
+
 	//point x will be visible only if light reaches it
 	bool visiblity(const Scene *scene, Point3f x) const
 	{
-		Vector3f dir = position - x;//direction from point to light source
-		dir.normalize();
-		Ray3f ray(x, dir);
-		return !scene->rayIntersect(ray);//if ray intersects, then it means that it hit another point in the mesh
-		//while on it's way to the light source. so x won't recieve light
+		return !scene->occluded(x, position);//if the segment to the light hits another point in the mesh
+		//while on it's way to the light source, then x won't recieve light
+	}
+
+	//fraction of the light that reaches point x
+	float visibilityFraction(const Scene *scene, Point3f x) const
+	{
+		if (shadowMap)
+			return shadowMap->visibility(x);
+		return visiblity(scene, x) ? 1.0f : 0.0f;
 	}
 
 	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
 	{
 		Intersection its;
-		if (!scene->rayIntersect(ray, its))
+		scene->rayIntersect(ray, its);
+		return shade(scene, sampler, ray, its);
+	}
+
+	Color3f shade(const Scene *scene, Sampler *sampler, const Ray3f &ray, const Intersection &its) const
+	{
+		if (!its.mesh)
 		{
 			return Color3f(0.0f);
 		}
@@ -61,11 +85,12 @@ public:
 		float cosRes = v.dot(n);
 
 		BSDFQueryRecord record(its.shFrame.toLocal((position - x).normalized()), its.shFrame.toLocal((-ray.d).normalized()), EMeasure::ESolidAngle);
-		if (!visiblity(scene, x))
+		float vis = visibilityFraction(scene, x);
+		if (vis == 0)
 		{
 			return Color3f(0.0f);
 		}
-		return (energy / (4 * M_PI*M_PI)) * bsdf->eval(record) * ((cosRes > 0 ? cosRes : 0) / xMinusP.squaredNorm());
+		return vis * (energy / (4 * M_PI*M_PI)) * bsdf->eval(record) * ((cosRes > 0 ? cosRes : 0) / xMinusP.squaredNorm());
 	}
 
 	std::string toString() const {
@@ -77,6 +102,11 @@ public:
 		return EIntegratorType::ESimple;
 	}
 
+	bool supportsPrimaryHits() const
+	{
+		return true;
+	}
+
 	std::vector<float> getMinMaxVector() const
 	{
 		return minMaxVector;
@@ -86,6 +116,10 @@ public:
 	Color3f energy; // energy of point light source
 	mutable bool first;
 	mutable std::vector<float> minMaxVector;
+	bool useShadowMap;
+	int shadowMapResolution;
+	float shadowMapBias;
+	std::unique_ptr<ShadowMap> shadowMap;
 	
 
 
@@ -0,0 +1,120 @@
+#include <nori/multi.h>
+#include <nori/scene.h>
+#include <memory>
+
+NORI_NAMESPACE_BEGIN
+
+//renders an integrator for several values of one of its properties (e.g. the light position or energy) in one pass.
+//all other properties of the sweep are passed on to the swept integrator, e.g.
+//  <integrator type="sweep">
+//      <string name="sweepIntegrator" value="simple"/>
+//      <string name="sweepProperty" value="position"/>
+//      <string name="sweepValues" value="0,1,0; 1,1,0; 2,1,0"/>
+//      <point name="position" value="0,1,0"/>
+//      <color name="energy" value="100,100,100"/>
+//  </integrator>
+//instead of a list of values, a range can be given by sweepFrom, sweepTo and sweepCount.
+//the type of the values is the type of the property in the sweep (e.g. <point name="position" .../> above),
+//and the image of value i is saved with the suffix of the swept integrator followed by "_i".
+//the integrators of the values are composed like the nested integrators of a MultiIntegrator
+class SweepIntegrator : public MultiIntegrator {
+public:
+	SweepIntegrator(const PropertyList &props) : MultiIntegrator(props)
+	{
+		std::string type = props.getString("sweepIntegrator");
+		property = props.getString("sweepProperty");
+		if (!props.has(property))
+			throw NoriException("SweepIntegrator: the swept property \"%s\" needs a value in the sweep, which determines its type!", property);
+		std::string propertyType = props.getType(property);
+
+		//one property list per value
+		std::vector<PropertyList> variants;
+		if (props.has("sweepValues"))
+		{
+			for (const std::string &token : tokenize(props.getString("sweepValues"), ";"))
+			{
+				//skip empty entries, e.g. after a trailing semicolon
+				if (token.find_first_not_of(" \t\r\n") == std::string::npos)
+					continue;
+				variants.push_back(props);
+				setValue(variants.back(), propertyType, parseValue(propertyType, token));
+			}
+		}
+		else
+		{
+			Vector3f from = parseValue(propertyType, props.getString("sweepFrom"));
+			Vector3f to = parseValue(propertyType, props.getString("sweepTo"));
+			int count = props.getInteger("sweepCount");
+			if (count < 1)
+				throw NoriException("SweepIntegrator: sweepCount must be positive!");
+			for (int i = 0; i < count; ++i)
+			{
+				float t = count > 1 ? (float) i / (float) (count - 1) : 0.0f;
+				variants.push_back(props);
+				setValue(variants.back(), propertyType, (1 - t) * from + t * to);
+			}
+		}
+		if (variants.empty())
+			throw NoriException("SweepIntegrator: no values were specified for \"%s\"!", property);
+
+		//the integrators that were created are released by ~MultiIntegrator() if one of them fails
+		for (PropertyList &variant : variants)
+		{
+			std::unique_ptr<NoriObject> obj(NoriObjectFactory::createInstance(type, variant));
+			if (obj->getClassType() != EIntegrator)
+				throw NoriException("SweepIntegrator: \"%s\" is not an integrator!", type);
+			obj->activate();
+			integrators.push_back(static_cast<Integrator *>(obj.release()));
+		}
+	}
+
+	//only numeric properties can be swept, their values are stored in the first components of a vector
+	static Vector3f parseValue(const std::string &type, const std::string &str)
+	{
+		if (type == "float")
+			return Vector3f(toFloat(str), 0, 0);
+		if (type == "integer")
+			return Vector3f((float) toInt(str), 0, 0);
+		if (type == "color" || type == "point" || type == "vector")
+			return toVector3f(str);
+		throw NoriException("SweepIntegrator: properties of type <%s> can't be swept!", type);
+	}
+
+	void setValue(PropertyList &props, const std::string &type, const Vector3f &value) const
+	{
+		props.remove(property);
+		if (type == "float")
+			props.setFloat(property, value.x());
+		else if (type == "integer")
+			props.setInteger(property, (int) std::round(value.x()));
+		else if (type == "color")
+			props.setColor(property, Color3f(value.x(), value.y(), value.z()));
+		else if (type == "point")
+			props.setPoint(property, Point3f(value));
+		else
+			props.setVector(property, value);
+	}
+
+	//the values are given by the sweep
+	void addChild(NoriObject *obj)
+	{
+		throw NoriException("SweepIntegrator::addChild(<%s>) is not supported!",
+			classTypeName(obj->getClassType()));
+	}
+
+	std::string getOutputSuffix(uint32_t index) const
+	{
+		uint32_t outputs = integrators[0]->getOutputCount();
+		return integrators[0]->getOutputSuffix(index % outputs) + "_" + std::to_string(index / outputs);
+	}
+
+	std::string toString() const {
+		return tfm::format("SweepIntegrator[property = %s, values = %i, integrator = %s]",
+			property, integrators.size(), indent(integrators[0]->toString()));
+	}
+
+	std::string property; // name of the swept property
+};
+
+NORI_REGISTER_CLASS(SweepIntegrator, "sweep");
+NORI_NAMESPACE_END
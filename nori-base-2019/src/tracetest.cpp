@@ -0,0 +1,539 @@
+/*
+    This file is part of Nori, a simple educational ray tracer
+
+    Copyright (c) 2015 by Wenzel Jakob
+
+    Nori is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Nori is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <nori/accel.h>
+#include <nori/scene.h>
+#include <nori/camera.h>
+#include <nori/integrator.h>
+#include <nori/sampler.h>
+#include <nori/rasterizer.h>
+#include <nori/raystream.h>
+#include <nori/block.h>
+#include <Eigen/Geometry>
+#include <hypothesis.h>
+#include <pcg32.h>
+#include <memory>
+
+/*
+ * Consistency checks of the code paths that must find the same surfaces:
+ *
+ * 1. every BVH layout, builder and node encoding, also after refit() and
+ *    after meshes were added or removed, against a brute-force search
+ * 2. ray packets against single rays
+ * 3. instances against transformed copies of the meshes
+ * 4. the rasterizer against ray tracing of the camera rays
+ * 5. Integrator::LiStream() against Integrator::Li() (Student's t-test)
+ *
+ * Usage: tracetest <mesh.obj> [<mesh.obj> ...]
+ */
+
+using namespace nori;
+
+/// Number of rays traced per BVH check
+static const int RAY_COUNT = 4096;
+
+/// Relative tolerance of the distances to the closest intersection
+static const float DISTANCE_TOLERANCE = 1e-4f;
+
+/**
+ * Fraction of the camera samples on which the rasterizer may disagree with
+ * ray tracing, since samples on a shared edge or at a tie between two
+ * surfaces are resolved differently by the two methods
+ */
+static const double RASTER_TOLERANCE = 1e-4;
+
+/// Significance level of the comparison of LiStream() and Li()
+static const float SIGNIFICANCE_LEVEL = 0.01f;
+
+/// Rectangle spanned by two edges, used for the ground plane and the light
+class Quad : public Mesh {
+public:
+    Quad(const Point3f &corner, const Vector3f &u, const Vector3f &v) {
+        m_name = "quad";
+        m_V.resize(3, 4);
+        m_V.col(0) = corner;
+        m_V.col(1) = corner + u;
+        m_V.col(2) = corner + u + v;
+        m_V.col(3) = corner + v;
+        m_F.resize(3, 2);
+        m_F.col(0) << 0, 1, 2;
+        m_F.col(1) << 0, 2, 3;
+        for (int i = 0; i < 4; ++i)
+            m_bbox.expandBy(m_V.col(i));
+    }
+};
+
+/// Transformation that fits an OBJ file into the cube [-1, 1]^3, followed by \c trafo
+static Transform fitToCube(const std::string &filename, const Eigen::Affine3f &trafo) {
+    PropertyList props;
+    props.setString("filename", filename);
+    std::unique_ptr<Mesh> mesh(static_cast<Mesh *>(
+        NoriObjectFactory::createInstance("obj", props)));
+    const BoundingBox3f &bbox = mesh->getBoundingBox();
+    Eigen::Affine3f fit = Eigen::Scaling(2.f / bbox.getExtents().maxCoeff())
+        * Eigen::Translation3f(-bbox.getCenter());
+    return Transform((trafo * fit).matrix());
+}
+
+/// Random rotation, (possibly mirroring) scaling and translation within [-spread, spread]^3
+static Eigen::Affine3f randomPlacement(pcg32 &rng, float spread, bool mirror) {
+    Eigen::Vector3f axis(rng.nextFloat() - .5f, rng.nextFloat() - .5f, rng.nextFloat() - .5f);
+    Eigen::Vector3f offset(rng.nextFloat(), rng.nextFloat(), rng.nextFloat());
+    float scale = 0.5f + rng.nextFloat();
+    return Eigen::Translation3f(spread * (2 * offset - Eigen::Vector3f::Ones()))
+        * Eigen::AngleAxisf(2 * M_PI * rng.nextFloat(), axis.normalized())
+        * Eigen::Scaling(scale, mirror ? -scale : scale, 1.3f * scale);
+}
+
+/// Load an OBJ file, or an \ref Instance of it
+static Mesh *loadMesh(const std::string &filename, const Transform &toWorld, bool instance = false) {
+    PropertyList props;
+    props.setString("filename", filename);
+    props.setTransform("toWorld", toWorld);
+    Mesh *mesh = static_cast<Mesh *>(
+        NoriObjectFactory::createInstance(instance ? "instance" : "obj", props));
+    mesh->activate();
+    return mesh;
+}
+
+/// Distance to the closest intersection with any triangle of the meshes (infinity if none)
+static float bruteForce(const std::vector<const Mesh *> &meshes, Ray3f ray) {
+    /* Same self-intersection offset as Accel::rayIntersect() */
+    if (ray.mint == Epsilon)
+        ray.mint = std::max(ray.mint, ray.mint * ray.o.array().abs().maxCoeff());
+
+    bool found = false;
+    for (const Mesh *mesh : meshes) {
+        for (uint32_t f = 0; f < mesh->getTriangleCount(); ++f) {
+            float u, v, t;
+            if (mesh->rayIntersect(f, ray, u, v, t)) {
+                ray.maxt = t;
+                found = true;
+            }
+        }
+    }
+    return found ? ray.maxt : std::numeric_limits<float>::infinity();
+}
+
+/// Distance of the point \c p from the segment between \c a and \c b
+static float segmentDistance(const Point3f &p, const Point3f &a, const Point3f &b) {
+    Vector3f ab = b - a;
+    float s = clamp((p - a).dot(ab) / ab.squaredNorm(), 0.f, 1.f);
+    return (p - (a + s * ab)).norm();
+}
+
+/**
+ * Whether the ray passes close to the boundary of a triangle (or through a
+ * sliver triangle) before reaching distance \c tMax. Whether it hits the
+ * triangle is then down to rounding errors, which differ between the
+ * brute-force search and the BVH kernels
+ */
+static bool grazesEdge(const std::vector<const Mesh *> &meshes, const Ray3f &ray, float tMax) {
+    for (const Mesh *mesh : meshes) {
+        const MatrixXf &V = mesh->getVertexPositions();
+        const MatrixXu &F = mesh->getIndices();
+        for (uint32_t f = 0; f < mesh->getTriangleCount(); ++f) {
+            Point3f p0 = V.col(F(0, f)), p1 = V.col(F(1, f)), p2 = V.col(F(2, f));
+            Vector3f n = (p1 - p0).cross(p2 - p0);
+            float t = n.dot(p0 - ray.o) / n.dot(ray.d);
+            if (!(t >= ray.mint && t <= tMax))
+                continue;
+            Point3f p = ray(t);
+            float eps = DISTANCE_TOLERANCE * std::max(1.f, t);
+            if (segmentDistance(p, p0, p1) < eps || segmentDistance(p, p1, p2) < eps ||
+                segmentDistance(p, p2, p0) < eps)
+                return true;
+        }
+    }
+    return false;
+}
+
+/// Whether a hit at distance \c t matches the reference hit at distance \c tRef
+static bool sameHit(bool hit, float t, bool hitRef, float tRef) {
+    return hit == hitRef && (!hit || std::abs(t - tRef) <= DISTANCE_TOLERANCE * std::max(1.f, tRef));
+}
+
+/// Test rays and their closest intersections found by a brute-force search
+struct Reference {
+    std::vector<const Mesh *> meshes; ///< Meshes that the rays were traced against
+    std::vector<Ray3f> rays;
+    std::vector<float> t;             ///< Distance to the closest intersection (infinity if none)
+    std::vector<Ray3f> packets;       ///< Coherent rays, NORI_PACKET_SIZE per packet
+};
+
+/**
+ * Rays from within the (enlarged) bounding box of the BVH towards points in
+ * the bounding boxes of the meshes, a third of them ending at that point,
+ * and packets of rays towards small regions of the meshes
+ */
+static Reference createReference(const std::vector<const Mesh *> &meshes,
+        const BoundingBox3f &bbox, pcg32 &rng) {
+    auto randomPoint = [&rng](const BoundingBox3f &box, float margin) {
+        Point3f p;
+        for (int k = 0; k < 3; ++k)
+            p[k] = box.min[k] + (box.max[k] - box.min[k]) * ((1 + 2 * margin) * rng.nextFloat() - margin);
+        return p;
+    };
+
+    Reference ref;
+    ref.meshes = meshes;
+    for (int i = 0; i < RAY_COUNT; ++i) {
+        const BoundingBox3f &target = meshes[rng.nextUInt((uint32_t) meshes.size())]->getBoundingBox();
+        Point3f o = randomPoint(bbox, 0.2f), p = randomPoint(target, 0.f);
+        Ray3f ray(o, (p - o).normalized());
+        if (i % 3 == 0)
+            ray.maxt = (p - o).norm();
+        ref.rays.push_back(ray);
+        ref.t.push_back(bruteForce(meshes, ray));
+    }
+
+    for (int i = 0; i < RAY_COUNT / NORI_PACKET_SIZE; ++i) {
+        const BoundingBox3f &target = meshes[rng.nextUInt((uint32_t) meshes.size())]->getBoundingBox();
+        Point3f o = randomPoint(bbox, 0.2f), p = randomPoint(target, 0.f);
+        BoundingBox3f region(p, p + 0.05f * target.getExtents());
+        for (int j = 0; j < NORI_PACKET_SIZE; ++j)
+            ref.packets.push_back(Ray3f(o, (randomPoint(region, 0.f) - o).normalized()));
+    }
+    return ref;
+}
+
+/// Compare a BVH against the brute-force search, and its packets against single rays
+static bool check(const std::string &name, const Accel &accel, const Reference &ref) {
+    int bad = 0, badPackets = 0;
+    for (size_t i = 0; i < ref.rays.size(); ++i) {
+        const Ray3f &ray = ref.rays[i];
+        Intersection its, shadow;
+        bool hit = accel.rayIntersect(ray, its, false);
+        bool occluded = accel.rayIntersect(ray, shadow, true);
+        bool hitRef = std::isfinite(ref.t[i]);
+        if (sameHit(hit, its.t, hitRef, ref.t[i]) && occluded == hitRef)
+            continue;
+        float tMax = ray.maxt;
+        if (hit || hitRef)
+            tMax = (1 + DISTANCE_TOLERANCE) * std::max(hit ? its.t : 0.f, hitRef ? ref.t[i] : 0.f);
+        if (!grazesEdge(ref.meshes, ray, tMax))
+            ++bad;
+    }
+
+    for (size_t i = 0; i < ref.packets.size(); i += NORI_PACKET_SIZE) {
+        Intersection its[NORI_PACKET_SIZE];
+        uint32_t mask = (i / NORI_PACKET_SIZE) % 5 == 0 ? 0xA5u : (1u << NORI_PACKET_SIZE) - 1;
+        uint32_t hits = accel.rayIntersectPacket(&ref.packets[i], its, mask);
+        for (int j = 0; j < NORI_PACKET_SIZE; ++j) {
+            bool hit = (hits >> j) & 1;
+            if (!((mask >> j) & 1)) {
+                badPackets += hit;
+                continue;
+            }
+            Intersection single;
+            bool hitSingle = accel.rayIntersect(ref.packets[i + j], single, false);
+            if (!sameHit(hit, its[j].t, hitSingle, single.t) || (hit && its[j].mesh != single.mesh))
+                ++badPackets;
+        }
+    }
+
+    bool passed = bad == 0 && badPackets == 0;
+    cout << tfm::format("%-40s %4i rays, %4i packet rays differ  %s", name, bad, badPackets,
+        passed ? "passed" : "FAILED") << endl;
+    return passed;
+}
+
+/// BVH under test, with the meshes that are currently registered with it
+struct TestCase {
+    std::string name;
+    std::unique_ptr<Accel> accel;
+    std::vector<Mesh *> meshes;
+};
+
+/**
+ * Check BVHs with every layout, builder and node encoding against the same
+ * brute-force results, before and after refit(), addMesh() and removeMesh()
+ */
+static void testAccel(const std::vector<std::string> &filenames, int &passed, int &total) {
+    pcg32 rng;
+    std::vector<Transform> toWorld;
+    for (size_t i = 0; i < filenames.size(); ++i)
+        toWorld.push_back(fitToCube(filenames[i], randomPlacement(rng, 0.5f, i % 3 == 2)));
+
+    std::vector<TestCase> cases;
+    for (const char *layout : { "bvh2", "bvh4", "bvh8" }) {
+        for (const char *builder : { "sah", "sbvh", "lbvh" }) {
+            for (bool quantize : { false, true }) {
+                /* The binary layout has no quantized encoding */
+                if (quantize && std::string(layout) == "bvh2")
+                    continue;
+                PropertyList props;
+                props.setString("accel", layout);
+                props.setString("accelBuilder", builder);
+                props.setBoolean("accelQuantize", quantize);
+
+                TestCase c;
+                c.name = tfm::format("%s, %s%s", layout, builder, quantize ? ", quantized" : "");
+                c.accel.reset(new Accel(props));
+                for (size_t i = 0; i < filenames.size(); ++i) {
+                    c.meshes.push_back(loadMesh(filenames[i], toWorld[i]));
+                    c.accel->addMesh(c.meshes.back());
+                }
+                c.accel->build();
+                cases.push_back(std::move(c));
+            }
+        }
+    }
+
+    /* All BVHs contain the same geometry, so that they are compared against the same results */
+    auto checkAll = [&](const std::string &suffix) {
+        const TestCase &first = cases[0];
+        Reference ref = createReference(std::vector<const Mesh *>(
+            first.meshes.begin(), first.meshes.end()), first.accel->getBoundingBox(), rng);
+        for (const TestCase &c : cases) {
+            total++;
+            passed += check(c.name + suffix, *c.accel, ref);
+        }
+    };
+    checkAll("");
+
+    /* Move the first mesh */
+    for (TestCase &c : cases) {
+        Point3f center = c.meshes[0]->getBoundingBox().getCenter();
+        Eigen::Affine3f trafo = Eigen::Translation3f(center)
+            * Eigen::AngleAxisf(0.5f, Eigen::Vector3f(0.3f, 1.f, 0.2f).normalized())
+            * Eigen::Scaling(1.5f, 1.f, 1.f) * Eigen::Translation3f(-center);
+        c.meshes[0]->transform(Transform(trafo.matrix()));
+        c.accel->refit();
+    }
+    checkAll(", refit");
+
+    /* Replace the last mesh by a shifted copy, which gets a BVH of its own */
+    Transform shifted = fitToCube(filenames.back(),
+        Eigen::Translation3f(0.3f, 0.2f, 0.1f) * randomPlacement(rng, 0.5f, false));
+    for (TestCase &c : cases) {
+        c.accel->removeMesh(c.meshes.back());
+        c.meshes.back() = loadMesh(filenames.back(), shifted);
+        c.accel->addMesh(c.meshes.back());
+    }
+    checkAll(", removed/added");
+
+    /* Remove a mesh that was merged into the triangle BVH, then move the copy */
+    Transform offset(Eigen::Affine3f(Eigen::Translation3f(-0.2f, 0.f, 0.1f)).matrix());
+    for (TestCase &c : cases) {
+        if (c.meshes.size() > 2) {
+            c.accel->removeMesh(c.meshes[1]);
+            c.meshes.erase(c.meshes.begin() + 1);
+        }
+        c.meshes.back()->transform(offset);
+        c.accel->refit();
+    }
+    checkAll(", removed/refit");
+}
+
+/// Check BVHs over instances of the meshes against transformed copies of them
+static void testInstances(const std::vector<std::string> &filenames, int &passed, int &total) {
+    pcg32 rng;
+    std::vector<Transform> toWorld;
+    std::vector<std::unique_ptr<Mesh>> copies;
+    std::vector<const Mesh *> meshes;
+    BoundingBox3f bbox;
+    for (int i = 0; i < 12; ++i) {
+        const std::string &filename = filenames[i % filenames.size()];
+        toWorld.push_back(fitToCube(filename, randomPlacement(rng, 2.f, i % 3 == 0)));
+        copies.emplace_back(loadMesh(filename, toWorld.back()));
+        meshes.push_back(copies.back().get());
+        bbox.expandBy(copies.back()->getBoundingBox());
+    }
+    Reference ref = createReference(meshes, bbox, rng);
+
+    for (const char *layout : { "bvh2", "bvh4", "bvh8" }) {
+        PropertyList props;
+        props.setString("accel", layout);
+        Accel accel(props);
+        for (int i = 0; i < 12; ++i)
+            accel.addMesh(loadMesh(filenames[i % filenames.size()], toWorld[i], true));
+        accel.build();
+        total++;
+        passed += check(std::string(layout) + ", instances", accel, ref);
+    }
+}
+
+/**
+ * Scene with the meshes in front of the camera, a mirroring instance of the
+ * first mesh, a ground plane that extends behind the camera and an area light
+ */
+static Scene *createScene(const std::vector<std::string> &filenames, const std::string &integrator) {
+    Scene *scene = new Scene(PropertyList());
+    pcg32 rng;
+    for (size_t i = 0; i < filenames.size(); ++i) {
+        float x = 0.8f * i - 0.4f * (filenames.size() - 1);
+        Eigen::Affine3f trafo = Eigen::Translation3f(x, 0.f, 3.5f)
+            * Eigen::AngleAxisf(2 * M_PI * rng.nextFloat(), Eigen::Vector3f::UnitY())
+            * Eigen::Scaling(0.4f);
+        scene->addChild(loadMesh(filenames[i], fitToCube(filenames[i], trafo)));
+    }
+
+    PropertyList instanceProps;
+    instanceProps.setString("filename", filenames[0]);
+    instanceProps.setTransform("toWorld", fitToCube(filenames[0],
+        Eigen::Translation3f(0.5f, 0.3f, 2.8f) * Eigen::Scaling(0.2f)));
+    Mesh *instance = static_cast<Mesh *>(NoriObjectFactory::createInstance("instance", instanceProps));
+    instance->addChild(NoriObjectFactory::createInstance("mirror", PropertyList()));
+    instance->activate();
+    scene->addChild(instance);
+
+    Mesh *ground = new Quad(Point3f(-10.f, -0.6f, -10.f), Vector3f(0.f, 0.f, 20.f), Vector3f(20.f, 0.f, 0.f));
+    ground->activate();
+    scene->addChild(ground);
+
+    PropertyList emitterProps;
+    emitterProps.setColor("radiance", Color3f(10.f));
+    Mesh *light = new Quad(Point3f(-0.5f, 1.2f, 3.f), Vector3f(1.f, 0.f, 0.f), Vector3f(0.f, 0.f, 1.f));
+    light->addChild(NoriObjectFactory::createInstance("area", emitterProps));
+    light->activate();
+    scene->addChild(light);
+
+    PropertyList cameraProps;
+    cameraProps.setInteger("width", 256);
+    cameraProps.setInteger("height", 192);
+    NoriObject *camera = NoriObjectFactory::createInstance("perspective", cameraProps);
+    camera->activate();
+    scene->addChild(camera);
+    scene->addChild(NoriObjectFactory::createInstance(integrator, PropertyList()));
+    scene->activate();
+    return scene;
+}
+
+/// Compare the rasterized first hits of camera samples against ray tracing
+static bool testRasterizer(const std::vector<std::string> &filenames) {
+    std::unique_ptr<Scene> scene(createScene(filenames, "path"));
+    const Camera *camera = scene->getCamera();
+    Vector2i size = camera->getOutputSize();
+    Rasterizer rasterizer(scene.get());
+
+    pcg32 rng;
+    std::vector<Point2f> samples;
+    std::vector<Ray3f> rays;
+    std::vector<Intersection> its;
+    size_t bad = 0, total = 0;
+    for (int y0 = 0; y0 < size.y(); y0 += NORI_BLOCK_SIZE) {
+        for (int x0 = 0; x0 < size.x(); x0 += NORI_BLOCK_SIZE) {
+            samples.clear();
+            rays.clear();
+            for (int y = y0; y < std::min(y0 + NORI_BLOCK_SIZE, size.y()); ++y) {
+                for (int x = x0; x < std::min(x0 + NORI_BLOCK_SIZE, size.x()); ++x) {
+                    for (int i = 0; i < 4; ++i) {
+                        Point2f sample(x + rng.nextFloat(), y + rng.nextFloat());
+                        Ray3f ray;
+                        camera->sampleRay(ray, sample, Point2f(0.5f));
+                        samples.push_back(sample);
+                        rays.push_back(ray);
+                    }
+                }
+            }
+            its.resize(samples.size());
+            rasterizer.rayIntersect(samples.data(), rays.data(), its.data(), (uint32_t) samples.size());
+
+            for (size_t i = 0; i < samples.size(); ++i) {
+                Intersection ref;
+                bool hitRef = scene->rayIntersect(rays[i], ref);
+                bool hit = its[i].mesh != nullptr;
+                if (!sameHit(hit, its[i].t, hitRef, ref.t) || (hit && its[i].mesh != ref.mesh))
+                    ++bad;
+                ++total;
+            }
+        }
+    }
+
+    bool passed = bad <= RASTER_TOLERANCE * total;
+    cout << tfm::format("%-40s %4i of %i samples differ  %s", "rasterizer", bad, total,
+        passed ? "passed" : "FAILED") << endl;
+    return passed;
+}
+
+/// Compare the mean radiance of camera rays computed by LiStream() and Li()
+static bool testStreams(const std::vector<std::string> &filenames, const std::string &integratorName) {
+    std::unique_ptr<Scene> scene(createScene(filenames, integratorName));
+    Integrator *integrator = scene->getIntegrator();
+    integrator->preprocess(scene.get());
+    std::unique_ptr<Sampler> sampler(scene->getSampler()->clone());
+    const Camera *camera = scene->getCamera();
+    Vector2i size = camera->getOutputSize();
+
+    std::vector<Ray3f> rays;
+    std::vector<Color3f> weights;
+    for (int y = 0; y < size.y(); ++y) {
+        for (int x = 0; x < size.x(); ++x) {
+            Ray3f ray;
+            weights.push_back(camera->sampleRay(ray, Point2f(x + 0.5f, y + 0.5f), Point2f(0.5f)));
+            rays.push_back(ray);
+        }
+    }
+
+    std::vector<Color3f> stream(rays.size());
+    for (size_t i = 0; i < rays.size(); i += NORI_STREAM_SIZE)
+        integrator->LiStream(scene.get(), sampler.get(), &rays[i], &stream[i],
+            (uint32_t) std::min<size_t>(NORI_STREAM_SIZE, rays.size() - i));
+
+    /* The two estimates of a pixel are independent, so the t-test
+       is applied to their differences, whose expected value is 0 */
+    double mean = 0, variance = 0;
+    for (size_t i = 0; i < rays.size(); ++i) {
+        Color3f value = weights[i] * integrator->Li(scene.get(), sampler.get(), rays[i]);
+        Color3f streamValue = weights[i] * stream[i];
+        double result = (double) value.getLuminance() - (double) streamValue.getLuminance();
+
+        /* Numerically robust online variance estimation using an
+           algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
+        double delta = result - mean;
+        mean += delta / (double) (i+1);
+        variance += delta * (result - mean);
+    }
+    variance /= rays.size() - 1;
+
+    std::pair<bool, std::string> result = hypothesis::students_t_test(
+        mean, variance, 0.0, rays.size(), SIGNIFICANCE_LEVEL, 2);
+    cout << tfm::format("%-40s mean difference %.5f  %s", integratorName + " LiStream",
+        mean, result.first ? "passed" : "FAILED") << endl;
+    if (!result.first)
+        cout << result.second << endl;
+    return result.first;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        cerr << "Syntax: " << argv[0] << " <mesh.obj> [<mesh.obj> ...]" << endl;
+        return -1;
+    }
+    std::vector<std::string> filenames(argv + 1, argv + argc);
+    int passed = 0, total = 0;
+
+    /* The meshes are loaded many times */
+    setOBJCache(true);
+
+    try {
+        testAccel(filenames, passed, total);
+        testInstances(filenames, passed, total);
+        total++; passed += testRasterizer(filenames);
+        for (const char *integrator : { "path", "whitted" }) {
+            total++; passed += testStreams(filenames, integrator);
+        }
+    } catch (const std::exception &e) {
+        cerr << "Caught a critical exception: " << e.what() << endl;
+        return -1;
+    }
+
+    cout << "Passed " << passed << "/" << total << " tests." << endl;
+    return passed == total ? 0 : 1;
+}
@@ -3,6 +3,7 @@
 #include <nori/sampler.h>
 #include <nori/bsdf.h>
 #include <nori/emitter.h>
+#include <nori/raystream.h>
 
 NORI_NAMESPACE_BEGIN
 
@@ -18,16 +19,11 @@ public:
 	}
 
 	//returns true if the x and y are mutually visible
-	//if ray from x to y hits anything other than the y then it's invisible
-	//input : scene, point x on mesh, point y on emitter, pointer to mesh that y is on.
-	bool isVisible(const Scene *scene, const Point3f& x, const Point3f& y, const Mesh* yMesh) const
+	//if the segment from x to y hits anything before reaching y then it's invisible
+	//input : scene, point x on mesh, point y on emitter.
+	bool isVisible(const Scene *scene, const Point3f& x, const Point3f& y) const
 	{
-		Ray3f ray(x, y - x);
-		Intersection its;
-		//not using shadowRay here as i need to know what mesh it hit
-		scene->rayIntersect(ray, its);//it will definitely at least hit the mesh that y is on so no need to check return value
-		return yMesh == its.mesh;//only returns true if ray intersected with y (and so missed all other meshes)
-
+		return !scene->occluded(x, y);//any-hit query that stops just before y, so the emitter itself is not reported
 	}
 	//we assune that nx and ny are normalized
 	float geometricTerm(const Vector3f& nx, const Vector3f& ny, const Point3f& x, const Point3f& y) const
@@ -37,34 +33,32 @@ public:
 		return  (std::abs(nx.dot(xToY))*std::abs(ny.dot(yToX))) / ((x - y).squaredNorm());
 	}
 
-	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+	//samples the reflected/refracted ray at a non-diffuse vertex its (hit by ray) and its weight.
+	//returns false if the path terminates here
+	bool sampleSpecular(Sampler *sampler, const Ray3f &ray, const Intersection &its, Ray3f &next, Color3f &weight) const
 	{
-		Intersection its;
-		if (!scene->rayIntersect(ray, its))
+		const BSDF* bsdf = its.mesh->getBSDF();
+		BSDFQueryRecord record(its.shFrame.toLocal((-ray.d).normalized()));
+		record.measure = EMeasure::ESolidAngle;
+		Color3f bsdfSample = bsdf->sample(record, sampler->next2D());
+		//now record would hold the refracted/reflected dir in wo
+		float sampleStuck = sampler->next1D();
+		if (sampleStuck >= 0.95f)
 		{
-			return Color3f(0.f);
+			//in case algorithm gets stuck in reflection/refraction events
+			return false;
 		}
-		Point3f x = its.p; //where the ray hits the mesh
+		weight = (1.f / 0.95f) * bsdfSample;
+		next = Ray3f(its.p, its.shFrame.toWorld(record.wo));
+		return true;
+	}
 
+	//samples a point y on one of the emitters for the diffuse vertex its (hit by ray).
+	//returns false if y doesn't light its, otherwise the radiance reaches its if y is visible
+	bool sampleLight(Sampler *sampler, const Ray3f &ray, const Intersection &its, Point3f &y, Color3f &radiance) const
+	{
+		Point3f x = its.p; //where the ray hits the mesh
 		const BSDF* bsdf = its.mesh->getBSDF();
-		if (its.mesh->isEmitter())
-		{
-			return its.mesh->getEmitter()->getRadiance();
-		}
-		if (!bsdf->isDiffuse())
-		{
-			BSDFQueryRecord record(its.shFrame.toLocal((-ray.d).normalized()));
-			record.measure = EMeasure::ESolidAngle;
-			Color3f bsdfSample = bsdf->sample(record, sampler->next2D());
-			//now record would hold the refracted/reflected dir in wo
-			float sampleStuck = sampler->next1D();
-			if (sampleStuck >= 0.95f)
-			{
-				//in case algorithm gets stuck in reflection/refraction events
-				return Color3f(0.0f);
-			}
-			return (1.f / 0.95f) * bsdfSample * Li(scene, sampler, Ray3f(x, its.shFrame.toWorld(record.wo)));
-		}
 
 		//now we sample a point on one of the emitters
 		float sample = sampler->next1D();
@@ -76,7 +70,7 @@ public:
 		SurfaceSample surfSample = emitterMeshes[emitterIdx]->getSurfaceSample(sampler->next2D(), sampler->next1D());
 
 		//make sure that light is only emitted from the positive direction of the n on the emitter mesh
-		if ((surfSample.n.dot(x - surfSample.p)) <= 0.0f) { return Color3f(0.0f); }
+		if ((surfSample.n.dot(x - surfSample.p)) <= 0.0f) { return false; }
 
 		//the record holds ray from emitter to x on mesh and ray from camera.
 		BSDFQueryRecord record(its.shFrame.toLocal((surfSample.p - x).normalized()), its.shFrame.toLocal((-ray.d).normalized()), EMeasure::ESolidAngle);
@@ -84,21 +78,114 @@ public:
 
 		//now to calculate Le(y,y->x)
 		Color3f Le = emitterMeshes[emitterIdx]->getEmitter()->getRadiance();//radiance is uniform on the entire area
-		if (!isVisible(scene, x, surfSample.p, emitterMeshes[emitterIdx]))
-		{
-			return Color3f(0.0f);
-		}
+
 		//now we calculate G(x<->y)
 		Vector3f nx = its.shFrame.n;
 		Vector3f ny = surfSample.n;
 		nx.normalize();
 		ny.normalize();
-		Point3f y = surfSample.p;
+		y = surfSample.p;
 		float g = geometricTerm(nx, ny, x, y);
 
-		return (g * fr * Le) / surfSample.pdf;
+		radiance = (g * fr * Le) / surfSample.pdf;
+		return true;
 	}
 
+	Color3f Li(const Scene *scene, Sampler *sampler, const Ray3f &ray) const
+	{
+		Intersection its;
+		if (!scene->rayIntersect(ray, its))
+		{
+			return Color3f(0.f);
+		}
+
+		const BSDF* bsdf = its.mesh->getBSDF();
+		if (its.mesh->isEmitter())
+		{
+			return its.mesh->getEmitter()->getRadiance();
+		}
+		if (!bsdf->isDiffuse())
+		{
+			Ray3f next;
+			Color3f weight;
+			if (!sampleSpecular(sampler, ray, its, next, weight))
+				return Color3f(0.0f);
+			return weight * Li(scene, sampler, next);
+		}
+
+		Point3f y;
+		Color3f radiance;
+		if (!sampleLight(sampler, ray, its, y, radiance) || !isVisible(scene, its.p, y))
+		{
+			return Color3f(0.0f);
+		}
+		return radiance;
+	}
+
+	/// Same estimator as Li(), but all samples advance one specular bounce at a time
+	void LiStream(const Scene *scene, Sampler *sampler, const Ray3f *rays,
+			Color3f *result, uint32_t count) const {
+		std::vector<Ray3f> paths(rays, rays + count);
+		std::vector<Color3f> throughput(count, Color3f(1.f)), lightSample(count);
+		std::vector<uint32_t> active(count), shadowIndex(count);
+		for (uint32_t i = 0; i < count; ++i) {
+			result[i] = Color3f(0.f);
+			active[i] = i;
+		}
+
+		RayStream stream(scene), shadowRays(scene);
+		while (!active.empty()) {
+			stream.clear();
+			for (uint32_t i : active)
+				stream.addRay(paths[i]);
+			stream.trace();
+
+			/* Paths that continue after a specular bounce */
+			std::vector<uint32_t> next;
+			std::vector<uint32_t> shaded;
+			shadowRays.clear();
+
+			for (uint32_t j = 0; j < (uint32_t) active.size(); ++j) {
+				uint32_t i = active[j];
+				if (!stream.hit(j))
+					continue;
+				const Intersection &its = stream.getIntersection(j);
+
+				if (its.mesh->isEmitter()) {
+					result[i] += throughput[i] * its.mesh->getEmitter()->getRadiance();
+					continue;
+				}
+				if (!its.mesh->getBSDF()->isDiffuse()) {
+					Color3f weight;
+					if (!sampleSpecular(sampler, paths[i], its, paths[i], weight))
+						continue;
+					throughput[i] *= weight;
+					next.push_back(i);
+					continue;
+				}
+
+				/* The contribution is added once the visibility is known */
+				Point3f y;
+				Color3f radiance;
+				if (!sampleLight(sampler, paths[i], its, y, radiance))
+					continue;
+				lightSample[i] = throughput[i] * radiance;
+				shadowIndex[i] = shadowRays.addShadowRay(its.p, y);
+				shaded.push_back(i);
+			}
+
+			shadowRays.trace();
+			for (uint32_t i : shaded) {
+				if (!shadowRays.hit(shadowIndex[i]))
+					result[i] += lightSample[i];
+			}
+
+			active.swap(next);
+		}
+	}
+
+	bool supportsRayStreams() const { return true; }
+
 	std::string toString() const {
 		return "WhittedIntegrator[]";
 	}
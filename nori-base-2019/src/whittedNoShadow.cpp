@@ -18,16 +18,11 @@ public:
 	}
 
 	//returns true if the x and y are mutually visible
-	//if ray from x to y hits anything other than the y then it's invisible
-	//input : scene, point x on mesh, point y on emitter, pointer to mesh that y is on.
-	bool isVisible(const Scene *scene, const Point3f& x, const Point3f& y, const Mesh* yMesh) const
+	//if the segment from x to y hits anything before reaching y then it's invisible
+	//input : scene, point x on mesh, point y on emitter.
+	bool isVisible(const Scene *scene, const Point3f& x, const Point3f& y) const
 	{
-		Ray3f ray(x, y - x);
-		Intersection its;
-		//not using shadowRay here as i need to know what mesh it hit
-		scene->rayIntersect(ray, its);//it will definitely at least hit the mesh that y is on so no need to check return value
-		return yMesh == its.mesh;//only returns true if ray intersected with y (and so missed all other meshes)
-
+		return !scene->occluded(x, y);//any-hit query that stops just before y, so the emitter itself is not reported
 	}
 	//we assune that nx and ny are normalized
 	float geometricTerm(const Vector3f& nx, const Vector3f& ny, const Point3f& x, const Point3f& y) const
@@ -84,7 +79,7 @@ public:
 
 		//now to calculate Le(y,y->x)
 		Color3f Le = emitterMeshes[emitterIdx]->getEmitter()->getRadiance();//radiance is uniform on the entire area
-		/*if (!isVisible(scene, x, surfSample.p, emitterMeshes[emitterIdx]))
+		/*if (!isVisible(scene, x, surfSample.p))
 		{
 			return Color3f(0.0f);
 		}*/